@@ -0,0 +1,80 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Compares worker placement: unpinned threads against workers pinned one per
+# CPU, without steering and with each steering mode. cross_cpu_pct is the
+# share of connections accepted by a worker on another CPU than the one the
+# kernel handled their packets on. On loopback that is the client's CPU, so
+# spread the load generator too (CLIENT_CPUS) to get a mix worth steering.
+
+HOST=127.0.0.1
+PORT=${PORT:-9191}
+SECONDS_PER_RUN=${1:-5}
+CPUS=${CPUS:-0-$(($(nproc) - 1))}
+CLIENT_CPUS=${CLIENT_CPUS:-$CPUS}
+ENGINE=${ENGINE:-epoll}
+CLK_TCK=$(getconf CLK_TCK)
+SERVER_PID=
+
+# One worker per listed CPU, so every mode runs the same number of threads.
+threads=$(echo "$CPUS" | tr ',' '\n' |
+  awk -F- '{ n += (NF == 2 ? $2 - $1 + 1 : 1) } END { print n }')
+
+run_mode() {
+  local mode=$1
+  shift
+  ./bin/server "$PORT" --engine="$ENGINE" --threads "$threads" \
+    --rate 0 --burst 1 --ip-rate 0 --ip-burst 1 "$@" >/dev/null &
+  SERVER_PID=$!
+  sleep 0.5
+
+  report "$mode" connect_storm -k -c 64
+  report "$mode" pipelined -c 64 -d 16
+
+  kill "$SERVER_PID"
+  wait "$SERVER_PID" 2>/dev/null || true
+  sleep 0.5
+}
+
+server_cpu_ticks() {
+  sed 's/^.*) //' "/proc/$SERVER_PID/stat" | awk '{ print $12 + $13 }'
+}
+
+stat_value() {
+  ./bin/client "$HOST" "$PORT" STATS | sed -n "s/^$1=//p"
+}
+
+report() {
+  local mode=$1
+  local scenario=$2
+  shift 2
+  local before out after local_before cross_before
+  before=$(server_cpu_ticks)
+  local_before=$(stat_value accepted_local_cpu)
+  cross_before=$(stat_value accepted_cross_cpu)
+  out=$(taskset -c "$CLIENT_CPUS" ./bin/loadgen "$HOST" "$PORT" -t "$SECONDS_PER_RUN" "$@")
+  after=$(server_cpu_ticks)
+  local local_n cross_n
+  local_n=$(($(stat_value accepted_local_cpu) - local_before))
+  cross_n=$(($(stat_value accepted_cross_cpu) - cross_before))
+  local count
+  if [ "$scenario" = connect_storm ]; then
+    count=$(echo "$out" | sed -n 's/^connects=//p')
+  else
+    count=$(echo "$out" | sed -n 's/^completed=//p')
+  fi
+  local cpu cross
+  cpu=$(awk -v t=$((after - before)) -v hz="$CLK_TCK" -v n="$count" \
+    'BEGIN { printf "%.2f", (n > 0 ? t * 1000000 / hz / n : 0) }')
+  cross=$(awk -v l="$local_n" -v c="$cross_n" \
+    'BEGIN { printf "%.1f", (l + c > 0 ? 100 * c / (l + c) : 0) }')
+  echo "$out" |
+    grep -E '^(requests_per_sec|latency_us_p50|latency_us_p99)=' |
+    paste -sd' ' - |
+    sed "s/^/mode=$mode scenario=$scenario /; s/\$/ cross_cpu_pct=$cross server_cpu_us_per_request=$cpu/"
+}
+
+run_mode unpinned
+run_mode pinned --cpus "$CPUS"
+run_mode incoming-cpu --cpus "$CPUS" --steer incoming-cpu
+run_mode cbpf --cpus "$CPUS" --steer cbpf
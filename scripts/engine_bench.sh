@@ -0,0 +1,63 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Runs the same loadgen scenarios against each server I/O engine in turn.
+# Rate limiting is switched off at startup so it measures the engines, not
+# the token buckets. server_cpu_us_per_request is the server's user+system time
+# over the run divided by completed requests (connects for connect_storm), so
+# the engines' per-request framework overhead can be compared directly.
+
+HOST=127.0.0.1
+PORT=${PORT:-9190}
+SECONDS_PER_RUN=${1:-5}
+THREADS=${THREADS:-1}
+CLK_TCK=$(getconf CLK_TCK)
+SERVER_PID=
+
+run_engine() {
+  local engine=$1
+  ./bin/server "$PORT" --threads "$THREADS" --engine="$engine" \
+    --rate 0 --burst 1 --ip-rate 0 --ip-burst 1 >/dev/null &
+  SERVER_PID=$!
+  sleep 0.5
+
+  report "$engine" depth1 -c 32 -d 1
+  report "$engine" pipelined -c 32 -d 32
+  report "$engine" echo4k -c 32 -d 8 -b -m echo:1 -s 4096
+  report "$engine" connect_storm -k -c 64
+
+  kill "$SERVER_PID"
+  sleep 0.5
+}
+
+# utime + stime in clock ticks; the comm field is skipped by cutting at ')'.
+server_cpu_ticks() {
+  sed 's/^.*) //' "/proc/$SERVER_PID/stat" | awk '{ print $12 + $13 }'
+}
+
+report() {
+  local engine=$1
+  local scenario=$2
+  shift 2
+  local before out after
+  before=$(server_cpu_ticks)
+  out=$(./bin/loadgen "$HOST" "$PORT" -t "$SECONDS_PER_RUN" "$@")
+  after=$(server_cpu_ticks)
+  local count
+  if [ "$scenario" = connect_storm ]; then
+    count=$(echo "$out" | sed -n 's/^connects=//p')
+  else
+    count=$(echo "$out" | sed -n 's/^completed=//p')
+  fi
+  local cpu
+  cpu=$(awk -v t=$((after - before)) -v hz="$CLK_TCK" -v n="$count" \
+    'BEGIN { printf "%.2f", (n > 0 ? t * 1000000 / hz / n : 0) }')
+  echo "$out" |
+    grep -E '^(requests_per_sec|latency_us_p50|latency_us_p99)=' |
+    paste -sd' ' - |
+    sed "s/^/engine=$engine scenario=$scenario /; s/\$/ server_cpu_us_per_request=$cpu/"
+}
+
+run_engine libevent
+run_engine uring
+run_engine epoll
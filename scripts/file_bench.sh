@@ -0,0 +1,58 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Downloads one file repeatedly with FILE against each engine, zero-copy
+# (the default: sendfile or a mapped segment), with --file-copy (pread into
+# the output evbuffer) and with --file-cache 0 (open and stat per request).
+# server_cpu_ms is the server's user+system time over the run.
+
+HOST=127.0.0.1
+PORT=${PORT:-9191}
+FILE_MB=${1:-64}
+REPEAT=${2:-16}
+CLK_TCK=$(getconf CLK_TCK)
+ROOT=$(mktemp -d)
+SERVER_PID=
+
+cleanup() {
+  if [ -n "$SERVER_PID" ]; then
+    kill "$SERVER_PID" 2>/dev/null || true
+  fi
+  rm -rf "$ROOT"
+}
+trap cleanup EXIT
+
+head -c "$((FILE_MB * 1024 * 1024))" /dev/urandom >"$ROOT/blob"
+
+server_cpu_ticks() {
+  sed 's/^.*) //' "/proc/$SERVER_PID/stat" | awk '{ print $12 + $13 }'
+}
+
+run() {
+  local engine=$1
+  local mode=$2
+  shift 2
+  ./bin/server "$PORT" --engine="$engine" --file-root "$ROOT" \
+    --rate 0 --burst 1 "$@" >/dev/null &
+  SERVER_PID=$!
+  sleep 0.5
+  # Warm the page cache (and the fd cache) before measuring.
+  ./bin/client --file blob "$HOST" "$PORT" >/dev/null
+  local before out after cpu
+  before=$(server_cpu_ticks)
+  out=$(./bin/client --file blob --repeat "$REPEAT" "$HOST" "$PORT")
+  after=$(server_cpu_ticks)
+  cpu=$(awk -v t=$((after - before)) -v hz="$CLK_TCK" 'BEGIN { printf "%.0f", t * 1000 / hz }')
+  echo "$out" |
+    grep -E '^mib_per_sec=' |
+    sed "s/^/engine=$engine mode=$mode /; s/\$/ server_cpu_ms=$cpu/"
+  kill "$SERVER_PID"
+  wait "$SERVER_PID" 2>/dev/null || true
+  SERVER_PID=
+}
+
+for engine in libevent uring epoll; do
+  run "$engine" zero_copy
+  run "$engine" copy --file-copy
+  run "$engine" uncached --file-cache 0
+done
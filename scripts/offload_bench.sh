@@ -0,0 +1,38 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Runs a PING-heavy mix with a slice of STATS against a server that answers
+# STATS inline and one that offloads it, so the cost of heavy commands to
+# everyone else on the loop shows up in the latency columns. Rate limiting is
+# switched off at startup so it measures the loop, not the token buckets.
+
+HOST=127.0.0.1
+PORT=${PORT:-9191}
+SECONDS_PER_RUN=${1:-5}
+THREADS=${THREADS:-1}
+OFFLOAD_THREADS=${OFFLOAD_THREADS:-2}
+
+report() {
+  local offload=$1
+  local scenario=$2
+  shift 2
+  ./bin/loadgen "$HOST" "$PORT" -t "$SECONDS_PER_RUN" "$@" |
+    grep -E '^(requests_per_sec|latency_us_p50|latency_us_p99)=' |
+    paste -sd' ' - |
+    sed "s/^/offload_threads=$offload scenario=$scenario /"
+}
+
+for offload in 0 "$OFFLOAD_THREADS"; do
+  ./bin/server "$PORT" --threads "$THREADS" --offload-threads "$offload" \
+    --rate 0 --burst 1 --ip-rate 0 --ip-burst 1 >/dev/null &
+  SERVER_PID=$!
+  trap 'kill "$SERVER_PID" 2>/dev/null || true' EXIT
+  sleep 0.5
+
+  report "$offload" ping_only -c 32 -d 4 -m ping:1
+  report "$offload" stats_1pct -c 32 -d 4 -m ping:99,stats:1
+  report "$offload" stats_10pct -c 32 -d 4 -m ping:9,stats:1
+
+  kill "$SERVER_PID"
+  wait "$SERVER_PID" 2>/dev/null || true
+done
@@ -0,0 +1,53 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Handshake rates against the TLS listener with a throwaway self-signed
+# certificate: full handshakes (openssl s_time -new) against resumed ones
+# (-reuse, TLS 1.2 session IDs from the server cache), then full TLS 1.3
+# handshakes. s_time never reads the TLS 1.3 tickets sent after the
+# handshake, so it cannot measure 1.3 resumption. The server's own counters
+# are printed after each run. Arguments after the run length go to the
+# server (for example --tls-cache 0).
+
+HOST=127.0.0.1
+PORT=${PORT:-9192}
+SECONDS_PER_RUN=${1:-5}
+shift || true
+DIR=$(mktemp -d)
+SERVER_PID=
+
+cleanup() {
+  if [ -n "$SERVER_PID" ]; then
+    kill "$SERVER_PID" 2>/dev/null || true
+  fi
+  rm -rf "$DIR"
+}
+trap cleanup EXIT
+
+openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:P-256 -nodes \
+  -keyout "$DIR/key.pem" -out "$DIR/cert.pem" -days 1 -subj /CN=localhost 2>/dev/null
+
+./bin/server "$PORT" --tls-cert "$DIR/cert.pem" --tls-key "$DIR/key.pem" "$@" >/dev/null &
+SERVER_PID=$!
+sleep 0.5
+
+tls_stats() {
+  # s_client exits at end of input, so hold stdin open for the reply.
+  (printf 'STATS\n'; sleep 0.3) |
+    openssl s_client -connect "$HOST:$PORT" -quiet 2>/dev/null |
+    grep -E '^tls_(full|resumed)_handshakes=' | paste -sd' ' -
+}
+
+run() {
+  local version=$1
+  local mode=$2
+  local rate
+  rate=$(openssl s_time -connect "$HOST:$PORT" "-$version" "-$mode" -time "$SECONDS_PER_RUN" 2>/dev/null |
+    sed -n 's/^\([0-9]*\) connections in \([0-9]*\) real seconds.*/\1 \2/p' |
+    awk '{ printf "%.0f", ($2 > 0 ? $1 / $2 : 0) }')
+  echo "version=$version mode=$mode handshakes_per_sec=$rate $(tls_stats)"
+}
+
+run tls1_2 new
+run tls1_2 reuse
+run tls1_3 new
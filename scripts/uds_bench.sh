@@ -0,0 +1,43 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Runs the same loadgen scenarios over loopback TCP and over the --unix
+# socket of one server, so both transports see the same workers and state.
+# Rate limiting is switched off at startup so it measures the transports,
+# not the token buckets.
+
+HOST=127.0.0.1
+PORT=${PORT:-9190}
+SOCK=${SOCK:-/tmp/netloop-bench.sock}
+SECONDS_PER_RUN=${1:-5}
+THREADS=${THREADS:-1}
+
+./bin/server "$PORT" --unix "$SOCK" --threads "$THREADS" \
+  --rate 0 --burst 1 --ip-rate 0 --ip-burst 1 >/dev/null &
+SERVER_PID=$!
+trap 'kill "$SERVER_PID" 2>/dev/null; rm -f "$SOCK"' EXIT
+sleep 0.5
+
+report() {
+  local transport=$1
+  local scenario=$2
+  shift 2
+  local target
+  if [ "$transport" = unix ]; then
+    target=(--unix "$SOCK")
+  else
+    target=("$HOST" "$PORT")
+  fi
+  ./bin/loadgen "${target[@]}" -t "$SECONDS_PER_RUN" "$@" |
+    grep -E '^(requests_per_sec|latency_us_p50|latency_us_p99)=' |
+    paste -sd' ' - |
+    sed "s/^/transport=$transport scenario=$scenario /"
+}
+
+for transport in tcp unix; do
+  report "$transport" depth1 -c 1 -d 1
+  report "$transport" depth1_c32 -c 32 -d 1
+  report "$transport" pipelined -c 32 -d 32
+  report "$transport" echo4k -c 32 -d 8 -b -m echo:1 -s 4096
+  report "$transport" connect_storm -k -c 64
+done
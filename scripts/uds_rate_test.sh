@@ -0,0 +1,41 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Checks that clients on the --unix socket do not share a per-IP bucket:
+# with an IP burst of 2, two socket clients sending 4 PINGs each must all get
+# PONG, while two loopback TCP clients doing the same must hit 429 SLOWDOWN.
+# Exits non-zero on failure.
+
+PORT=${PORT:-9195}
+SOCK=${SOCK:-/tmp/netloop-rate-test.sock}
+
+./bin/server "$PORT" --unix "$SOCK" \
+  --rate 0 --burst 1 --ip-rate 1 --ip-burst 2 >/dev/null &
+SERVER_PID=$!
+trap 'kill "$SERVER_PID" 2>/dev/null || true; rm -f "$SOCK"' EXIT
+sleep 0.5
+
+pings() {
+  printf 'PING\nPING\nPING\nPING\n' | ./bin/client "$@"
+}
+
+fail=0
+for client in a b; do
+  limited=$(pings --unix "$SOCK" | grep -c '^429' || true)
+  echo "transport=unix client=$client rate_limited=$limited"
+  [ "$limited" -eq 0 ] || fail=1
+done
+
+limited=0
+for client in a b; do
+  n=$(pings 127.0.0.1 "$PORT" | grep -c '^429' || true)
+  echo "transport=tcp client=$client rate_limited=$n"
+  limited=$((limited + n))
+done
+[ "$limited" -gt 0 ] || fail=1
+
+if [ "$fail" -ne 0 ]; then
+  echo "result=FAIL"
+  exit 1
+fi
+echo "result=PASS"
@@ -0,0 +1,86 @@
+#include "chat_room.h"
+
+#include <event2/buffer.h>
+#include <stdlib.h>
+#include <string.h>
+
+void chat_room_join(struct chat_room *room, struct chat_member *m) {
+    m->next = room->members;
+    room->members = m;
+    room->count++;
+}
+
+void chat_room_leave(struct chat_room *room, struct chat_member *m) {
+    struct chat_member **cur = &room->members;
+    while (*cur) {
+        if (*cur == m) {
+            *cur = m->next;
+            room->count--;
+            return;
+        }
+        cur = &(*cur)->next;
+    }
+}
+
+struct chat_member *chat_room_find(const struct chat_room *room, const char *name) {
+    for (struct chat_member *cur = room->members; cur; cur = cur->next) {
+        if (strcmp(cur->name, name) == 0) {
+            return cur;
+        }
+    }
+    return NULL;
+}
+
+int chat_room_name_in_use(const struct chat_room *room, const char *name,
+    const struct chat_member *self) {
+    for (struct chat_member *cur = room->members; cur; cur = cur->next) {
+        if (cur != self && strcmp(cur->name, name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// One immutable copy of a broadcast line, shared by every output it was
+// added to. The room lives on one event loop, so the count needs no atomics.
+struct chat_msg {
+    size_t refs;
+    char data[];
+};
+
+static void chat_msg_unref(struct chat_msg *msg) {
+    if (--msg->refs == 0) {
+        free(msg);
+    }
+}
+
+// Called by an output once it has drained (or freed) its reference.
+static void chat_msg_release(const void *data, size_t len, void *arg) {
+    (void)data;
+    (void)len;
+    chat_msg_unref(arg);
+}
+
+// The broadcast holds its own reference while it fans out, so a failed add
+// (which does not call the cleanup) cannot free the line under the rest.
+void chat_room_broadcast(const struct chat_room *room, const char *line, size_t len) {
+    if (len < CHAT_BROADCAST_REF_MIN) {
+        for (struct chat_member *cur = room->members; cur; cur = cur->next) {
+            evbuffer_add(cur->out, line, len);
+        }
+        return;
+    }
+    struct chat_msg *msg = malloc(sizeof(*msg) + len);
+    if (!msg) {
+        return;
+    }
+    memcpy(msg->data, line, len);
+    msg->refs = 1;
+    for (struct chat_member *cur = room->members; cur; cur = cur->next) {
+        msg->refs++;
+        if (evbuffer_add_reference(cur->out, msg->data, len, chat_msg_release, msg) < 0) {
+            msg->refs--;
+        }
+    }
+    chat_msg_unref(msg);
+}
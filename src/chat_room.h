@@ -0,0 +1,43 @@
+#ifndef NETLOOP_CHAT_ROOM_H
+#define NETLOOP_CHAT_ROOM_H
+
+#include <stddef.h>
+
+struct evbuffer;
+
+// Membership and fan-out for the chat server. A member is just a name and
+// the output buffer its lines go to, so the room works on any evbuffer.
+
+#define CHAT_MAX_NAME 32
+#define CHAT_BROADCAST_REF_MIN 256
+
+struct chat_member {
+    struct evbuffer *out;
+    char name[CHAT_MAX_NAME];
+    void *owner; // the caller's connection
+    struct chat_member *next;
+};
+
+struct chat_room {
+    struct chat_member *members;
+    size_t count;
+};
+
+void chat_room_join(struct chat_room *room, struct chat_member *m);
+void chat_room_leave(struct chat_room *room, struct chat_member *m);
+
+struct chat_member *chat_room_find(const struct chat_room *room, const char *name);
+
+// Whether a member other than self already uses the name.
+int chat_room_name_in_use(const struct chat_room *room, const char *name,
+    const struct chat_member *self);
+
+// Appends the line to every member's output, sender included. A line of at
+// least CHAT_BROADCAST_REF_MIN bytes is copied once and every output
+// references that copy, so it costs one line plus a chain descriptor per
+// member; the copy is freed when the last output has drained it. Shorter
+// lines are copied into each output: the bytes are no more than a
+// descriptor would cost, and they pack into the chain already there.
+void chat_room_broadcast(const struct chat_room *room, const char *line, size_t len);
+
+#endif
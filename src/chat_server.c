@@ -12,17 +12,17 @@
 #include <sys/types.h>
 #include <unistd.h>
 
-#define MAX_LINE 1024
-#define MAX_NAME 32
+#include "chat_room.h"
+#include "log.h"
 
+#define MAX_LINE 1024
 struct client {
     struct bufferevent *bev;
-    char name[MAX_NAME];
+    struct chat_member member;
     char peer[NI_MAXHOST + NI_MAXSERV + 2];
-    struct client *next;
 };
 
-static struct client *g_clients = NULL;
+static struct chat_room g_room;
 static unsigned long g_next_id = 1;
 
 static void format_peer(const struct sockaddr_storage *addr, socklen_t addr_len,
@@ -94,79 +94,31 @@ static int create_listener_socket(const char *port) {
     return fd;
 }
 
-static void add_client(struct client *c) {
-    c->next = g_clients;
-    g_clients = c;
-}
-
-static void remove_client(struct client *c) {
-    struct client **cur = &g_clients;
-    while (*cur) {
-        if (*cur == c) {
-            *cur = c->next;
-            return;
-        }
-        cur = &(*cur)->next;
-    }
-}
-
-static int name_in_use(const char *name, struct client *self) {
-    struct client *cur = g_clients;
-    while (cur) {
-        if (cur != self && strcmp(cur->name, name) == 0) {
-            return 1;
-        }
-        cur = cur->next;
-    }
-    return 0;
-}
-
 static void send_line(struct client *c, const char *line) {
     bufferevent_write(c->bev, line, strlen(line));
 }
 
-static void broadcast_line(const char *line) {
-    struct client *cur = g_clients;
-    while (cur) {
-        bufferevent_write(cur->bev, line, strlen(line));
-        cur = cur->next;
-    }
-}
-
-static struct client *find_client(const char *name) {
-    struct client *cur = g_clients;
-    while (cur) {
-        if (strcmp(cur->name, name) == 0) {
-            return cur;
-        }
-        cur = cur->next;
-    }
-    return NULL;
-}
-
 static void handle_line(struct client *c, char *line) {
     if (strncmp(line, "/nick ", 6) == 0) {
         const char *new_name = line + 6;
-        if (new_name[0] == '\0' || strlen(new_name) >= MAX_NAME) {
+        if (new_name[0] == '\0' || strlen(new_name) >= CHAT_MAX_NAME) {
             send_line(c, "ERR bad_nick\n");
             return;
         }
-        if (name_in_use(new_name, c)) {
+        if (chat_room_name_in_use(&g_room, new_name, &c->member)) {
             send_line(c, "ERR name_in_use\n");
             return;
         }
-        snprintf(c->name, sizeof(c->name), "%s", new_name);
+        snprintf(c->member.name, sizeof(c->member.name), "%s", new_name);
         send_line(c, "OK nick\n");
         return;
     }
 
     if (strcmp(line, "/who") == 0) {
-        struct client *cur = g_clients;
-        while (cur) {
+        for (struct chat_member *cur = g_room.members; cur; cur = cur->next) {
             char out[MAX_LINE];
             snprintf(out, sizeof(out), "USER %s\n", cur->name);
             send_line(c, out);
-            cur = cur->next;
         }
         return;
     }
@@ -185,17 +137,19 @@ static void handle_line(struct client *c, char *line) {
             return;
         }
 
-        struct client *dst = find_client(target);
-        if (!dst) {
+        struct chat_member *m = chat_room_find(&g_room, target);
+        if (!m) {
             send_line(c, "ERR no_such_user\n");
             return;
         }
+        struct client *dst = m->owner;
 
-        printf("chat: route dm %s(%s) -> %s(%s)\n",
-            c->name, c->peer, dst->name, dst->peer);
+        // Routing is per message; cap it so a chatty room cannot flood the log.
+        LOG_RATELIMIT(LOG_INFO, 100, "chat: route dm %s(%s) -> %s(%s)",
+            c->member.name, c->peer, dst->member.name, dst->peer);
         {
             char out[MAX_LINE];
-            snprintf(out, sizeof(out), "DM %s: %s\n", c->name, msg);
+            snprintf(out, sizeof(out), "DM %s: %s\n", c->member.name, msg);
             send_line(dst, out);
         }
         send_line(c, "OK sent\n");
@@ -204,9 +158,15 @@ static void handle_line(struct client *c, char *line) {
 
     {
         char out[MAX_LINE];
-        snprintf(out, sizeof(out), "%s: %s\n", c->name, line);
-        printf("chat: route broadcast %s(%s)\n", c->name, c->peer);
-        broadcast_line(out);
+        int len = snprintf(out, sizeof(out), "%s: %s\n", c->member.name, line);
+        if (len < 0) {
+            return;
+        }
+        if ((size_t)len >= sizeof(out)) {
+            len = (int)sizeof(out) - 1;
+        }
+        LOG_RATELIMIT(LOG_INFO, 100, "chat: route broadcast %s(%s)", c->member.name, c->peer);
+        chat_room_broadcast(&g_room, out, (size_t)len);
     }
 }
 
@@ -214,8 +174,10 @@ static void close_client(struct client *c) {
     if (!c) {
         return;
     }
-    printf("chat: leave %s %s\n", c->name, c->peer);
-    remove_client(c);
+    LOG(LOG_INFO, "chat: leave %s %s", c->member.name, c->peer);
+    if (c->member.out) {
+        chat_room_leave(&g_room, &c->member);
+    }
     if (c->bev) {
         bufferevent_free(c->bev);
     }
@@ -270,7 +232,7 @@ static void accept_cb(evutil_socket_t fd, short events, void *arg) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 return;
             }
-            perror("accept");
+            LOG_RATELIMIT(LOG_WARN, 1, "chat: accept: %s", strerror(errno));
             return;
         }
 
@@ -281,26 +243,34 @@ static void accept_cb(evutil_socket_t fd, short events, void *arg) {
         }
 
         format_peer(&client_addr, client_len, c->peer, sizeof(c->peer));
-        snprintf(c->name, sizeof(c->name), "anon%lu", g_next_id++);
-        add_client(c);
+        snprintf(c->member.name, sizeof(c->member.name), "anon%lu", g_next_id++);
+        c->member.owner = c;
 
         c->bev = bufferevent_socket_new(base, client_fd, BEV_OPT_CLOSE_ON_FREE);
         if (!c->bev) {
+            close(client_fd);
             close_client(c);
             continue;
         }
+        c->member.out = bufferevent_get_output(c->bev);
+        chat_room_join(&g_room, &c->member);
 
         bufferevent_setcb(c->bev, client_read_cb, NULL, client_event_cb, c);
         bufferevent_enable(c->bev, EV_READ | EV_WRITE);
 
-        printf("chat: join %s %s\n", c->name, c->peer);
+        LOG(LOG_INFO, "chat: join %s %s", c->member.name, c->peer);
         send_line(c, "INFO welcome\n");
     }
 }
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s <port>\n", argv[0]);
+    enum log_level log_level = LOG_INFO;
+    int bad_args = argc != 2 && argc != 4;
+    if (argc == 4) {
+        bad_args = strcmp(argv[2], "--log-level") != 0 || log_level_parse(argv[3], &log_level) < 0;
+    }
+    if (bad_args) {
+        fprintf(stderr, "usage: %s <port> [--log-level debug|info|warn|error]\n", argv[0]);
         return 1;
     }
 
@@ -343,11 +313,20 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    printf("chat server: listening on %s\n", argv[1]);
+    if (log_init(log_level) < 0) {
+        fprintf(stderr, "server: failed to start logger\n");
+        event_free(listen_event);
+        event_base_free(base);
+        close(listener_fd);
+        return 1;
+    }
+    log_attach_thread();
+    LOG(LOG_INFO, "chat server: listening on %s", argv[1]);
     event_base_dispatch(base);
 
     event_free(listen_event);
     event_base_free(base);
     close(listener_fd);
+    log_shutdown();
     return 0;
 }
@@ -1,14 +1,33 @@
 #include <errno.h>
 #include <netdb.h>
+#include <poll.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
 #define MAX_LINE 1024
-#define STATS_LINES 7
+// STATS LATENCY lines carry bucket lists and can exceed MAX_LINE.
+#define MAX_RESP_LINE 8192
+#define STATS_LINES 80
+#define LATENCY_LINES 9
+// STATS WORKERS: the first line carries the count of lines that follow.
+#define WORKERS_LINES -1
+// Binary framing; must match server.c.
+#define BIN_MAGIC 0xB1
+#define BIN_HEADER_LEN 12
+#define BIN_OP_PING 1
+#define BIN_OP_ECHO 2
+#define BIN_OP_STATS 3
+#define BIN_OP_QUIT 4
+#define BIN_OP_STATS_LATENCY 5
+#define STREAM_CHUNK (64 * 1024)
+#define FILE_PATH_MAX 256
 
 static int connect_to_server(const char *host, const char *port) {
     struct addrinfo hints;
@@ -52,6 +71,29 @@ static int connect_to_server(const char *host, const char *port) {
     return fd;
 }
 
+static int connect_unix(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "client: socket path too long\n");
+        return -1;
+    }
+    memcpy(addr.sun_path, path, strlen(path));
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "client: connect %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
 static int send_all(int fd, const char *buf, size_t len) {
     size_t sent = 0;
 
@@ -157,9 +199,22 @@ static int send_command_line(int fd, const char *cmd) {
     return 0;
 }
 
+static int response_lines(const char *cmd) {
+    if (strcmp(cmd, "STATS") == 0) {
+        return STATS_LINES;
+    }
+    if (strcmp(cmd, "STATS LATENCY") == 0) {
+        return LATENCY_LINES;
+    }
+    if (strcmp(cmd, "STATS WORKERS") == 0) {
+        return WORKERS_LINES;
+    }
+    return 1;
+}
+
 static int read_response_lines(int fd, unsigned int slow_ms, int lines) {
-    for (int i = 0; i < lines; i++) {
-        char resp[MAX_LINE];
+    for (int i = 0; i == 0 || i < lines; i++) {
+        char resp[MAX_RESP_LINE];
         ssize_t n = recv_line(fd, resp, sizeof(resp), slow_ms);
         if (n == 0) {
             printf("client: server closed\n");
@@ -170,52 +225,416 @@ static int read_response_lines(int fd, unsigned int slow_ms, int lines) {
             return -1;
         }
         printf("%s\n", resp);
+        // Rejections and errors are always a single line.
+        if (i == 0 && (strncmp(resp, "429 ", 4) == 0 || strncmp(resp, "ERR ", 4) == 0)) {
+            break;
+        }
+        int workers;
+        if (i == 0 && lines == WORKERS_LINES && sscanf(resp, "workers=%d", &workers) == 1) {
+            lines = 1 + workers;
+        }
+    }
+    return 0;
+}
+
+static int recv_exact(int fd, void *out, size_t len) {
+    size_t used = 0;
+    while (used < len) {
+        ssize_t n = recv(fd, (char *)out + used, len - used, 0);
+        if (n == 0) {
+            return 0;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        used += (size_t)n;
+    }
+    return 1;
+}
+
+static void store_be32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static uint32_t load_be32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// Maps a text command onto a binary opcode and payload.
+static int binary_opcode(const char *cmd, const char **payload) {
+    *payload = "";
+    if (strcmp(cmd, "PING") == 0) {
+        return BIN_OP_PING;
+    }
+    if (strncmp(cmd, "ECHO ", 5) == 0) {
+        *payload = cmd + 5;
+        return BIN_OP_ECHO;
+    }
+    if (strcmp(cmd, "STATS") == 0) {
+        return BIN_OP_STATS;
+    }
+    if (strcmp(cmd, "STATS LATENCY") == 0) {
+        return BIN_OP_STATS_LATENCY;
+    }
+    if (strcmp(cmd, "QUIT") == 0) {
+        return BIN_OP_QUIT;
+    }
+    return 0;
+}
+
+static int send_command_frame(int fd, const char *cmd, uint32_t request_id) {
+    const char *payload;
+    int opcode = binary_opcode(cmd, &payload);
+    size_t len = strlen(payload);
+    unsigned char hdr[BIN_HEADER_LEN];
+
+    memset(hdr, 0, sizeof(hdr));
+    hdr[0] = (unsigned char)opcode;
+    store_be32(hdr + 4, request_id);
+    store_be32(hdr + 8, (uint32_t)len);
+    if (send_all(fd, (const char *)hdr, sizeof(hdr)) < 0 ||
+        send_all(fd, payload, len) < 0) {
+        perror("send");
+        return -1;
+    }
+    return 0;
+}
+
+static int read_response_frame(int fd) {
+    static const char *status_text[] = { NULL, "429 SLOWDOWN", "ERR unknown", "ERR too_long" };
+    unsigned char hdr[BIN_HEADER_LEN];
+
+    int rc = recv_exact(fd, hdr, sizeof(hdr));
+    if (rc == 0) {
+        printf("client: server closed\n");
+        return -1;
+    }
+    if (rc < 0) {
+        perror("recv");
+        return -1;
+    }
+
+    uint32_t len = load_be32(hdr + 8);
+    char *payload = malloc((size_t)len + 1);
+    if (!payload) {
+        fprintf(stderr, "client: out of memory\n");
+        return -1;
+    }
+    if (recv_exact(fd, payload, len) <= 0) {
+        printf("client: server closed\n");
+        free(payload);
+        return -1;
+    }
+    payload[len] = '\0';
+
+    if (hdr[1] != 0) {
+        printf("%s\n", hdr[1] < 4 ? status_text[hdr[1]] : "ERR status");
+    } else if (len > 0 && payload[len - 1] == '\n') {
+        fwrite(payload, 1, len, stdout);
+    } else {
+        printf("%s\n", payload);
     }
+    free(payload);
     return 0;
 }
 
+// Sends one command and prints its reply. Returns 1 after QUIT, -1 on error.
+static int run_command(int fd, const char *cmd, unsigned int slow_ms, int binary) {
+    static uint32_t next_id = 1;
+
+    if (binary) {
+        if (send_command_frame(fd, cmd, next_id++) < 0) {
+            return -1;
+        }
+        if (strcmp(cmd, "QUIT") == 0) {
+            return 1;
+        }
+        return read_response_frame(fd);
+    }
+
+    if (send_command_line(fd, cmd) < 0) {
+        return -1;
+    }
+    if (read_response_lines(fd, slow_ms, response_lines(cmd)) < 0) {
+        return -1;
+    }
+    return strcmp(cmd, "QUIT") == 0 ? 1 : 0;
+}
+
+static void print_throughput(uint64_t bytes, const struct timespec *t0, const struct timespec *t1) {
+    double secs = (double)(t1->tv_sec - t0->tv_sec) + (double)(t1->tv_nsec - t0->tv_nsec) / 1e9;
+    printf("bytes=%llu\n", (unsigned long long)bytes);
+    printf("seconds=%.3f\n", secs);
+    printf("mib_per_sec=%.1f\n", secs > 0 ? (double)bytes / (1024.0 * 1024.0) / secs : 0.0);
+}
+
+static unsigned char stream_byte(uint64_t offset) {
+    return (unsigned char)(offset % 251);
+}
+
+// STREAM transfer test: sends a generated payload while reading the echo
+// back (the server stops reading when we fall behind, so both directions
+// must progress together), then checks every byte and reports throughput.
+static int run_stream(int fd, uint64_t bytes) {
+    char line[64];
+    int wrote = snprintf(line, sizeof(line), "STREAM %llu\n", (unsigned long long)bytes);
+    if (send_all(fd, line, (size_t)wrote) < 0) {
+        perror("send");
+        return -1;
+    }
+
+    unsigned char *out = malloc(STREAM_CHUNK);
+    unsigned char *in = malloc(STREAM_CHUNK);
+    if (!out || !in) {
+        fprintf(stderr, "client: out of memory\n");
+        free(out);
+        free(in);
+        return -1;
+    }
+    struct timespec t0;
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    int header_done = 0;
+    size_t header_len = 0;
+    int mismatch = 0;
+    int rc = 0;
+    while (received < bytes || !header_done) {
+        struct pollfd pfd = { fd, POLLIN | (sent < bytes ? POLLOUT : 0), 0 };
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            rc = -1;
+            break;
+        }
+        if ((pfd.revents & POLLOUT) && sent < bytes) {
+            size_t n = bytes - sent < STREAM_CHUNK ? (size_t)(bytes - sent) : STREAM_CHUNK;
+            for (size_t i = 0; i < n; i++) {
+                out[i] = stream_byte(sent + i);
+            }
+            ssize_t w = send(fd, out, n, MSG_DONTWAIT);
+            if (w < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("send");
+                rc = -1;
+                break;
+            }
+            if (w > 0) {
+                sent += (uint64_t)w;
+            }
+        }
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t r = recv(fd, in, STREAM_CHUNK, MSG_DONTWAIT);
+            if (r == 0) {
+                fprintf(stderr, "client: server closed the stream\n");
+                rc = -1;
+                break;
+            }
+            if (r < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                    continue;
+                }
+                perror("recv");
+                rc = -1;
+                break;
+            }
+            size_t pos = 0;
+            while (!header_done && pos < (size_t)r) {
+                char ch = (char)in[pos++];
+                if (ch == '\n') {
+                    line[header_len] = '\0';
+                    header_done = 1;
+                    if (strncmp(line, "STREAM ", 7) != 0) {
+                        fprintf(stderr, "client: unexpected reply: %s\n", line);
+                        rc = -1;
+                    }
+                } else if (header_len + 1 < sizeof(line)) {
+                    line[header_len++] = ch;
+                }
+            }
+            if (rc < 0) {
+                break;
+            }
+            for (; pos < (size_t)r; pos++, received++) {
+                if (in[pos] != stream_byte(received)) {
+                    mismatch = 1;
+                }
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    free(out);
+    free(in);
+    if (rc < 0) {
+        return -1;
+    }
+
+    print_throughput(bytes, &t0, &t1);
+    printf("verified=%d\n", !mismatch);
+    return mismatch ? -1 : 0;
+}
+
+// FILE download test: fetches path `repeat` times over one connection,
+// discarding the bodies, and reports throughput.
+static int run_file(int fd, const char *path, unsigned repeat) {
+    char *in = malloc(STREAM_CHUNK);
+    if (!in) {
+        fprintf(stderr, "client: out of memory\n");
+        return -1;
+    }
+    struct timespec t0;
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    uint64_t total = 0;
+    int rc = 0;
+    size_t have = 0;
+    for (unsigned i = 0; i < repeat && rc == 0; i++) {
+        char line[FILE_PATH_MAX + 16];
+        int n = snprintf(line, sizeof(line), "FILE %s\n", path);
+        if (n < 0 || (size_t)n >= sizeof(line) || send_all(fd, line, (size_t)n) < 0) {
+            fprintf(stderr, "client: cannot send request\n");
+            rc = -1;
+            break;
+        }
+        // Header line first; whatever follows it in the buffer is body.
+        char *lf = NULL;
+        while (!(lf = memchr(in, '\n', have))) {
+            ssize_t r = have < STREAM_CHUNK ? recv(fd, in + have, STREAM_CHUNK - have, 0) : 0;
+            if (r <= 0) {
+                fprintf(stderr, "client: no reply header\n");
+                rc = -1;
+                break;
+            }
+            have += (size_t)r;
+        }
+        if (rc < 0) {
+            break;
+        }
+        *lf = '\0';
+        unsigned long long len;
+        if (sscanf(in, "FILE %llu", &len) != 1) {
+            fprintf(stderr, "client: %s\n", in);
+            rc = -1;
+            break;
+        }
+        size_t body = have - (size_t)(lf + 1 - in);
+        uint64_t left = len;
+        size_t take = body < left ? body : (size_t)left;
+        left -= take;
+        // Keep anything past this body for the next reply.
+        memmove(in, lf + 1 + take, body - take);
+        have = body - take;
+        while (left > 0) {
+            ssize_t r = recv(fd, in, left < STREAM_CHUNK ? (size_t)left : STREAM_CHUNK, 0);
+            if (r <= 0) {
+                fprintf(stderr, "client: short body\n");
+                rc = -1;
+                break;
+            }
+            left -= (uint64_t)r;
+        }
+        total += len;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    free(in);
+    if (rc < 0) {
+        return -1;
+    }
+    print_throughput(total, &t0, &t1);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--slow <ms>] [--binary] [--stream BYTES]\n"
+        "       [--file PATH [--repeat N]] <host> <port> [command]\n"
+        "       %s [options] --unix PATH [command]\n", prog, prog);
+}
+
 int main(int argc, char **argv) {
     unsigned int slow_ms = 0;
+    int binary = 0;
+    int stream = 0;
+    uint64_t stream_bytes = 0;
+    const char *file_path = NULL;
+    unsigned repeat = 1;
+    const char *unix_path = NULL;
     int argi = 1;
 
-    if (argc >= 2 && strcmp(argv[1], "--slow") == 0) {
-        if (argc < 5) {
-            fprintf(stderr, "usage: %s [--slow <ms>] <host> <port> [command]\n", argv[0]);
+    while (argi < argc && strncmp(argv[argi], "--", 2) == 0) {
+        if (strcmp(argv[argi], "--slow") == 0 && argi + 1 < argc) {
+            slow_ms = (unsigned int)strtoul(argv[argi + 1], NULL, 10);
+            argi += 2;
+        } else if (strcmp(argv[argi], "--binary") == 0) {
+            binary = 1;
+            argi++;
+        } else if (strcmp(argv[argi], "--stream") == 0 && argi + 1 < argc) {
+            stream = 1;
+            stream_bytes = strtoull(argv[argi + 1], NULL, 10);
+            argi += 2;
+        } else if (strcmp(argv[argi], "--file") == 0 && argi + 1 < argc) {
+            file_path = argv[argi + 1];
+            argi += 2;
+        } else if (strcmp(argv[argi], "--repeat") == 0 && argi + 1 < argc) {
+            repeat = (unsigned)strtoul(argv[argi + 1], NULL, 10);
+            argi += 2;
+        } else if (strcmp(argv[argi], "--unix") == 0 && argi + 1 < argc) {
+            unix_path = argv[argi + 1];
+            argi += 2;
+        } else {
+            usage(argv[0]);
             return 1;
         }
-        slow_ms = (unsigned int)strtoul(argv[2], NULL, 10);
-        argi = 3;
     }
 
-    if (argc - argi < 2) {
-        fprintf(stderr, "usage: %s [--slow <ms>] <host> <port> [command]\n", argv[0]);
+    // The command follows the socket path, or the host and port.
+    int cmd_argi = unix_path ? argi : argi + 2;
+    if (cmd_argi > argc || stream + binary + (file_path != NULL) > 1) {
+        usage(argv[0]);
         return 1;
     }
 
-    int fd = connect_to_server(argv[argi], argv[argi + 1]);
+    int fd = unix_path ? connect_unix(unix_path) : connect_to_server(argv[argi], argv[argi + 1]);
     if (fd < 0) {
         return 1;
     }
 
-    if (argc - argi > 2) {
-        char *cmd = join_command(argc, argv, argi + 2);
-        if (!cmd) {
-            fprintf(stderr, "client: out of memory\n");
+    if (stream || file_path) {
+        int rc = stream ? run_stream(fd, stream_bytes) : run_file(fd, file_path, repeat);
+        close(fd);
+        return rc < 0 ? 1 : 0;
+    }
+
+    if (binary) {
+        unsigned char magic = BIN_MAGIC;
+        if (send_all(fd, (const char *)&magic, 1) < 0) {
+            perror("send");
             close(fd);
             return 1;
         }
+    }
 
-        if (send_command_line(fd, cmd) < 0) {
-            free(cmd);
+    if (argc > cmd_argi) {
+        char *cmd = join_command(argc, argv, cmd_argi);
+        if (!cmd) {
+            fprintf(stderr, "client: out of memory\n");
             close(fd);
             return 1;
         }
 
-        int lines = strcmp(cmd, "STATS") == 0 ? STATS_LINES : 1;
+        int rc = run_command(fd, cmd, slow_ms, binary);
         free(cmd);
-        read_response_lines(fd, slow_ms, lines);
         close(fd);
-        return 0;
+        return rc < 0 ? 1 : 0;
     }
 
     // Interactive mode: read from stdin and send each line.
@@ -225,15 +644,7 @@ int main(int argc, char **argv) {
         if (input[0] == '\0') {
             continue;
         }
-        if (send_command_line(fd, input) < 0) {
-            break;
-        }
-
-        int lines = strcmp(input, "STATS") == 0 ? STATS_LINES : 1;
-        if (read_response_lines(fd, slow_ms, lines) < 0) {
-            break;
-        }
-        if (strcmp(input, "QUIT") == 0) {
+        if (run_command(fd, input, slow_ms, binary) != 0) {
             break;
         }
     }
@@ -0,0 +1,77 @@
+#include "command.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static uint64_t verb_key(const char *verb, size_t len) {
+    uint64_t key = 0;
+    memcpy(&key, verb, len);
+    return key;
+}
+
+static unsigned int command_slot(uint64_t key, uint64_t mult) {
+    return (unsigned int)((key * mult) >> (64 - COMMAND_TABLE_BITS));
+}
+
+int command_table_init(struct command_table *t, const char *const *verbs, size_t n) {
+    uint64_t keys[COMMAND_TABLE_SIZE];
+    if (n > COMMAND_TABLE_SIZE) {
+        fprintf(stderr, "command: %zu verbs do not fit %u slots\n", n, COMMAND_TABLE_SIZE);
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        size_t len = strlen(verbs[i]);
+        if (len == 0 || len > COMMAND_VERB_MAX) {
+            fprintf(stderr, "command: bad verb '%s'\n", verbs[i]);
+            return -1;
+        }
+        keys[i] = verb_key(verbs[i], len);
+    }
+
+    uint64_t mult = 0x9e3779b97f4a7c15ull;
+    for (int attempt = 0; attempt < 10000; attempt++, mult += 0x632be59bd9b4e01aull) {
+        int collision = 0;
+        for (unsigned int s = 0; s < COMMAND_TABLE_SIZE; s++) {
+            t->keys[s] = 0;
+            t->index[s] = -1;
+        }
+        for (size_t i = 0; i < n && !collision; i++) {
+            unsigned int slot = command_slot(keys[i], mult | 1);
+            if (t->index[slot] >= 0) {
+                collision = 1;
+            } else {
+                t->keys[slot] = keys[i];
+                t->index[slot] = (int)i;
+            }
+        }
+        if (!collision) {
+            t->mult = mult | 1;
+            return 0;
+        }
+    }
+    fprintf(stderr, "command: no perfect hash for the command table\n");
+    return -1;
+}
+
+int command_find(const struct command_table *t, const char *verb, size_t len) {
+    if (len == 0 || len > COMMAND_VERB_MAX) {
+        return -1;
+    }
+    uint64_t key = verb_key(verb, len);
+    unsigned int slot = command_slot(key, t->mult);
+    return t->keys[slot] == key ? t->index[slot] : -1;
+}
+
+void command_split(const char *line, size_t len, struct command_line *out) {
+    const char *space = memchr(line, ' ', len);
+    out->verb = line;
+    if (!space) {
+        out->verb_len = len;
+        out->arg = NULL;
+        out->arg_len = 0;
+        return;
+    }
+    out->verb_len = (size_t)(space - line);
+    out->arg = space + 1;
+    out->arg_len = len - out->verb_len - 1;
+}
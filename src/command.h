@@ -0,0 +1,40 @@
+#ifndef NETLOOP_COMMAND_H
+#define NETLOOP_COMMAND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Verb lookup for the text protocol. Verbs are packed into a uint64 key and
+// looked up with a multiplicative hash whose multiplier is searched at init
+// until every verb has its own slot, so a lookup is one multiply, one load
+// and one compare however many verbs there are.
+
+#define COMMAND_VERB_MAX 8
+#define COMMAND_TABLE_BITS 4
+#define COMMAND_TABLE_SIZE (1u << COMMAND_TABLE_BITS)
+
+struct command_table {
+    uint64_t keys[COMMAND_TABLE_SIZE];
+    int index[COMMAND_TABLE_SIZE]; // into the caller's verb array; -1 if empty
+    uint64_t mult;
+};
+
+// A request line split at its first space. arg is NULL when there is no
+// space; both slices borrow from the line.
+struct command_line {
+    const char *verb;
+    size_t verb_len;
+    const char *arg;
+    size_t arg_len;
+};
+
+// Fails (and says why on stderr) if a verb is too long or no multiplier
+// separates them; raise COMMAND_TABLE_BITS then.
+int command_table_init(struct command_table *t, const char *const *verbs, size_t n);
+
+// Index of the verb (not NUL-terminated) in the init array, or -1.
+int command_find(const struct command_table *t, const char *verb, size_t len);
+
+void command_split(const char *line, size_t len, struct command_line *out);
+
+#endif
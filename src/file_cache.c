@@ -0,0 +1,241 @@
+#include "file_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static void count(unsigned long *counter) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+}
+
+static uint64_t path_hash(const char *path, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ull; // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)path[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+// Lexical check before any syscall: relative, no "..", no embedded NUL.
+static int path_allowed(const char *path, size_t len) {
+    if (len == 0 || path[0] == '/' || memchr(path, '\0', len)) {
+        return 0;
+    }
+    const char *p = path;
+    const char *end = path + len;
+    while (p < end) {
+        const char *slash = memchr(p, '/', (size_t)(end - p));
+        const char *stop = slash ? slash : end;
+        if (stop - p == 2 && p[0] == '.' && p[1] == '.') {
+            return 0;
+        }
+        p = stop + 1;
+    }
+    return 1;
+}
+
+// O_NONBLOCK so a FIFO under the root cannot stall the worker in open.
+static int open_beneath(int root_fd, const char *path) {
+    int flags = O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK;
+#ifdef SYS_openat2
+    struct open_how how;
+    memset(&how, 0, sizeof(how));
+    how.flags = (uint64_t)flags;
+    how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+    int fd = (int)syscall(SYS_openat2, root_fd, path, &how, sizeof(how));
+    if (fd >= 0 || errno != ENOSYS) {
+        return fd;
+    }
+#endif
+    return openat(root_fd, path, flags);
+}
+
+static int errno_result(int err) {
+    switch (err) {
+    case ENOENT:
+    case ENOTDIR:
+    case ELOOP:
+        return FILE_NOT_FOUND;
+    case EXDEV: // RESOLVE_BENEATH: a symlink pointed outside the root
+    case EACCES:
+    case EPERM:
+        return FILE_FORBIDDEN;
+    default:
+        return FILE_ERROR;
+    }
+}
+
+static void entry_close(struct file_entry *e) {
+    if (e->seg) {
+        evbuffer_file_segment_free(e->seg);
+    }
+    e->seg = NULL;
+    e->fd = -1;
+    e->used = 0;
+}
+
+static int entry_matches(const struct file_entry *e, const struct stat *st) {
+    return e->dev == st->st_dev && e->ino == st->st_ino &&
+        e->size == (uint64_t)st->st_size &&
+        e->mtime.tv_sec == st->st_mtim.tv_sec && e->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+// e->path is already filled in.
+static int entry_open(struct file_cache *fc, struct file_entry *e, size_t path_len,
+    uint64_t hash, uint64_t now_ms) {
+    int fd = open_beneath(fc->root_fd, e->path);
+    if (fd < 0) {
+        return errno_result(errno);
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int rc = errno_result(errno);
+        close(fd);
+        return rc;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        return FILE_NOT_FOUND;
+    }
+    e->seg = NULL;
+    e->fd = -1;
+    if (st.st_size > 0) {
+        // The segment owns the fd from here on. libevent sends it with
+        // sendfile from a socket bufferevent and maps it for other buffers.
+        e->seg = evbuffer_file_segment_new(fd, 0, st.st_size, EVBUF_FS_CLOSE_ON_FREE);
+        if (!e->seg) {
+            close(fd);
+            return FILE_ERROR;
+        }
+        e->fd = fd;
+    } else {
+        close(fd);
+    }
+    e->path_len = path_len;
+    e->hash = hash;
+    e->size = (uint64_t)st.st_size;
+    e->dev = st.st_dev;
+    e->ino = st.st_ino;
+    e->mtime = st.st_mtim;
+    e->checked_ms = now_ms;
+    e->used = 1;
+    return FILE_OK;
+}
+
+int file_cache_init(struct file_cache *fc, int root_fd, size_t capacity) {
+    memset(fc, 0, sizeof(*fc));
+    fc->root_fd = root_fd;
+    fc->capacity = capacity;
+    fc->scratch.fd = -1;
+    if (capacity > 0) {
+        fc->entries = calloc(capacity, sizeof(*fc->entries));
+        if (!fc->entries) {
+            return -1;
+        }
+        for (size_t i = 0; i < capacity; i++) {
+            fc->entries[i].fd = -1;
+        }
+    }
+    return 0;
+}
+
+void file_cache_free(struct file_cache *fc) {
+    for (size_t i = 0; i < fc->capacity; i++) {
+        if (fc->entries[i].used) {
+            entry_close(&fc->entries[i]);
+        }
+    }
+    free(fc->entries);
+    fc->entries = NULL;
+    fc->count = 0;
+}
+
+static struct file_entry *cache_find(struct file_cache *fc, const char *path, size_t len,
+    uint64_t hash) {
+    for (size_t i = 0; i < fc->capacity; i++) {
+        struct file_entry *e = &fc->entries[i];
+        if (e->used && e->hash == hash && e->path_len == len && memcmp(e->path, path, len) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+// A free entry, or the least recently used one closed to make room.
+static struct file_entry *cache_victim(struct file_cache *fc) {
+    struct file_entry *victim = NULL;
+    for (size_t i = 0; i < fc->capacity; i++) {
+        struct file_entry *e = &fc->entries[i];
+        if (!e->used) {
+            return e;
+        }
+        if (!victim || e->last_used < victim->last_used) {
+            victim = e;
+        }
+    }
+    entry_close(victim);
+    fc->count--;
+    return victim;
+}
+
+int file_cache_get(struct file_cache *fc, const char *path, size_t path_len,
+    uint64_t now_ms, struct file_entry **out) {
+    if (path_len >= FILE_PATH_MAX) {
+        return FILE_PATH_TOO_LONG;
+    }
+    if (!path_allowed(path, path_len)) {
+        return FILE_FORBIDDEN;
+    }
+    uint64_t hash = path_hash(path, path_len);
+
+    struct file_entry *e = fc->capacity > 0 ? cache_find(fc, path, path_len, hash) : NULL;
+    if (e && now_ms - e->checked_ms >= FILE_CACHE_REVALIDATE_MS) {
+        struct stat st;
+        if (fstatat(fc->root_fd, e->path, &st, 0) == 0 && entry_matches(e, &st)) {
+            e->checked_ms = now_ms;
+        } else {
+            entry_close(e);
+            fc->count--;
+            count(&fc->invalidations);
+            e = NULL;
+        }
+    }
+    if (e) {
+        count(&fc->hits);
+        e->last_used = ++fc->clock;
+        *out = e;
+        return FILE_OK;
+    }
+
+    count(&fc->misses);
+    if (fc->capacity == 0) {
+        e = &fc->scratch;
+        entry_close(e);
+    } else {
+        e = cache_victim(fc);
+    }
+    memcpy(e->path, path, path_len);
+    e->path[path_len] = '\0';
+    int rc = entry_open(fc, e, path_len, hash, now_ms);
+    if (rc != FILE_OK) {
+        return rc;
+    }
+    if (fc->capacity > 0) {
+        fc->count++;
+    }
+    e->last_used = ++fc->clock;
+    *out = e;
+    return FILE_OK;
+}
+
+void file_cache_put(struct file_cache *fc, struct file_entry *e) {
+    if (e == &fc->scratch) {
+        entry_close(e);
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef NETLOOP_FILE_CACHE_H
+#define NETLOOP_FILE_CACHE_H
+
+#include <event2/buffer.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+// Per-worker cache of open files under the served root, so hot files are not
+// re-opened and re-stat'ed on every request. Single-threaded, like the worker
+// that owns it.
+//
+// - Each entry holds a libevent file segment. Output buffers take their own
+//   reference when a range is queued, so evicting an entry mid-transfer is
+//   safe: the fd closes once the last reference is gone.
+// - Entries are revalidated with one stat at most every
+//   FILE_CACHE_REVALIDATE_MS; a changed inode, size or mtime reopens the
+//   file. Replace served files by rename, not in place: a file truncated
+//   under a transfer ends it early.
+// - Past capacity the least recently used entry is evicted. A capacity of 0
+//   opens the file for every request.
+// - Paths resolve beneath the root only (openat2 RESOLVE_BENEATH where the
+//   kernel has it); absolute paths and ".." components are refused outright.
+
+#define FILE_PATH_MAX 256
+#define FILE_CACHE_REVALIDATE_MS 1000
+
+enum file_result {
+    FILE_OK,
+    FILE_NOT_FOUND,
+    FILE_FORBIDDEN,
+    FILE_PATH_TOO_LONG,
+    FILE_ERROR
+};
+
+struct file_entry {
+    char path[FILE_PATH_MAX];
+    size_t path_len;
+    uint64_t hash;
+    int fd;                             // owned by seg; -1 for empty files
+    struct evbuffer_file_segment *seg;  // NULL for empty files
+    uint64_t size;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    uint64_t checked_ms;
+    uint64_t last_used;
+    int used;
+};
+
+struct file_cache {
+    int root_fd;
+    struct file_entry *entries;
+    size_t capacity;
+    size_t count;
+    uint64_t clock;
+    struct file_entry scratch; // capacity 0: the one uncached open
+    // Written by the owning worker only; STATS reads them relaxed.
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long invalidations;
+};
+
+int file_cache_init(struct file_cache *fc, int root_fd, size_t capacity);
+void file_cache_free(struct file_cache *fc);
+
+// Finds or opens path (not NUL-terminated) under the root. The entry stays
+// valid until file_cache_put or the next file_cache_get.
+int file_cache_get(struct file_cache *fc, const char *path, size_t path_len,
+    uint64_t now_ms, struct file_entry **out);
+void file_cache_put(struct file_cache *fc, struct file_entry *e);
+
+#endif
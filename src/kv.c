@@ -0,0 +1,624 @@
+#include "kv.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KV_MIN_CAPACITY 64 // slots, power of two
+// Live plus tombstone slots, in percent of capacity, that trigger a rehash;
+// tables that fall below KV_SHRINK_PCT live are halved.
+#define KV_MAX_LOAD_PCT 70
+#define KV_SHRINK_PCT 10
+// Occupied old slots moved per operation. A step also gives up after
+// visiting 4x as many empty ones, so it is bounded either way.
+#define KV_REHASH_STEP 64
+#define KV_EVICT_SAMPLES 5
+#define KV_EXPIRE_SAMPLES 20
+// Sampled expiry repeats while more than a quarter of a sample had expired.
+#define KV_EXPIRE_ROUNDS 4
+// Slots walked from a random index looking for a key to sample.
+#define KV_SAMPLE_SCAN 16
+#define KV_MAINTAIN_SHARDS 4
+// Rough allocator header per heap block, so memory use tracks RSS better.
+#define KV_ALLOC_OVERHEAD 16
+
+enum slot_state {
+    SLOT_EMPTY, // must be 0: new tables come from calloc
+    SLOT_FULL,
+    SLOT_TOMBSTONE
+};
+
+// One cache line per slot: a probe that matches the hash finds the key
+// inline without chasing a pointer unless the key is long.
+struct kv_slot {
+    uint64_t hash;
+    uint64_t expire_ms; // 0: no TTL
+    char *data;         // [key, when not inline][value]; NULL if both are empty
+    uint32_t value_len;
+    uint32_t lru;       // low 32 bits of the last access time in ms
+    uint8_t state;
+    uint8_t key_len;
+    char key[KV_INLINE_KEY];
+};
+
+_Static_assert(sizeof(struct kv_slot) == 64, "kv_slot should fill one cache line");
+
+struct kv_table {
+    struct kv_slot *slots;
+    size_t cap;
+    size_t used;
+    size_t tombstones;
+};
+
+// While old.slots is set the shard is rehashing: new keys go to cur, lookups
+// check old first, and each operation moves a few old slots across. Moved
+// slots are left as tombstones so old probe chains stay intact.
+struct kv_shard {
+    pthread_mutex_t lock;
+    struct kv_table cur;
+    struct kv_table old;
+    size_t rehash_pos;
+    // What the limit governs: one slot plus heap data per key. Slot arrays
+    // are counted apart, or doubling a table could evict half the shard.
+    size_t memory;
+    size_t max_memory;
+    size_t table_bytes;
+    size_t ttl_keys;
+    uint64_t rng;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long expired;
+} __attribute__((aligned(64)));
+
+struct kv_store {
+    struct kv_shard shards[KV_SHARDS];
+    size_t max_memory;
+    unsigned maintain_cursor;
+};
+
+static uint64_t kv_hash(const char *key, size_t len) {
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ (uint64_t)len;
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, key, 8);
+        h = (h ^ v) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+        key += 8;
+        len -= 8;
+    }
+    uint64_t v = 0;
+    memcpy(&v, key, len);
+    h = (h ^ v) * 0xc4ceb9fe1a85ec53ull;
+    return h ^ (h >> 29);
+}
+
+// Top bits pick the shard, low bits the slot, so the two stay independent.
+static struct kv_shard *shard_for(struct kv_store *kv, uint64_t hash) {
+    return &kv->shards[hash >> (64 - KV_SHARD_BITS)];
+}
+
+static uint64_t shard_random(struct kv_shard *sh) {
+    uint64_t x = sh->rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    sh->rng = x;
+    return x;
+}
+
+static const char *slot_key(const struct kv_slot *s) {
+    return s->key_len <= KV_INLINE_KEY ? s->key : s->data;
+}
+
+static char *slot_value(struct kv_slot *s) {
+    return s->key_len <= KV_INLINE_KEY ? s->data : s->data + s->key_len;
+}
+
+static size_t heap_bytes(size_t key_len, size_t value_len) {
+    size_t n = (key_len > KV_INLINE_KEY ? key_len : 0) + value_len;
+    return n > 0 ? n + KV_ALLOC_OVERHEAD : 0;
+}
+
+static size_t entry_bytes(size_t key_len, size_t value_len) {
+    return sizeof(struct kv_slot) + heap_bytes(key_len, value_len);
+}
+
+static int slot_expired(const struct kv_slot *s, uint64_t now_ms) {
+    return s->expire_ms != 0 && s->expire_ms <= now_ms;
+}
+
+static struct kv_slot *table_find(struct kv_table *t, uint64_t hash, const char *key, size_t len) {
+    if (!t->slots) {
+        return NULL;
+    }
+    size_t mask = t->cap - 1;
+    size_t i = hash & mask;
+    for (size_t probe = 0; probe < t->cap; probe++, i = (i + 1) & mask) {
+        struct kv_slot *s = &t->slots[i];
+        if (s->state == SLOT_EMPTY) {
+            return NULL;
+        }
+        if (s->state == SLOT_FULL && s->hash == hash && s->key_len == len &&
+            memcmp(slot_key(s), key, len) == 0) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+// First free slot on the key's probe path; the caller has checked the key is
+// not already present.
+static struct kv_slot *table_claim(struct kv_table *t, uint64_t hash) {
+    size_t mask = t->cap - 1;
+    size_t i = hash & mask;
+    for (size_t probe = 0; probe < t->cap; probe++, i = (i + 1) & mask) {
+        struct kv_slot *s = &t->slots[i];
+        if (s->state != SLOT_FULL) {
+            if (s->state == SLOT_TOMBSTONE) {
+                t->tombstones--;
+            }
+            t->used++;
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static struct kv_slot *shard_find(struct kv_shard *sh, uint64_t hash, const char *key, size_t len,
+    struct kv_table **table) {
+    struct kv_slot *s = table_find(&sh->old, hash, key, len);
+    if (s) {
+        *table = &sh->old;
+        return s;
+    }
+    *table = &sh->cur;
+    return table_find(&sh->cur, hash, key, len);
+}
+
+static void slot_remove(struct kv_shard *sh, struct kv_table *t, struct kv_slot *s) {
+    sh->memory -= entry_bytes(s->key_len, s->value_len);
+    if (s->expire_ms) {
+        sh->ttl_keys--;
+    }
+    free(s->data);
+    s->data = NULL;
+    s->state = SLOT_TOMBSTONE;
+    t->used--;
+    t->tombstones++;
+
+    // A tombstone just before an empty slot ends no probe chain that matters:
+    // turn it (and any run of tombstones behind it) back into empty.
+    size_t mask = t->cap - 1;
+    size_t i = (size_t)(s - t->slots);
+    while (t->slots[i].state == SLOT_TOMBSTONE && t->slots[(i + 1) & mask].state == SLOT_EMPTY) {
+        t->slots[i].state = SLOT_EMPTY;
+        t->tombstones--;
+        i = (i - 1) & mask;
+    }
+}
+
+static void rehash_step(struct kv_shard *sh, size_t budget) {
+    if (!sh->old.slots) {
+        return;
+    }
+    size_t empty_budget = budget * 4;
+    while (budget > 0 && empty_budget > 0 && sh->rehash_pos < sh->old.cap) {
+        struct kv_slot *s = &sh->old.slots[sh->rehash_pos++];
+        if (s->state != SLOT_FULL) {
+            empty_budget--;
+            continue;
+        }
+        struct kv_slot *dst = table_claim(&sh->cur, s->hash);
+        if (!dst) {
+            sh->rehash_pos--; // cannot happen while the load limits hold
+            return;
+        }
+        *dst = *s;
+        s->data = NULL;
+        s->state = SLOT_TOMBSTONE;
+        sh->old.used--;
+        sh->old.tombstones++;
+        budget--;
+    }
+    if (sh->old.used == 0 || sh->rehash_pos == sh->old.cap) {
+        sh->table_bytes -= sh->old.cap * sizeof(struct kv_slot);
+        free(sh->old.slots);
+        memset(&sh->old, 0, sizeof(sh->old));
+        sh->rehash_pos = 0;
+    }
+}
+
+// Grows a table that is mostly live, rebuilds one that is mostly tombstones
+// at the same size, and halves one that is mostly empty. The new array comes
+// from calloc, whose zeroed pages the kernel hands out lazily, so even a big
+// table costs no upfront work; the copying is spread by rehash_step.
+static void maybe_start_rehash(struct kv_shard *sh) {
+    if (sh->old.slots) {
+        return;
+    }
+    struct kv_table *t = &sh->cur;
+    size_t new_cap;
+    if ((t->used + t->tombstones) * 100 >= t->cap * KV_MAX_LOAD_PCT) {
+        new_cap = t->used * 100 >= t->cap * (KV_MAX_LOAD_PCT / 2) ? t->cap * 2 : t->cap;
+    } else if (t->cap > KV_MIN_CAPACITY && t->used * 100 < t->cap * KV_SHRINK_PCT) {
+        new_cap = t->cap / 2;
+    } else {
+        return;
+    }
+    struct kv_slot *slots = calloc(new_cap, sizeof(*slots));
+    if (!slots) {
+        return; // retried on the next write
+    }
+    sh->old = *t;
+    t->slots = slots;
+    t->cap = new_cap;
+    t->used = 0;
+    t->tombstones = 0;
+    sh->rehash_pos = 0;
+    sh->table_bytes += new_cap * sizeof(struct kv_slot);
+}
+
+// A random occupied slot, or NULL if the short scan found none.
+static struct kv_slot *sample_slot(struct kv_shard *sh, struct kv_table **table) {
+    size_t total = sh->cur.used + sh->old.used;
+    if (total == 0) {
+        return NULL;
+    }
+    uint64_t r = shard_random(sh);
+    struct kv_table *t = (r % total) < sh->cur.used ? &sh->cur : &sh->old;
+    size_t mask = t->cap - 1;
+    size_t i = (size_t)(r >> 32) & mask;
+    for (int n = 0; n < KV_SAMPLE_SCAN; n++, i = (i + 1) & mask) {
+        if (t->slots[i].state == SLOT_FULL) {
+            *table = t;
+            return &t->slots[i];
+        }
+    }
+    return NULL;
+}
+
+// Approximate LRU: of a few sampled keys, the one idle longest goes first,
+// and an expired key beats any live one. keep (the key just written) is
+// never chosen.
+static void evict_to_fit(struct kv_shard *sh, uint64_t now_ms, const struct kv_slot *keep) {
+    int misses = 0;
+    while (sh->memory > sh->max_memory && sh->cur.used + sh->old.used > (keep ? 1u : 0u)) {
+        struct kv_slot *victim = NULL;
+        struct kv_table *victim_table = NULL;
+        uint32_t victim_age = 0;
+        for (int k = 0; k < KV_EVICT_SAMPLES; k++) {
+            struct kv_table *t;
+            struct kv_slot *s = sample_slot(sh, &t);
+            if (!s || s == keep) {
+                continue;
+            }
+            uint32_t age = slot_expired(s, now_ms) ? UINT32_MAX : (uint32_t)now_ms - s->lru;
+            if (!victim || age > victim_age) {
+                victim = s;
+                victim_table = t;
+                victim_age = age;
+            }
+        }
+        if (!victim) {
+            if (++misses >= KV_SAMPLE_SCAN) {
+                return;
+            }
+            continue;
+        }
+        misses = 0;
+        if (victim_age == UINT32_MAX) {
+            sh->expired++;
+        } else {
+            sh->evictions++;
+        }
+        slot_remove(sh, victim_table, victim);
+    }
+}
+
+// Lookup with lazy expiry: an expired key is removed and reported missing.
+static struct kv_slot *shard_lookup(struct kv_shard *sh, uint64_t hash, const char *key, size_t len,
+    uint64_t now_ms, struct kv_table **table) {
+    struct kv_slot *s = shard_find(sh, hash, key, len, table);
+    if (s && slot_expired(s, now_ms)) {
+        slot_remove(sh, *table, s);
+        sh->expired++;
+        return NULL;
+    }
+    return s;
+}
+
+static int shard_store(struct kv_shard *sh, uint64_t hash, const char *key, size_t key_len,
+    const char *value, size_t value_len, uint64_t expire_ms, uint64_t now_ms) {
+    size_t heap = heap_bytes(key_len, value_len);
+    if (entry_bytes(key_len, value_len) > sh->max_memory) {
+        return KV_NO_MEMORY;
+    }
+    char *data = NULL;
+    if (heap > 0) {
+        data = malloc(heap - KV_ALLOC_OVERHEAD);
+        if (!data) {
+            return KV_NO_MEMORY;
+        }
+        size_t off = 0;
+        if (key_len > KV_INLINE_KEY) {
+            memcpy(data, key, key_len);
+            off = key_len;
+        }
+        memcpy(data + off, value, value_len);
+    }
+
+    struct kv_table *t;
+    struct kv_slot *s = shard_find(sh, hash, key, key_len, &t);
+    if (s) {
+        sh->memory -= entry_bytes(s->key_len, s->value_len);
+        if (s->expire_ms) {
+            sh->ttl_keys--;
+        }
+        free(s->data);
+    } else {
+        s = table_claim(&sh->cur, hash);
+        if (!s) {
+            free(data);
+            return KV_NO_MEMORY;
+        }
+        s->hash = hash;
+        s->key_len = (uint8_t)key_len;
+        if (key_len <= KV_INLINE_KEY) {
+            memcpy(s->key, key, key_len);
+        }
+        s->state = SLOT_FULL;
+    }
+    s->data = data;
+    s->value_len = (uint32_t)value_len;
+    s->expire_ms = expire_ms;
+    if (expire_ms) {
+        sh->ttl_keys++;
+    }
+    s->lru = (uint32_t)now_ms;
+    sh->memory += entry_bytes(key_len, value_len);
+
+    // Starting a rehash only moves the array under old, so s stays valid.
+    maybe_start_rehash(sh);
+    evict_to_fit(sh, now_ms, s);
+    return KV_OK;
+}
+
+struct kv_store *kv_create(size_t max_memory) {
+    struct kv_store *kv = aligned_alloc(64, sizeof(*kv));
+    if (!kv) {
+        return NULL;
+    }
+    memset(kv, 0, sizeof(*kv));
+    kv->max_memory = max_memory;
+    for (unsigned i = 0; i < KV_SHARDS; i++) {
+        struct kv_shard *sh = &kv->shards[i];
+        pthread_mutex_init(&sh->lock, NULL);
+        sh->cur.slots = calloc(KV_MIN_CAPACITY, sizeof(struct kv_slot));
+        if (!sh->cur.slots) {
+            kv_destroy(kv);
+            return NULL;
+        }
+        sh->cur.cap = KV_MIN_CAPACITY;
+        sh->table_bytes = KV_MIN_CAPACITY * sizeof(struct kv_slot);
+        sh->max_memory = max_memory / KV_SHARDS;
+        sh->rng = 0x2545f4914f6cdd1dull * (i + 1);
+    }
+    return kv;
+}
+
+static void table_free(struct kv_table *t) {
+    for (size_t i = 0; t->slots && i < t->cap; i++) {
+        if (t->slots[i].state == SLOT_FULL) {
+            free(t->slots[i].data);
+        }
+    }
+    free(t->slots);
+}
+
+void kv_destroy(struct kv_store *kv) {
+    if (!kv) {
+        return;
+    }
+    for (unsigned i = 0; i < KV_SHARDS; i++) {
+        table_free(&kv->shards[i].cur);
+        table_free(&kv->shards[i].old);
+        pthread_mutex_destroy(&kv->shards[i].lock);
+    }
+    free(kv);
+}
+
+int kv_get(struct kv_store *kv, const char *key, size_t key_len, uint64_t now_ms,
+    kv_value_fn fn, void *arg) {
+    uint64_t hash = kv_hash(key, key_len);
+    struct kv_shard *sh = shard_for(kv, hash);
+    struct kv_table *t;
+    int rc = KV_NOT_FOUND;
+
+    pthread_mutex_lock(&sh->lock);
+    rehash_step(sh, KV_REHASH_STEP);
+    struct kv_slot *s = shard_lookup(sh, hash, key, key_len, now_ms, &t);
+    if (s) {
+        s->lru = (uint32_t)now_ms;
+        sh->hits++;
+        fn(slot_value(s), s->value_len, arg);
+        rc = KV_OK;
+    } else {
+        sh->misses++;
+    }
+    pthread_mutex_unlock(&sh->lock);
+    return rc;
+}
+
+int kv_set(struct kv_store *kv, const char *key, size_t key_len,
+    const char *value, size_t value_len, uint64_t now_ms) {
+    if (key_len > KV_MAX_KEY) {
+        return KV_KEY_TOO_LONG;
+    }
+    uint64_t hash = kv_hash(key, key_len);
+    struct kv_shard *sh = shard_for(kv, hash);
+
+    pthread_mutex_lock(&sh->lock);
+    rehash_step(sh, KV_REHASH_STEP);
+    int rc = shard_store(sh, hash, key, key_len, value, value_len, 0, now_ms);
+    pthread_mutex_unlock(&sh->lock);
+    return rc;
+}
+
+int kv_del(struct kv_store *kv, const char *key, size_t key_len, uint64_t now_ms) {
+    uint64_t hash = kv_hash(key, key_len);
+    struct kv_shard *sh = shard_for(kv, hash);
+    struct kv_table *t;
+    int rc = KV_NOT_FOUND;
+
+    pthread_mutex_lock(&sh->lock);
+    rehash_step(sh, KV_REHASH_STEP);
+    struct kv_slot *s = shard_lookup(sh, hash, key, key_len, now_ms, &t);
+    if (s) {
+        slot_remove(sh, t, s);
+        maybe_start_rehash(sh);
+        rc = KV_OK;
+    }
+    pthread_mutex_unlock(&sh->lock);
+    return rc;
+}
+
+// Accepts an optional '-' and 1..19 digits, nothing else.
+static int parse_int64(const char *p, size_t len, int64_t *out) {
+    char buf[24];
+    if (len == 0 || len >= sizeof(buf)) {
+        return -1;
+    }
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+    for (size_t i = buf[0] == '-' ? 1 : 0; i < len; i++) {
+        if (buf[i] < '0' || buf[i] > '9') {
+            return -1;
+        }
+    }
+    char *end;
+    errno = 0;
+    long long v = strtoll(buf, &end, 10);
+    if (errno != 0 || end == buf || *end != '\0') {
+        return -1;
+    }
+    *out = (int64_t)v;
+    return 0;
+}
+
+int kv_incr(struct kv_store *kv, const char *key, size_t key_len, int64_t delta,
+    uint64_t now_ms, int64_t *result) {
+    if (key_len > KV_MAX_KEY) {
+        return KV_KEY_TOO_LONG;
+    }
+    uint64_t hash = kv_hash(key, key_len);
+    struct kv_shard *sh = shard_for(kv, hash);
+    struct kv_table *t;
+    int64_t value = 0;
+    uint64_t expire_ms = 0;
+    int rc = KV_OK;
+
+    pthread_mutex_lock(&sh->lock);
+    rehash_step(sh, KV_REHASH_STEP);
+    struct kv_slot *s = shard_lookup(sh, hash, key, key_len, now_ms, &t);
+    if (s) {
+        expire_ms = s->expire_ms;
+        if (parse_int64(slot_value(s), s->value_len, &value) < 0) {
+            rc = KV_NOT_INTEGER;
+        }
+    }
+    if (rc == KV_OK && __builtin_add_overflow(value, delta, &value)) {
+        rc = KV_OVERFLOW;
+    }
+    if (rc == KV_OK) {
+        char buf[24];
+        int n = snprintf(buf, sizeof(buf), "%" PRId64, value);
+        rc = shard_store(sh, hash, key, key_len, buf, (size_t)n, expire_ms, now_ms);
+    }
+    pthread_mutex_unlock(&sh->lock);
+    if (rc == KV_OK) {
+        *result = value;
+    }
+    return rc;
+}
+
+int kv_expire(struct kv_store *kv, const char *key, size_t key_len, uint64_t ttl_ms,
+    uint64_t now_ms) {
+    uint64_t hash = kv_hash(key, key_len);
+    struct kv_shard *sh = shard_for(kv, hash);
+    struct kv_table *t;
+    int rc = KV_NOT_FOUND;
+
+    pthread_mutex_lock(&sh->lock);
+    rehash_step(sh, KV_REHASH_STEP);
+    struct kv_slot *s = shard_lookup(sh, hash, key, key_len, now_ms, &t);
+    if (s) {
+        if (ttl_ms == 0) {
+            slot_remove(sh, t, s);
+            maybe_start_rehash(sh);
+        } else {
+            if (!s->expire_ms) {
+                sh->ttl_keys++;
+            }
+            s->expire_ms = now_ms + ttl_ms;
+        }
+        rc = KV_OK;
+    }
+    pthread_mutex_unlock(&sh->lock);
+    return rc;
+}
+
+// Random sampling finds expired keys without an index of TTLs; lazy expiry
+// on access catches the rest.
+static void shard_expire(struct kv_shard *sh, uint64_t now_ms) {
+    for (int round = 0; round < KV_EXPIRE_ROUNDS && sh->ttl_keys > 0; round++) {
+        int expired = 0;
+        for (int k = 0; k < KV_EXPIRE_SAMPLES; k++) {
+            struct kv_table *t;
+            struct kv_slot *s = sample_slot(sh, &t);
+            if (s && slot_expired(s, now_ms)) {
+                slot_remove(sh, t, s);
+                sh->expired++;
+                expired++;
+            }
+        }
+        if (expired * 4 <= KV_EXPIRE_SAMPLES) {
+            break;
+        }
+    }
+}
+
+void kv_maintain(struct kv_store *kv, uint64_t now_ms) {
+    for (int i = 0; i < KV_MAINTAIN_SHARDS; i++) {
+        unsigned idx = __atomic_fetch_add(&kv->maintain_cursor, 1, __ATOMIC_RELAXED) % KV_SHARDS;
+        struct kv_shard *sh = &kv->shards[idx];
+        if (pthread_mutex_trylock(&sh->lock) != 0) {
+            continue;
+        }
+        rehash_step(sh, KV_REHASH_STEP);
+        shard_expire(sh, now_ms);
+        maybe_start_rehash(sh);
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
+
+void kv_stats(struct kv_store *kv, struct kv_stats *out) {
+    memset(out, 0, sizeof(*out));
+    out->max_memory_bytes = kv->max_memory;
+    for (unsigned i = 0; i < KV_SHARDS; i++) {
+        struct kv_shard *sh = &kv->shards[i];
+        pthread_mutex_lock(&sh->lock);
+        out->keys += sh->cur.used + sh->old.used;
+        out->hits += sh->hits;
+        out->misses += sh->misses;
+        out->evictions += sh->evictions;
+        out->expired += sh->expired;
+        out->rehashing += sh->old.slots != NULL;
+        out->memory_bytes += sh->memory;
+        out->table_bytes += sh->table_bytes;
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
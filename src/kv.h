@@ -0,0 +1,78 @@
+#ifndef NETLOOP_KV_H
+#define NETLOOP_KV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// In-memory key-value store shared by every worker. Keys hash to one of
+// KV_SHARDS shards, each an open-addressing table behind its own lock, so
+// workers only contend when they touch the same shard.
+//
+// - Keys up to KV_INLINE_KEY bytes live inside the 64-byte slot; longer keys
+//   share the value's allocation.
+// - Tables grow, shrink and drop tombstones by incremental rehash: each
+//   operation (and kv_maintain) moves a bounded number of slots, so no call
+//   ever walks a whole table.
+// - TTLs expire lazily on access and by random sampling in kv_maintain.
+// - Past max_memory, writes evict the least recently used of a few sampled
+//   keys until the shard fits again (approximate LRU). The limit covers keys,
+//   values and one slot per key; spare slot capacity is reported apart as
+//   table_bytes.
+//
+// Times are wall-clock milliseconds supplied by the caller.
+
+#define KV_SHARD_BITS 4
+#define KV_SHARDS (1u << KV_SHARD_BITS)
+#define KV_INLINE_KEY 30
+#define KV_MAX_KEY 250
+
+enum kv_result {
+    KV_OK,
+    KV_NOT_FOUND,
+    KV_NOT_INTEGER,
+    KV_OVERFLOW,
+    KV_KEY_TOO_LONG,
+    KV_NO_MEMORY
+};
+
+struct kv_stats {
+    unsigned long keys;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long expired;
+    unsigned long rehashing; // shards with a rehash in progress
+    size_t memory_bytes;
+    size_t max_memory_bytes;
+    size_t table_bytes;
+};
+
+struct kv_store;
+
+// Called with the value while the shard lock is held: copy it out and act on
+// it after kv_get returns, never from inside the callback.
+typedef void (*kv_value_fn)(const char *value, size_t len, void *arg);
+
+struct kv_store *kv_create(size_t max_memory);
+void kv_destroy(struct kv_store *kv);
+
+int kv_get(struct kv_store *kv, const char *key, size_t key_len, uint64_t now_ms,
+    kv_value_fn fn, void *arg);
+// Replaces any existing value and clears its TTL.
+int kv_set(struct kv_store *kv, const char *key, size_t key_len,
+    const char *value, size_t value_len, uint64_t now_ms);
+int kv_del(struct kv_store *kv, const char *key, size_t key_len, uint64_t now_ms);
+// A missing key counts as 0. The TTL, if any, is kept.
+int kv_incr(struct kv_store *kv, const char *key, size_t key_len, int64_t delta,
+    uint64_t now_ms, int64_t *result);
+// A TTL of 0 deletes the key.
+int kv_expire(struct kv_store *kv, const char *key, size_t key_len, uint64_t ttl_ms,
+    uint64_t now_ms);
+
+// Background work for a few shards per call: a rehash step and a round of
+// sampled TTL expiry. Busy shards are skipped. Safe to call from any thread.
+void kv_maintain(struct kv_store *kv, uint64_t now_ms);
+
+void kv_stats(struct kv_store *kv, struct kv_stats *out);
+
+#endif
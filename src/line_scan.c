@@ -0,0 +1,69 @@
+#include "line_scan.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+const char *line_scan_scalar(const char *p, const char *end) {
+    return memchr(p, '\n', (size_t)(end - p));
+}
+
+#ifdef HAVE_X86_SIMD
+static const char *line_scan_sse2(const char *p, const char *end) {
+    const __m128i lf = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, lf));
+        if (mask) {
+            return p + __builtin_ctz((unsigned int)mask);
+        }
+        p += 16;
+    }
+    return p < end ? line_scan_scalar(p, end) : NULL;
+}
+
+__attribute__((target("avx2")))
+static const char *line_scan_avx2(const char *p, const char *end) {
+    const __m256i lf = _mm256_set1_epi8('\n');
+    while (end - p >= 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, lf));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return line_scan_sse2(p, end);
+}
+#endif
+
+static struct line_scanner g_scanners[3];
+static int g_num_scanners = 0;
+
+int line_scanners(const struct line_scanner **out) {
+    if (g_num_scanners == 0) {
+        int n = 0;
+        g_scanners[n++] = (struct line_scanner){ "scalar", line_scan_scalar };
+#ifdef HAVE_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2")) {
+            g_scanners[n++] = (struct line_scanner){ "sse2", line_scan_sse2 };
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            g_scanners[n++] = (struct line_scanner){ "avx2", line_scan_avx2 };
+        }
+#endif
+        g_num_scanners = n;
+    }
+    *out = g_scanners;
+    return g_num_scanners;
+}
+
+line_scan_fn line_scan_select(void) {
+    const struct line_scanner *scanners;
+    int n = line_scanners(&scanners);
+    return scanners[n - 1].fn;
+}
@@ -0,0 +1,23 @@
+#ifndef NETLOOP_LINE_SCAN_H
+#define NETLOOP_LINE_SCAN_H
+
+// Finding the LF that ends a protocol line. The SIMD variants are built on
+// x86 only and picked by CPU features at runtime.
+
+// First '\n' in [p, end), or NULL.
+typedef const char *(*line_scan_fn)(const char *p, const char *end);
+
+struct line_scanner {
+    const char *name;
+    line_scan_fn fn;
+};
+
+const char *line_scan_scalar(const char *p, const char *end);
+
+// The fastest variant this CPU supports.
+line_scan_fn line_scan_select(void);
+
+// Every variant this CPU supports, slowest first; returns the count.
+int line_scanners(const struct line_scanner **out);
+
+#endif
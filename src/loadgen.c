@@ -0,0 +1,875 @@
+#include <errno.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <event2/util.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_LINE 1024
+#define MAX_DEPTH 1024
+#define IDLE_TICK_USEC 1000
+#define DRAIN_GRACE_SEC 2
+// Binary framing; must match server.c.
+#define BIN_MAGIC 0xB1
+#define BIN_HEADER_LEN 12
+#define BIN_MAX_PAYLOAD (16 * 1024 * 1024)
+
+// HDR-style log-linear histogram: values below HIST_SUB_COUNT are exact, and
+// every power of two above that is split into HIST_SUB_COUNT/2 linear slots,
+// so the relative error stays under 1/64 (~1.6%) from 1ns up to hours.
+#define HIST_SUB_BITS 7
+#define HIST_SUB_COUNT (1u << HIST_SUB_BITS)
+#define HIST_LEVELS 40
+#define HIST_SLOTS ((HIST_LEVELS + 1) * HIST_SUB_COUNT)
+
+enum cmd_kind {
+    CMD_PING,
+    CMD_ECHO,
+    CMD_STATS,
+    CMD_KINDS
+};
+
+static const char *g_kind_names[CMD_KINDS] = { "ping", "echo", "stats" };
+
+struct histogram {
+    uint64_t counts[HIST_SLOTS];
+    uint64_t total;
+    uint64_t max;
+    double sum;
+};
+
+struct config {
+    const char *host;
+    const char *port;
+    const char *unix_path; // replaces host and port
+    int connections;
+    int depth;
+    double rate;
+    double duration_sec;
+    unsigned long max_requests;
+    size_t payload;
+    unsigned int weights[CMD_KINDS];
+    uint64_t expected_interval_ns;
+    int binary;
+    int reconnect;
+};
+
+struct conn;
+
+struct loadgen {
+    struct config cfg;
+    struct event_base *base;
+    struct event *tick;
+    struct conn *conns;
+    struct histogram hist;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    // Prebuilt requests, as text lines or binary frames.
+    char *requests[CMD_KINDS];
+    size_t request_len[CMD_KINDS];
+    int stats_lines;
+    int open_conns;
+    int stopping;
+    uint64_t start_ns;
+    uint64_t stop_ns;
+    uint64_t interval_ns;
+    uint64_t rng;
+    unsigned long sent;
+    unsigned long completed;
+    unsigned long rate_limited;
+    unsigned long errors;
+    unsigned long connects;
+    unsigned long per_kind[CMD_KINDS];
+};
+
+struct conn {
+    struct loadgen *lg;
+    struct bufferevent *bev;
+    // In-flight requests in send order; responses arrive in the same order.
+    uint64_t start_ns[MAX_DEPTH];
+    unsigned char kind[MAX_DEPTH];
+    unsigned int head;
+    unsigned int inflight;
+    int stats_lines_left;
+    uint64_t next_send_ns;
+};
+
+static void conn_read_cb(struct bufferevent *bev, void *arg);
+static void conn_event_cb(struct bufferevent *bev, short events, void *arg);
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static unsigned int hist_index(uint64_t v) {
+    if (v < HIST_SUB_COUNT) {
+        return (unsigned int)v;
+    }
+    unsigned int msb = 63u - (unsigned int)__builtin_clzll(v);
+    unsigned int level = msb - HIST_SUB_BITS + 1;
+    if (level > HIST_LEVELS) {
+        return HIST_SLOTS - 1;
+    }
+    return level * HIST_SUB_COUNT + (unsigned int)(v >> level);
+}
+
+static uint64_t hist_value_at(unsigned int idx) {
+    unsigned int level = idx / HIST_SUB_COUNT;
+    uint64_t sub = idx % HIST_SUB_COUNT;
+    if (level == 0) {
+        return sub;
+    }
+    // Report the highest value that maps to this slot, as HdrHistogram does.
+    return ((sub + 1) << level) - 1;
+}
+
+static void hist_record(struct histogram *h, uint64_t v) {
+    h->counts[hist_index(v)]++;
+    h->total++;
+    h->sum += (double)v;
+    if (v > h->max) {
+        h->max = v;
+    }
+}
+
+// Coordinated-omission correction for closed-loop runs: a stall that blocked
+// the requests we would have sent every expected_interval gets back-filled
+// with the latencies those requests would have seen.
+static void hist_record_corrected(struct histogram *h, uint64_t v, uint64_t expected_interval) {
+    hist_record(h, v);
+    if (expected_interval == 0 || v <= expected_interval) {
+        return;
+    }
+    for (uint64_t missing = v - expected_interval; missing >= expected_interval;
+        missing -= expected_interval) {
+        hist_record(h, missing);
+    }
+}
+
+static uint64_t hist_percentile(const struct histogram *h, double pct) {
+    if (h->total == 0) {
+        return 0;
+    }
+    uint64_t target = (uint64_t)((pct / 100.0) * (double)h->total + 0.5);
+    if (target < 1) {
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < HIST_SLOTS; i++) {
+        seen += h->counts[i];
+        if (seen >= target) {
+            uint64_t v = hist_value_at(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+static uint64_t xorshift64(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static enum cmd_kind pick_kind(struct loadgen *lg) {
+    unsigned int total = 0;
+    for (int k = 0; k < CMD_KINDS; k++) {
+        total += lg->cfg.weights[k];
+    }
+    unsigned int r = (unsigned int)(xorshift64(&lg->rng) % total);
+    for (int k = 0; k < CMD_KINDS; k++) {
+        if (r < lg->cfg.weights[k]) {
+            return (enum cmd_kind)k;
+        }
+        r -= lg->cfg.weights[k];
+    }
+    return CMD_PING;
+}
+
+static int budget_left(const struct loadgen *lg) {
+    if (lg->stopping) {
+        return 0;
+    }
+    return lg->cfg.max_requests == 0 || lg->sent < lg->cfg.max_requests;
+}
+
+static void send_request(struct conn *cn, uint64_t start_ns) {
+    struct loadgen *lg = cn->lg;
+    enum cmd_kind kind = pick_kind(lg);
+    struct evbuffer *out = bufferevent_get_output(cn->bev);
+
+    evbuffer_add(out, lg->requests[kind], lg->request_len[kind]);
+
+    unsigned int slot = (cn->head + cn->inflight) % MAX_DEPTH;
+    cn->start_ns[slot] = start_ns;
+    cn->kind[slot] = (unsigned char)kind;
+    cn->inflight++;
+    lg->sent++;
+    lg->per_kind[kind]++;
+}
+
+static void maybe_finish(struct loadgen *lg) {
+    if (!lg->stopping) {
+        return;
+    }
+    for (int i = 0; i < lg->cfg.connections; i++) {
+        if (lg->conns[i].bev && lg->conns[i].inflight > 0) {
+            return;
+        }
+    }
+    event_base_loopexit(lg->base, NULL);
+}
+
+static void begin_stop(struct loadgen *lg) {
+    if (lg->stopping) {
+        return;
+    }
+    lg->stopping = 1;
+    lg->stop_ns = now_ns();
+    struct timeval grace = { DRAIN_GRACE_SEC, 0 };
+    event_base_loopexit(lg->base, &grace);
+    maybe_finish(lg);
+}
+
+static int conn_open(struct conn *cn) {
+    struct loadgen *lg = cn->lg;
+    cn->bev = bufferevent_socket_new(lg->base, -1, BEV_OPT_CLOSE_ON_FREE);
+    if (!cn->bev) {
+        fprintf(stderr, "loadgen: failed to create bufferevent\n");
+        return -1;
+    }
+    bufferevent_setcb(cn->bev, conn_read_cb, NULL, conn_event_cb, cn);
+    if (lg->cfg.binary) {
+        unsigned char magic = BIN_MAGIC;
+        evbuffer_add(bufferevent_get_output(cn->bev), &magic, 1);
+    }
+    if (bufferevent_socket_connect(cn->bev, (struct sockaddr *)&lg->addr,
+            (int)lg->addr_len) < 0) {
+        fprintf(stderr, "loadgen: connect failed\n");
+        bufferevent_free(cn->bev);
+        cn->bev = NULL;
+        return -1;
+    }
+    {
+        int one = 1;
+        setsockopt(bufferevent_getfd(cn->bev), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    bufferevent_enable(cn->bev, EV_READ | EV_WRITE);
+    cn->head = 0;
+    cn->inflight = 0;
+    cn->stats_lines_left = 0;
+    lg->connects++;
+    return 0;
+}
+
+// Connect-storm mode: tear the connection down and dial again with the next
+// request already queued, so its latency covers the whole handshake. Closing
+// with a zero linger sends RST and keeps TIME_WAIT from eating the ephemeral
+// port range on long runs.
+static void conn_recycle(struct conn *cn) {
+    struct loadgen *lg = cn->lg;
+    struct linger lin = { 1, 0 };
+    setsockopt(bufferevent_getfd(cn->bev), SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+    bufferevent_free(cn->bev);
+    cn->bev = NULL;
+    if (!budget_left(lg) || conn_open(cn) < 0) {
+        if (--lg->open_conns == 0) {
+            begin_stop(lg);
+        }
+        maybe_finish(lg);
+        return;
+    }
+    send_request(cn, now_ns());
+}
+
+static void conn_close(struct conn *cn) {
+    struct loadgen *lg = cn->lg;
+    if (!cn->bev) {
+        return;
+    }
+    lg->errors += cn->inflight;
+    cn->inflight = 0;
+    bufferevent_free(cn->bev);
+    cn->bev = NULL;
+    if (--lg->open_conns == 0) {
+        begin_stop(lg);
+    }
+    maybe_finish(lg);
+}
+
+static void complete_request(struct conn *cn, uint64_t now) {
+    struct loadgen *lg = cn->lg;
+    uint64_t start = cn->start_ns[cn->head];
+    uint64_t latency = now > start ? now - start : 0;
+
+    // Open-loop runs measure from the intended send time, which already
+    // accounts for coordinated omission; closed-loop runs back-fill instead.
+    if (lg->cfg.rate > 0) {
+        hist_record(&lg->hist, latency);
+    } else {
+        hist_record_corrected(&lg->hist, latency, lg->cfg.expected_interval_ns);
+    }
+    lg->completed++;
+    cn->head = (cn->head + 1) % MAX_DEPTH;
+    cn->inflight--;
+}
+
+// Open-loop pacing: each connection owns an evenly spaced schedule and sends
+// everything that is due. When the pipeline is full the request keeps its
+// original intended start time, so queueing delay shows up as latency instead
+// of silently lowering the offered rate.
+static void pace_conn(struct conn *cn, uint64_t now) {
+    struct loadgen *lg = cn->lg;
+    while (cn->next_send_ns <= now && cn->inflight < (unsigned int)lg->cfg.depth &&
+        budget_left(lg)) {
+        send_request(cn, cn->next_send_ns);
+        cn->next_send_ns += lg->interval_ns;
+    }
+}
+
+static uint32_t load_be32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void store_be32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static void read_frames(struct conn *cn, struct evbuffer *input, uint64_t now) {
+    struct loadgen *lg = cn->lg;
+
+    for (;;) {
+        unsigned char hdr[BIN_HEADER_LEN];
+        size_t avail = evbuffer_get_length(input);
+        if (avail < BIN_HEADER_LEN) {
+            return;
+        }
+        evbuffer_copyout(input, hdr, BIN_HEADER_LEN);
+        size_t len = load_be32(hdr + 8);
+        if (avail < BIN_HEADER_LEN + len) {
+            return;
+        }
+        evbuffer_drain(input, BIN_HEADER_LEN + len);
+        if (cn->inflight == 0) {
+            lg->errors++;
+            continue;
+        }
+        if (hdr[1] == 1) {
+            lg->rate_limited++;
+        } else if (hdr[1] != 0) {
+            lg->errors++;
+        }
+        complete_request(cn, now);
+    }
+}
+
+static void read_lines(struct conn *cn, struct evbuffer *input, uint64_t now) {
+    struct loadgen *lg = cn->lg;
+
+    for (;;) {
+        size_t len = 0;
+        char *line = evbuffer_readln(input, &len, EVBUFFER_EOL_LF);
+        if (!line) {
+            break;
+        }
+        if (cn->inflight == 0) {
+            free(line);
+            lg->errors++;
+            continue;
+        }
+
+        if (cn->stats_lines_left > 0) {
+            free(line);
+            if (--cn->stats_lines_left == 0) {
+                complete_request(cn, now);
+            }
+            continue;
+        }
+
+        if (strncmp(line, "429 ", 4) == 0) {
+            lg->rate_limited++;
+            complete_request(cn, now);
+        } else if (strncmp(line, "ERR ", 4) == 0) {
+            lg->errors++;
+            complete_request(cn, now);
+        } else if (cn->kind[cn->head] == CMD_STATS && lg->stats_lines > 1) {
+            cn->stats_lines_left = lg->stats_lines - 1;
+        } else {
+            complete_request(cn, now);
+        }
+        free(line);
+    }
+}
+
+static void conn_read_cb(struct bufferevent *bev, void *arg) {
+    struct conn *cn = arg;
+    struct loadgen *lg = cn->lg;
+    struct evbuffer *input = bufferevent_get_input(bev);
+    uint64_t now = now_ns();
+
+    if (lg->cfg.binary) {
+        read_frames(cn, input, now);
+    } else {
+        read_lines(cn, input, now);
+    }
+
+    if (lg->cfg.reconnect) {
+        if (cn->inflight == 0) {
+            conn_recycle(cn);
+        }
+    } else if (lg->cfg.rate > 0) {
+        pace_conn(cn, now_ns());
+    } else {
+        while (cn->inflight < (unsigned int)lg->cfg.depth && budget_left(lg)) {
+            send_request(cn, now_ns());
+        }
+    }
+    if (!budget_left(lg)) {
+        begin_stop(lg);
+    }
+    maybe_finish(lg);
+}
+
+static void conn_event_cb(struct bufferevent *bev, short events, void *arg) {
+    (void)bev;
+    struct conn *cn = arg;
+    if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR | BEV_EVENT_TIMEOUT)) {
+        // A refused or reset dial is a data point in a storm, not the end of
+        // the connection slot.
+        if (cn->lg->cfg.reconnect && !cn->lg->stopping) {
+            cn->lg->errors += cn->inflight;
+            cn->inflight = 0;
+            conn_recycle(cn);
+            return;
+        }
+        conn_close(cn);
+    }
+}
+
+static void tick_cb(evutil_socket_t fd, short events, void *arg) {
+    (void)fd;
+    (void)events;
+    struct loadgen *lg = arg;
+    uint64_t now = now_ns();
+    uint64_t end = lg->start_ns + (uint64_t)(lg->cfg.duration_sec * 1e9);
+
+    if (now >= end) {
+        begin_stop(lg);
+        return;
+    }
+
+    // Re-arm for the earliest due send so pacing error stays well under the
+    // latencies being measured; closed-loop runs only need the deadline.
+    uint64_t next = now + IDLE_TICK_USEC * 1000ull;
+    if (lg->cfg.rate > 0) {
+        for (int i = 0; i < lg->cfg.connections; i++) {
+            struct conn *cn = &lg->conns[i];
+            if (!cn->bev) {
+                continue;
+            }
+            pace_conn(cn, now);
+            if (cn->next_send_ns < next) {
+                next = cn->next_send_ns;
+            }
+        }
+    }
+    if (!budget_left(lg)) {
+        begin_stop(lg);
+        return;
+    }
+    if (next > end) {
+        next = end;
+    }
+
+    uint64_t delay = next > now ? next - now : 0;
+    struct timeval tv = { (time_t)(delay / 1000000000ull), (suseconds_t)((delay % 1000000000ull) / 1000) };
+    event_add(lg->tick, &tv);
+}
+
+static int resolve_target(struct loadgen *lg) {
+    struct addrinfo hints;
+    struct addrinfo *res = NULL;
+
+    if (lg->cfg.unix_path) {
+        struct sockaddr_un *un = (struct sockaddr_un *)&lg->addr;
+        size_t len = strlen(lg->cfg.unix_path);
+        if (len >= sizeof(un->sun_path)) {
+            fprintf(stderr, "loadgen: socket path too long\n");
+            return -1;
+        }
+        memset(un, 0, sizeof(*un));
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, lg->cfg.unix_path, len);
+        lg->addr_len = sizeof(*un);
+        return 0;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int rv = getaddrinfo(lg->cfg.host, lg->cfg.port, &hints, &res);
+    if (rv != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
+        return -1;
+    }
+    memcpy(&lg->addr, res->ai_addr, res->ai_addrlen);
+    lg->addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+// STATS replies are multi-line and the line count grows with the server, so
+// ask once: everything before the PONG belongs to the STATS reply.
+static int probe_stats_lines(struct loadgen *lg) {
+    int fd = socket(lg->addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&lg->addr, lg->addr_len) < 0) {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+
+    const char *probe = "STATS\nPING\n";
+    if (send(fd, probe, strlen(probe), 0) < 0) {
+        perror("send");
+        close(fd);
+        return -1;
+    }
+
+    char buf[8192];
+    size_t used = 0;
+    int lines = 0;
+    for (;;) {
+        ssize_t n = recv(fd, buf + used, sizeof(buf) - 1 - used, 0);
+        if (n <= 0) {
+            fprintf(stderr, "loadgen: stats probe failed\n");
+            close(fd);
+            return -1;
+        }
+        used += (size_t)n;
+        buf[used] = '\0';
+        char *line = buf;
+        char *nl;
+        lines = 0;
+        while ((nl = strchr(line, '\n')) != NULL) {
+            if (strncmp(line, "PONG", 4) == 0) {
+                close(fd);
+                return lines;
+            }
+            lines++;
+            line = nl + 1;
+        }
+        if (used + 1 >= sizeof(buf)) {
+            fprintf(stderr, "loadgen: stats probe reply too large\n");
+            close(fd);
+            return -1;
+        }
+    }
+}
+
+static int open_connections(struct loadgen *lg) {
+    lg->conns = calloc((size_t)lg->cfg.connections, sizeof(*lg->conns));
+    if (!lg->conns) {
+        fprintf(stderr, "loadgen: out of memory\n");
+        return -1;
+    }
+
+    for (int i = 0; i < lg->cfg.connections; i++) {
+        struct conn *cn = &lg->conns[i];
+        cn->lg = lg;
+        if (conn_open(cn) < 0) {
+            return -1;
+        }
+        lg->open_conns++;
+    }
+    return 0;
+}
+
+static void start_traffic(struct loadgen *lg) {
+    lg->start_ns = now_ns();
+    if (lg->cfg.rate > 0) {
+        lg->interval_ns = (uint64_t)((double)lg->cfg.connections * 1e9 / lg->cfg.rate);
+        if (lg->interval_ns == 0) {
+            lg->interval_ns = 1;
+        }
+        // Stagger connections so they do not all fire on the same tick.
+        for (int i = 0; i < lg->cfg.connections; i++) {
+            lg->conns[i].next_send_ns = lg->start_ns +
+                lg->interval_ns * (uint64_t)i / (uint64_t)lg->cfg.connections;
+        }
+        return;
+    }
+    for (int i = 0; i < lg->cfg.connections; i++) {
+        struct conn *cn = &lg->conns[i];
+        while (cn->inflight < (unsigned int)lg->cfg.depth && budget_left(lg)) {
+            send_request(cn, now_ns());
+        }
+    }
+}
+
+static int parse_mix(struct config *cfg, const char *spec) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    memset(cfg->weights, 0, sizeof(cfg->weights));
+
+    unsigned int total = 0;
+    for (char *tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+        char *colon = strchr(tok, ':');
+        if (!colon) {
+            return -1;
+        }
+        *colon = '\0';
+        int k;
+        for (k = 0; k < CMD_KINDS; k++) {
+            if (strcmp(tok, g_kind_names[k]) == 0) {
+                break;
+            }
+        }
+        if (k == CMD_KINDS) {
+            return -1;
+        }
+        cfg->weights[k] = (unsigned int)strtoul(colon + 1, NULL, 10);
+        total += cfg->weights[k];
+    }
+    return total > 0 ? 0 : -1;
+}
+
+static int build_requests(struct loadgen *lg) {
+    static const char *text[CMD_KINDS] = { "PING\n", NULL, "STATS\n" };
+    static const unsigned char opcodes[CMD_KINDS] = { 1, 2, 3 };
+    size_t payload = lg->cfg.payload;
+
+    for (int k = 0; k < CMD_KINDS; k++) {
+        size_t body = k == CMD_ECHO ? payload : 0;
+        size_t len;
+        char *req = malloc(BIN_HEADER_LEN + 6 + body);
+        if (!req) {
+            return -1;
+        }
+        if (lg->cfg.binary) {
+            unsigned char *hdr = (unsigned char *)req;
+            memset(hdr, 0, BIN_HEADER_LEN);
+            hdr[0] = opcodes[k];
+            store_be32(hdr + 4, (uint32_t)k);
+            store_be32(hdr + 8, (uint32_t)body);
+            memset(req + BIN_HEADER_LEN, 'x', body);
+            len = BIN_HEADER_LEN + body;
+        } else if (k == CMD_ECHO) {
+            memcpy(req, "ECHO ", 5);
+            memset(req + 5, 'x', body);
+            req[5 + body] = '\n';
+            len = 6 + body;
+        } else {
+            len = strlen(text[k]);
+            memcpy(req, text[k], len);
+        }
+        lg->requests[k] = req;
+        lg->request_len[k] = len;
+    }
+    return 0;
+}
+
+static void print_report(const struct loadgen *lg) {
+    uint64_t end = lg->stop_ns ? lg->stop_ns : now_ns();
+    double elapsed = (double)(end - lg->start_ns) / 1e9;
+    const struct histogram *h = &lg->hist;
+
+    printf("connections=%d\n", lg->cfg.connections);
+    printf("pipeline_depth=%d\n", lg->cfg.depth);
+    printf("mode=%s\n", lg->cfg.reconnect ? "connect_storm" :
+        lg->cfg.rate > 0 ? "open_loop" : "closed_loop");
+    printf("protocol=%s\n", lg->cfg.binary ? "binary" : "text");
+    if (lg->cfg.rate > 0) {
+        printf("target_rate=%.0f\n", lg->cfg.rate);
+    }
+    printf("sent=%lu\n", lg->sent);
+    printf("completed=%lu\n", lg->completed);
+    printf("sent_ping=%lu\n", lg->per_kind[CMD_PING]);
+    printf("sent_echo=%lu\n", lg->per_kind[CMD_ECHO]);
+    printf("sent_stats=%lu\n", lg->per_kind[CMD_STATS]);
+    printf("rate_limited=%lu\n", lg->rate_limited);
+    printf("errors=%lu\n", lg->errors);
+    printf("elapsed_seconds=%.3f\n", elapsed);
+    printf("requests_per_sec=%.0f\n", elapsed > 0 ? (double)lg->completed / elapsed : 0.0);
+    printf("connects=%lu\n", lg->connects);
+    printf("connects_per_sec=%.0f\n", elapsed > 0 ? (double)lg->connects / elapsed : 0.0);
+    printf("latency_samples=%lu\n", (unsigned long)h->total);
+    printf("latency_us_mean=%.1f\n", h->total ? h->sum / (double)h->total / 1000.0 : 0.0);
+    printf("latency_us_p50=%.1f\n", (double)hist_percentile(h, 50.0) / 1000.0);
+    printf("latency_us_p90=%.1f\n", (double)hist_percentile(h, 90.0) / 1000.0);
+    printf("latency_us_p99=%.1f\n", (double)hist_percentile(h, 99.0) / 1000.0);
+    printf("latency_us_p999=%.1f\n", (double)hist_percentile(h, 99.9) / 1000.0);
+    printf("latency_us_max=%.1f\n", (double)h->max / 1000.0);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s <host> <port>|--unix <path> [-c conns] [-d depth] [-t seconds] [-n requests]\n"
+        "          [-r rate] [-s echo_bytes] [-m ping:W,echo:W,stats:W] [-i expected_us] [-b] [-k]\n",
+        prog);
+}
+
+int main(int argc, char **argv) {
+    static struct loadgen lg;
+    struct config *cfg = &lg.cfg;
+
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (strcmp(argv[1], "--unix") == 0) {
+        cfg->unix_path = argv[2];
+    } else {
+        cfg->host = argv[1];
+        cfg->port = argv[2];
+    }
+    cfg->connections = 16;
+    cfg->depth = 1;
+    cfg->duration_sec = 10.0;
+    cfg->payload = 16;
+    cfg->weights[CMD_PING] = 1;
+
+    for (int i = 3; i < argc; i++) {
+        const char *opt = argv[i];
+        if (strcmp(opt, "-b") == 0) {
+            cfg->binary = 1;
+            continue;
+        }
+        if (strcmp(opt, "-k") == 0) {
+            cfg->reconnect = 1;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *val = argv[++i];
+        if (strcmp(opt, "-c") == 0) {
+            cfg->connections = atoi(val);
+        } else if (strcmp(opt, "-d") == 0) {
+            cfg->depth = atoi(val);
+        } else if (strcmp(opt, "-t") == 0) {
+            cfg->duration_sec = atof(val);
+        } else if (strcmp(opt, "-n") == 0) {
+            cfg->max_requests = strtoul(val, NULL, 10);
+        } else if (strcmp(opt, "-r") == 0) {
+            cfg->rate = atof(val);
+        } else if (strcmp(opt, "-s") == 0) {
+            cfg->payload = strtoul(val, NULL, 10);
+        } else if (strcmp(opt, "-i") == 0) {
+            cfg->expected_interval_ns = strtoull(val, NULL, 10) * 1000ull;
+        } else if (strcmp(opt, "-m") == 0) {
+            if (parse_mix(cfg, val) < 0) {
+                fprintf(stderr, "loadgen: bad mix '%s'\n", val);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (cfg->connections < 1 || cfg->depth < 1 || cfg->depth > MAX_DEPTH ||
+        cfg->duration_sec <= 0) {
+        fprintf(stderr, "loadgen: need -c >= 1, 1 <= -d <= %d, -t > 0\n", MAX_DEPTH);
+        return 1;
+    }
+    if (cfg->reconnect && (cfg->rate > 0 || cfg->depth != 1)) {
+        fprintf(stderr, "loadgen: -k runs closed loop with one request per connection\n");
+        return 1;
+    }
+    if (!cfg->binary && cfg->payload + 6 >= MAX_LINE) {
+        fprintf(stderr, "loadgen: text echo payload must be under %d bytes\n", MAX_LINE - 6);
+        return 1;
+    }
+    if (cfg->payload > BIN_MAX_PAYLOAD) {
+        fprintf(stderr, "loadgen: echo payload must be at most %d bytes\n", BIN_MAX_PAYLOAD);
+        return 1;
+    }
+    if (build_requests(&lg) < 0) {
+        fprintf(stderr, "loadgen: out of memory\n");
+        return 1;
+    }
+
+    lg.rng = 0x9e3779b97f4a7c15ull ^ (uint64_t)getpid();
+
+    if (resolve_target(&lg) < 0) {
+        return 1;
+    }
+    lg.stats_lines = 1;
+    if (cfg->weights[CMD_STATS] > 0 && !cfg->binary) {
+        lg.stats_lines = probe_stats_lines(&lg);
+        if (lg.stats_lines < 1) {
+            return 1;
+        }
+    }
+
+    {
+        // Precise timers (timerfd) keep open-loop pacing at microsecond grain.
+        struct event_config *ev_cfg = event_config_new();
+        if (ev_cfg) {
+            event_config_set_flag(ev_cfg, EVENT_BASE_FLAG_PRECISE_TIMER);
+            lg.base = event_base_new_with_config(ev_cfg);
+            event_config_free(ev_cfg);
+        }
+    }
+    if (!lg.base) {
+        fprintf(stderr, "loadgen: failed to create event_base\n");
+        return 1;
+    }
+    if (open_connections(&lg) < 0) {
+        return 1;
+    }
+
+    lg.tick = event_new(lg.base, -1, 0, tick_cb, &lg);
+    if (!lg.tick) {
+        fprintf(stderr, "loadgen: failed to create tick event\n");
+        return 1;
+    }
+
+    start_traffic(&lg);
+    tick_cb(-1, 0, &lg);
+    event_base_dispatch(lg.base);
+    if (!lg.stop_ns) {
+        lg.stop_ns = now_ns();
+    }
+
+    print_report(&lg);
+
+    event_free(lg.tick);
+    for (int i = 0; i < cfg->connections; i++) {
+        if (lg.conns[i].bev) {
+            bufferevent_free(lg.conns[i].bev);
+        }
+    }
+    free(lg.conns);
+    for (int k = 0; k < CMD_KINDS; k++) {
+        free(lg.requests[k]);
+    }
+    event_base_free(lg.base);
+    return 0;
+}
@@ -0,0 +1,226 @@
+#include "log.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_RECORD_SIZE 256
+#define LOG_RING_RECORDS 4096 // power of two; 1 MiB per thread
+#define LOG_DRAIN_SLEEP_MS 5
+#define LOG_OUT_BUF 65536
+
+struct log_record {
+    uint32_t len;
+    char msg[LOG_RECORD_SIZE - sizeof(uint32_t)];
+};
+
+// head and the producer's counters share one cache line, tail gets its own,
+// so the producer and the drain thread only contend when the ring wraps.
+struct log_ring {
+    _Alignas(64) uint64_t head;
+    uint64_t cached_tail;
+    unsigned long dropped;
+    unsigned long suppressed;
+    _Alignas(64) uint64_t tail;
+    struct log_ring *next;
+    struct log_record *records;
+};
+
+enum log_level g_log_level = LOG_INFO;
+
+static struct log_ring *g_rings; // push-only list, walked without the lock
+static pthread_mutex_t g_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct log_ring *t_ring;
+static pthread_t g_drain_thread;
+static int g_running;
+static int g_stop;
+
+// Copies everything queued in one ring into out, flushing when it fills.
+// Returns the number of records consumed.
+static size_t drain_ring(struct log_ring *r, char *out, size_t *out_len) {
+    uint64_t tail = r->tail;
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    size_t n = 0;
+
+    while (tail != head) {
+        const struct log_record *rec = &r->records[tail & (LOG_RING_RECORDS - 1)];
+        if (*out_len + rec->len + 1 > LOG_OUT_BUF) {
+            fwrite(out, 1, *out_len, stdout);
+            *out_len = 0;
+        }
+        memcpy(out + *out_len, rec->msg, rec->len);
+        *out_len += rec->len;
+        out[(*out_len)++] = '\n';
+        tail++;
+        n++;
+        // Hand slots back as we go so a busy producer is not starved.
+        if ((n & 63) == 0) {
+            __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+        }
+    }
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    return n;
+}
+
+static size_t drain_all(char *out) {
+    size_t out_len = 0;
+    size_t n = 0;
+    for (struct log_ring *r = __atomic_load_n(&g_rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+        n += drain_ring(r, out, &out_len);
+    }
+    if (out_len > 0) {
+        fwrite(out, 1, out_len, stdout);
+    }
+    if (n > 0) {
+        fflush(stdout);
+    }
+    return n;
+}
+
+static void *drain_main(void *arg) {
+    (void)arg;
+    char *out = malloc(LOG_OUT_BUF);
+    if (!out) {
+        return NULL;
+    }
+    for (;;) {
+        int stop = __atomic_load_n(&g_stop, __ATOMIC_ACQUIRE);
+        if (drain_all(out) == 0) {
+            if (stop) {
+                break;
+            }
+            struct timespec ts = { 0, LOG_DRAIN_SLEEP_MS * 1000000L };
+            nanosleep(&ts, NULL);
+        }
+    }
+    free(out);
+    return NULL;
+}
+
+int log_init(enum log_level level) {
+    g_log_level = level;
+    if (pthread_create(&g_drain_thread, NULL, drain_main, NULL) != 0) {
+        return -1;
+    }
+    g_running = 1;
+    return 0;
+}
+
+int log_attach_thread(void) {
+    if (t_ring) {
+        return 0;
+    }
+    struct log_ring *r = aligned_alloc(64, sizeof(*r));
+    if (!r) {
+        return -1;
+    }
+    memset(r, 0, sizeof(*r));
+    r->records = malloc(sizeof(struct log_record) * LOG_RING_RECORDS);
+    if (!r->records) {
+        free(r);
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_rings_lock);
+    r->next = g_rings;
+    __atomic_store_n(&g_rings, r, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_rings_lock);
+    t_ring = r;
+    return 0;
+}
+
+void log_shutdown(void) {
+    if (!g_running) {
+        return;
+    }
+    __atomic_store_n(&g_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(g_drain_thread, NULL);
+    g_running = 0;
+}
+
+int log_level_parse(const char *name, enum log_level *out) {
+    static const char *const names[] = { "debug", "info", "warn", "error" };
+    for (int i = 0; i < 4; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *out = (enum log_level)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void log_write(enum log_level level, const char *fmt, ...) {
+    (void)level; // filtered by the LOG macros before formatting
+    struct log_ring *r = t_ring;
+    va_list ap;
+
+    if (!r || !g_running) {
+        va_start(ap, fmt);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+        fputc('\n', stderr);
+        return;
+    }
+
+    uint64_t head = r->head;
+    if (head - r->cached_tail >= LOG_RING_RECORDS) {
+        r->cached_tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (head - r->cached_tail >= LOG_RING_RECORDS) {
+            __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    struct log_record *rec = &r->records[head & (LOG_RING_RECORDS - 1)];
+    va_start(ap, fmt);
+    int n = vsnprintf(rec->msg, sizeof(rec->msg), fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+        return;
+    }
+    // Long records are truncated to the slot.
+    rec->len = (size_t)n < sizeof(rec->msg) ? (uint32_t)n : (uint32_t)sizeof(rec->msg) - 1;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void log_note_suppressed(void) {
+    struct log_ring *r = t_ring;
+    if (r) {
+        __atomic_store_n(&r->suppressed, r->suppressed + 1, __ATOMIC_RELAXED);
+    }
+}
+
+int log_limit_allow(struct log_limit *l, unsigned per_sec) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    uint64_t now_s = (uint64_t)ts.tv_sec;
+    if (now_s != l->window_s) {
+        l->window_s = now_s;
+        l->count = 0;
+    }
+    if (l->count < per_sec) {
+        l->count++;
+        return 1;
+    }
+    log_note_suppressed();
+    return 0;
+}
+
+unsigned long log_dropped(void) {
+    unsigned long total = 0;
+    for (struct log_ring *r = __atomic_load_n(&g_rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+        total += __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+unsigned long log_suppressed(void) {
+    unsigned long total = 0;
+    for (struct log_ring *r = __atomic_load_n(&g_rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+        total += __atomic_load_n(&r->suppressed, __ATOMIC_RELAXED);
+    }
+    return total;
+}
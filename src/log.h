@@ -0,0 +1,77 @@
+#ifndef NETLOOP_LOG_H
+#define NETLOOP_LOG_H
+
+#include <stdint.h>
+
+// Asynchronous logger. Each event loop thread owns a single-producer ring of
+// fixed-size records; a background thread drains every ring to stdout. The
+// producer never blocks and never makes a syscall: when its ring is full the
+// record is dropped and counted instead.
+
+enum log_level {
+    LOG_DEBUG = 0,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR,
+};
+
+extern enum log_level g_log_level;
+
+// Starts the drain thread. Until this is called, log_write falls back to a
+// synchronous fprintf to stderr.
+int log_init(enum log_level level);
+
+// Gives the calling thread its own ring. Threads that never attach log
+// synchronously, so every event loop thread should call this once.
+int log_attach_thread(void);
+
+// Drains everything still queued and stops the drain thread.
+void log_shutdown(void);
+
+int log_level_parse(const char *name, enum log_level *out);
+
+void log_write(enum log_level level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// Records lost to a full ring, and records skipped by rate limits or
+// sampling, summed over every thread.
+unsigned long log_dropped(void);
+unsigned long log_suppressed(void);
+
+// Per call site, per thread: allows up to per_sec records each second.
+struct log_limit {
+    uint64_t window_s;
+    unsigned count;
+};
+
+int log_limit_allow(struct log_limit *l, unsigned per_sec);
+void log_note_suppressed(void);
+
+#define LOG_ENABLED(level) ((level) >= g_log_level)
+
+#define LOG(level, ...) do { \
+    if (LOG_ENABLED(level)) { \
+        log_write((level), __VA_ARGS__); \
+    } \
+} while (0)
+
+#define LOG_RATELIMIT(level, per_sec, ...) do { \
+    static __thread struct log_limit log_limit_; \
+    if (LOG_ENABLED(level) && log_limit_allow(&log_limit_, (per_sec))) { \
+        log_write((level), __VA_ARGS__); \
+    } \
+} while (0)
+
+// Keeps one record in every one_in.
+#define LOG_SAMPLE(level, one_in, ...) do { \
+    static __thread unsigned log_sample_; \
+    if (LOG_ENABLED(level)) { \
+        if (log_sample_++ % (one_in) == 0) { \
+            log_write((level), __VA_ARGS__); \
+        } else { \
+            log_note_suppressed(); \
+        } \
+    } \
+} while (0)
+
+#endif
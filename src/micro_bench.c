@@ -0,0 +1,519 @@
+#include <arpa/inet.h>
+#include <event2/buffer.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#include "chat_room.h"
+#include "command.h"
+#include "line_scan.h"
+#include "rate_limit.h"
+#include "stats.h"
+
+// In-process microbenchmarks for the per-request kernels the servers link
+// from libnetloop: line scanning, verb dispatch, the rate limiter tiers,
+// stats formatting and chat fan-out. No sockets, so runs compare kernels
+// without network noise. Each kernel prints one key=value line:
+//
+//   bench=<name> [param=...] ops=<n> ns_per_op=<f> cycles_per_op=<f> allocs_per_op=<f>
+//
+// cycles_per_op counts TSC ticks (reference cycles), 0 where there is no TSC;
+// allocs_per_op is -1 where allocations cannot be counted.
+
+#define DEFAULT_OPS 2000000
+#define SCAN_LINES 4096
+// Chat lines: a short one, and the longest the chat server allows.
+#define BROADCAST_SHORT 64
+#define BROADCAST_LONG 1023
+// Broadcasts between drains: recipients flush about this often under load.
+#define BROADCAST_FLUSH 32
+
+static const char *const g_verbs[] = {
+    "PING", "ECHO", "STATS", "HELLO", "QUIT", "GET", "SET", "DEL", "INCR", "EXPIRE",
+    "STREAM", "FILE"
+};
+#define NUM_VERBS (sizeof(g_verbs) / sizeof(g_verbs[0]))
+
+// Keeps results alive so the compiler cannot drop the work behind them.
+static volatile uint64_t g_sink;
+
+#ifdef __GLIBC__
+// Every allocation in the process, libevent's included, goes through these.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void __libc_free(void *p);
+
+static unsigned long g_allocs;
+
+void *malloc(size_t size) {
+    g_allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    g_allocs++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+    g_allocs++;
+    return __libc_realloc(p, size);
+}
+
+void *aligned_alloc(size_t align, size_t size) {
+    g_allocs++;
+    return __libc_memalign(align, size);
+}
+
+int posix_memalign(void **out, size_t align, size_t size) {
+    g_allocs++;
+    void *p = __libc_memalign(align, size);
+    if (!p) {
+        return 12; // ENOMEM
+    }
+    *out = p;
+    return 0;
+}
+
+void free(void *p) {
+    __libc_free(p);
+}
+
+#define ALLOCS_COUNTED 1
+#else
+static unsigned long g_allocs;
+#define ALLOCS_COUNTED 0
+#endif
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t cycles(void) {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+typedef void (*bench_fn)(void *ctx, size_t ops);
+
+struct bench_opts {
+    size_t ops;
+    const char *filter;
+};
+
+// Runs fn for a tenth of the ops to warm caches and branch predictors, then
+// times the full count.
+static void bench_run(const struct bench_opts *o, const char *name, const char *param,
+    bench_fn fn, void *ctx) {
+    fn(ctx, o->ops / 10 + 1);
+
+    unsigned long allocs = g_allocs;
+    uint64_t c0 = cycles();
+    uint64_t t0 = now_ns();
+    fn(ctx, o->ops);
+    uint64_t t1 = now_ns();
+    uint64_t c1 = cycles();
+    allocs = g_allocs - allocs;
+
+    printf("bench=%s%s%s ops=%zu ns_per_op=%.2f cycles_per_op=%.2f allocs_per_op=%.3f\n",
+        name, param ? " " : "", param ? param : "", o->ops,
+        (double)(t1 - t0) / (double)o->ops,
+        (double)(c1 - c0) / (double)o->ops,
+        ALLOCS_COUNTED ? (double)allocs / (double)o->ops : -1.0);
+    fflush(stdout);
+}
+
+static int bench_selected(const struct bench_opts *o, const char *name) {
+    return !o->filter || strstr(name, o->filter) != NULL;
+}
+
+static void *xmalloc(size_t size) {
+    void *p = malloc(size);
+    if (!p) {
+        fprintf(stderr, "micro_bench: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+// A pipelined request stream: the verb mix and line lengths a KV-heavy
+// client sends.
+static char *make_lines(size_t *len) {
+    size_t cap = SCAN_LINES * 64;
+    char *buf = xmalloc(cap);
+    size_t used = 0;
+    for (unsigned int i = 0; i < SCAN_LINES; i++) {
+        int wrote;
+        switch (i % 8) {
+        case 0:
+            wrote = snprintf(buf + used, cap - used, "PING\n");
+            break;
+        case 1:
+        case 2:
+            wrote = snprintf(buf + used, cap - used, "SET user:%05u session-%08x\n", i, i * 2654435761u);
+            break;
+        case 3:
+            wrote = snprintf(buf + used, cap - used, "ECHO the quick brown fox %u\n", i);
+            break;
+        default:
+            wrote = snprintf(buf + used, cap - used, "GET user:%05u\n", i);
+            break;
+        }
+        used += (size_t)wrote;
+    }
+    *len = used;
+    return buf;
+}
+
+struct scan_ctx {
+    const char *buf;
+    size_t len;
+    line_scan_fn scan;
+    const struct command_table *table;
+};
+
+// One op is one line: find its LF, as process_line's caller does.
+static void bench_scan(void *arg, size_t ops) {
+    struct scan_ctx *s = arg;
+    const char *p = s->buf;
+    const char *end = s->buf + s->len;
+    uint64_t sum = 0;
+    for (size_t op = 0; op < ops; op++) {
+        const char *lf = s->scan(p, end);
+        sum += (uint64_t)(lf - p);
+        p = lf + 1 < end ? lf + 1 : s->buf;
+    }
+    g_sink += sum;
+}
+
+// One op is one line found, split and looked up: the parse and dispatch
+// half of handle_command, without running the handler.
+static void bench_dispatch(void *arg, size_t ops) {
+    struct scan_ctx *s = arg;
+    const char *p = s->buf;
+    const char *end = s->buf + s->len;
+    uint64_t sum = 0;
+    for (size_t op = 0; op < ops; op++) {
+        const char *lf = s->scan(p, end);
+        struct command_line cl;
+        command_split(p, (size_t)(lf - p), &cl);
+        sum += (uint64_t)command_find(s->table, cl.verb, cl.verb_len) + cl.arg_len;
+        p = lf + 1 < end ? lf + 1 : s->buf;
+    }
+    g_sink += sum;
+}
+
+static void run_parse(const struct bench_opts *o) {
+    size_t len;
+    char *buf = make_lines(&len);
+    struct command_table table;
+    if (command_table_init(&table, g_verbs, NUM_VERBS) < 0) {
+        exit(1);
+    }
+
+    const struct line_scanner *scanners;
+    int n = line_scanners(&scanners);
+    for (int i = 0; i < n; i++) {
+        char param[32];
+        snprintf(param, sizeof(param), "variant=%s", scanners[i].name);
+        struct scan_ctx s = { buf, len, scanners[i].fn, &table };
+        if (bench_selected(o, "scan_line")) {
+            bench_run(o, "scan_line", param, bench_scan, &s);
+        }
+        if (bench_selected(o, "dispatch")) {
+            bench_run(o, "dispatch", param, bench_dispatch, &s);
+        }
+    }
+    free(buf);
+}
+
+struct conn_bucket_ctx {
+    uint64_t tokens;
+    uint64_t last_us;
+    uint64_t now_us;
+};
+
+// The connection tier of bucket_consume at the server's default 5/s, 10
+// burst, with the loop clock moving 1 ms per request.
+static void bench_conn_bucket(void *arg, size_t ops) {
+    struct conn_bucket_ctx *b = arg;
+    uint64_t allowed = 0;
+    for (size_t op = 0; op < ops; op++) {
+        b->now_us += 1000;
+        b->tokens = bucket_refill(b->tokens, b->last_us, b->now_us, 5, 10);
+        b->last_us = b->now_us;
+        if (b->tokens >= TOKEN_SCALE) {
+            b->tokens -= TOKEN_SCALE;
+            allowed++;
+        }
+    }
+    g_sink += allowed;
+}
+
+struct ip_bucket_ctx {
+    struct ip_limiter limiter;
+    struct ip_key *keys;
+    size_t num_keys;
+    uint64_t now_us;
+};
+
+// The shared per-address tier, uncontended, cycling through num_keys sources.
+static void bench_ip_bucket(void *arg, size_t ops) {
+    struct ip_bucket_ctx *b = arg;
+    uint64_t allowed = 0;
+    for (size_t op = 0; op < ops; op++) {
+        int table_full;
+        b->now_us += 10;
+        allowed += (uint64_t)ip_limiter_consume(&b->limiter, &b->keys[op % b->num_keys],
+            b->now_us, 50, 100, &table_full);
+    }
+    g_sink += allowed;
+}
+
+static void run_rate_limit(const struct bench_opts *o) {
+    if (bench_selected(o, "bucket_conn")) {
+        struct conn_bucket_ctx b = { 10 * TOKEN_SCALE, 1, 1 };
+        bench_run(o, "bucket_conn", NULL, bench_conn_bucket, &b);
+    }
+
+    if (!bench_selected(o, "bucket_ip")) {
+        return;
+    }
+    static const size_t key_counts[] = { 1, 1024, 65536 };
+    for (size_t k = 0; k < sizeof(key_counts) / sizeof(key_counts[0]); k++) {
+        struct ip_bucket_ctx b;
+        memset(&b, 0, sizeof(b));
+        if (ip_limiter_init(&b.limiter) < 0) {
+            fprintf(stderr, "micro_bench: out of memory\n");
+            exit(1);
+        }
+        b.num_keys = key_counts[k];
+        b.keys = xmalloc(b.num_keys * sizeof(*b.keys));
+        b.now_us = 1;
+        for (size_t i = 0; i < b.num_keys; i++) {
+            struct sockaddr_storage addr;
+            memset(&addr, 0, sizeof(addr));
+            struct sockaddr_in *in = (struct sockaddr_in *)&addr;
+            in->sin_family = AF_INET;
+            in->sin_addr.s_addr = htonl(0x0a000000u + (uint32_t)i);
+            ip_key_from_sockaddr(&addr, &b.keys[i]);
+        }
+        char param[32];
+        snprintf(param, sizeof(param), "sources=%zu", b.num_keys);
+        bench_run(o, "bucket_ip", param, bench_ip_bucket, &b);
+        free(b.keys);
+        ip_limiter_free(&b.limiter);
+    }
+}
+
+struct stats_ctx {
+    struct stats_report report;
+    struct latency_hist hist;
+    uint64_t seed;
+    char buf[16384];
+};
+
+static uint64_t next_rand(uint64_t *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return *seed;
+}
+
+// Latencies spread over 100 ns to ~1 ms, as a busy command histogram sees.
+static void bench_hist_record(void *arg, size_t ops) {
+    struct stats_ctx *s = arg;
+    for (size_t op = 0; op < ops; op++) {
+        hist_record(&s->hist, 100 + (next_rand(&s->seed) & 0xfffff));
+    }
+}
+
+static void bench_stats_format(void *arg, size_t ops) {
+    struct stats_ctx *s = arg;
+    uint64_t sum = 0;
+    for (size_t op = 0; op < ops; op++) {
+        sum += stats_format(&s->report, s->buf, sizeof(s->buf));
+    }
+    g_sink += sum;
+}
+
+static void bench_latency_format(void *arg, size_t ops) {
+    struct stats_ctx *s = arg;
+    uint64_t sum = 0;
+    for (size_t op = 0; op < ops; op++) {
+        sum += latency_format("get", &s->hist, s->buf, sizeof(s->buf), 0);
+    }
+    g_sink += sum;
+}
+
+static void run_stats(const struct bench_opts *o) {
+    static const char *const names[] = {
+        "ping", "echo", "stats", "hello", "quit", "rate", "get", "set", "del", "incr", "expire",
+        "stream", "file", "unknown"
+    };
+    struct stats_ctx *s = xmalloc(sizeof(*s));
+    memset(s, 0, sizeof(*s));
+    s->seed = 0x9e3779b97f4a7c15ull;
+
+    if (bench_selected(o, "hist_record")) {
+        bench_run(o, "hist_record", NULL, bench_hist_record, s);
+    } else {
+        bench_hist_record(s, 100000);
+    }
+
+    // Plausible, many-digit counters so the number formatting is not trivial.
+    unsigned long *counters = (unsigned long *)&s->report.totals;
+    for (size_t i = 0; i < sizeof(s->report.totals) / sizeof(unsigned long); i++) {
+        counters[i] = 1000003ul * (i + 1);
+    }
+    s->report.kv.hits = 123456789;
+    s->report.kv.misses = 2345678;
+    s->report.loop_iteration = s->hist;
+    s->report.loop_lag = s->hist;
+    s->report.steering = "none";
+    s->report.command_names = names;
+    s->report.num_commands = sizeof(names) / sizeof(names[0]);
+
+    // Formatting is far slower than the other kernels; fewer ops keep the
+    // run short.
+    struct bench_opts slow = *o;
+    slow.ops = o->ops / 100 + 1;
+    if (bench_selected(o, "stats_format")) {
+        bench_run(&slow, "stats_format", NULL, bench_stats_format, s);
+    }
+    if (bench_selected(o, "latency_format")) {
+        bench_run(&slow, "latency_format", NULL, bench_latency_format, s);
+    }
+    free(s);
+}
+
+struct broadcast_ctx {
+    struct chat_room room;
+    struct chat_member *members;
+    size_t num_members;
+    char line[BROADCAST_LONG];
+    size_t len;
+    size_t sent;
+};
+
+// One op is one line fanned out to every member, with every member's output
+// drained each BROADCAST_FLUSH lines as if the socket had taken it.
+static void bench_broadcast(void *arg, size_t ops) {
+    struct broadcast_ctx *b = arg;
+    for (size_t op = 0; op < ops; op++) {
+        chat_room_broadcast(&b->room, b->line, b->len);
+        if (++b->sent % BROADCAST_FLUSH == 0) {
+            for (size_t i = 0; i < b->num_members; i++) {
+                evbuffer_drain(b->members[i].out, evbuffer_get_length(b->members[i].out));
+            }
+        }
+    }
+}
+
+// The server's per-request output path: one short reply appended, then
+// written out.
+static void bench_reply_buffer(void *arg, size_t ops) {
+    struct evbuffer *out = arg;
+    static const char reply[] = "VALUE session-0000002a\n";
+    for (size_t op = 0; op < ops; op++) {
+        evbuffer_add(out, reply, sizeof(reply) - 1);
+        evbuffer_drain(out, sizeof(reply) - 1);
+    }
+}
+
+static void run_buffers(const struct bench_opts *o) {
+    if (bench_selected(o, "reply_buffer")) {
+        struct evbuffer *out = evbuffer_new();
+        if (!out) {
+            fprintf(stderr, "micro_bench: out of memory\n");
+            exit(1);
+        }
+        bench_run(o, "reply_buffer", NULL, bench_reply_buffer, out);
+        evbuffer_free(out);
+    }
+
+    if (!bench_selected(o, "broadcast")) {
+        return;
+    }
+    static const size_t member_counts[] = { 1, 100, 1000 };
+    static const size_t line_lens[] = { BROADCAST_SHORT, BROADCAST_LONG };
+    for (size_t k = 0; k < sizeof(member_counts) / sizeof(member_counts[0]) * 2; k++) {
+        struct broadcast_ctx b;
+        memset(&b, 0, sizeof(b));
+        b.num_members = member_counts[k / 2];
+        b.len = line_lens[k % 2];
+        b.members = xmalloc(b.num_members * sizeof(*b.members));
+        memset(b.members, 0, b.num_members * sizeof(*b.members));
+        for (size_t i = 0; i < b.num_members; i++) {
+            b.members[i].out = evbuffer_new();
+            if (!b.members[i].out) {
+                fprintf(stderr, "micro_bench: out of memory\n");
+                exit(1);
+            }
+            snprintf(b.members[i].name, sizeof(b.members[i].name), "anon%zu", i + 1);
+            chat_room_join(&b.room, &b.members[i]);
+        }
+        memset(b.line, 'x', b.len - 1);
+        b.line[b.len - 1] = '\n';
+
+        // Each op touches every member; keep the total work near o->ops.
+        struct bench_opts scaled = *o;
+        scaled.ops = o->ops / b.num_members + 1;
+        char param[48];
+        snprintf(param, sizeof(param), "members=%zu bytes=%zu", b.num_members, b.len);
+        bench_run(&scaled, "broadcast", param, bench_broadcast, &b);
+
+        for (size_t i = 0; i < b.num_members; i++) {
+            evbuffer_free(b.members[i].out);
+        }
+        free(b.members);
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-n ops] [-f name_substring]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    struct bench_opts o = { DEFAULT_OPS, NULL };
+    int opt;
+    while ((opt = getopt(argc, argv, "n:f:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            o.ops = strtoul(optarg, NULL, 10);
+            break;
+        case 'f':
+            o.filter = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (o.ops == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    run_parse(&o);
+    run_rate_limit(&o);
+    run_stats(&o);
+    run_buffers(&o);
+    return 0;
+}
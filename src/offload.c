@@ -0,0 +1,115 @@
+#include "offload.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+int offload_done_init(struct offload_done *d) {
+    d->head = NULL;
+    d->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (d->efd < 0) {
+        perror("eventfd");
+        return -1;
+    }
+    return 0;
+}
+
+void offload_done_free(struct offload_done *d) {
+    if (d->efd >= 0) {
+        close(d->efd);
+        d->efd = -1;
+    }
+}
+
+// Only the push that finds the stack empty writes the eventfd: the loop has
+// not taken anything since, so one wakeup covers every job behind it.
+static void offload_done_push(struct offload_done *d, struct offload_job *job) {
+    struct offload_job *head = __atomic_load_n(&d->head, __ATOMIC_RELAXED);
+    do {
+        job->next = head;
+    } while (!__atomic_compare_exchange_n(&d->head, &head, job, 1,
+        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    if (!head) {
+        uint64_t one = 1;
+        ssize_t n = write(d->efd, &one, sizeof(one));
+        (void)n; // a full counter is still readable
+    }
+}
+
+// The eventfd is read before the stack is swapped out, so a push that lands
+// in between leaves the fd readable and at worst costs an empty wakeup.
+struct offload_job *offload_done_take(struct offload_done *d) {
+    uint64_t count;
+    ssize_t n = read(d->efd, &count, sizeof(count));
+    (void)n;
+    struct offload_job *job = __atomic_exchange_n(&d->head, NULL, __ATOMIC_ACQUIRE);
+    struct offload_job *oldest = NULL;
+    while (job) {
+        struct offload_job *next = job->next;
+        job->next = oldest;
+        oldest = job;
+        job = next;
+    }
+    return oldest;
+}
+
+static void *offload_thread(void *arg) {
+    struct offload_pool *p = arg;
+    for (;;) {
+        pthread_mutex_lock(&p->lock);
+        while (!p->first) {
+            pthread_cond_wait(&p->ready, &p->lock);
+        }
+        struct offload_job *job = p->first;
+        p->first = job->next;
+        if (!p->first) {
+            p->last = NULL;
+        }
+        __atomic_store_n(&p->depth, p->depth - 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&p->lock);
+
+        job->run(job);
+        offload_done_push(job->done, job);
+    }
+    return NULL;
+}
+
+int offload_pool_start(struct offload_pool *p, int threads) {
+    memset(p, 0, sizeof(*p));
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->ready, NULL);
+    p->threads = calloc((size_t)threads, sizeof(*p->threads));
+    if (!p->threads) {
+        fprintf(stderr, "offload: out of memory\n");
+        return -1;
+    }
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&p->threads[i], NULL, offload_thread, p) != 0) {
+            fprintf(stderr, "offload: failed to start thread %d\n", i);
+            return -1;
+        }
+        p->num_threads++;
+    }
+    return 0;
+}
+
+void offload_submit(struct offload_pool *p, struct offload_job *job) {
+    job->next = NULL;
+    pthread_mutex_lock(&p->lock);
+    if (p->last) {
+        p->last->next = job;
+    } else {
+        p->first = job;
+    }
+    p->last = job;
+    __atomic_store_n(&p->depth, p->depth + 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&p->ready);
+    pthread_mutex_unlock(&p->lock);
+}
+
+unsigned long offload_depth(struct offload_pool *p) {
+    return __atomic_load_n(&p->depth, __ATOMIC_RELAXED);
+}
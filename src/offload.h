@@ -0,0 +1,51 @@
+#ifndef NETLOOP_OFFLOAD_H
+#define NETLOOP_OFFLOAD_H
+
+#include <pthread.h>
+
+// A thread pool for work too slow to run on an event loop. Jobs go in through
+// one mutex-protected FIFO shared by every loop; finished jobs come back to
+// the loop named in the job through that loop's completion queue, which never
+// takes a lock.
+
+struct offload_done;
+
+// Embed as the first member of the caller's job. run is called on a pool
+// thread and must not touch anything the owning loop uses unlocked.
+struct offload_job {
+    struct offload_job *next;
+    void (*run)(struct offload_job *job);
+    struct offload_done *done;
+};
+
+// One per event loop: a lock-free stack any pool thread pushes to, and an
+// eventfd that turns readable when the stack goes from empty to non-empty,
+// so the loop polls it like any other fd.
+struct offload_done {
+    struct offload_job *head;
+    int efd;
+};
+
+struct offload_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    struct offload_job *first;
+    struct offload_job *last;
+    unsigned long depth; // submitted, not yet picked up by a thread
+    pthread_t *threads;
+    int num_threads;
+};
+
+int offload_done_init(struct offload_done *d);
+void offload_done_free(struct offload_done *d);
+
+// Everything completed so far, oldest first (linked through next); NULL if
+// nothing is. Clears the eventfd, so call it from the fd's read callback.
+struct offload_job *offload_done_take(struct offload_done *d);
+
+// The threads run until the process exits.
+int offload_pool_start(struct offload_pool *p, int threads);
+void offload_submit(struct offload_pool *p, struct offload_job *job);
+unsigned long offload_depth(struct offload_pool *p);
+
+#endif
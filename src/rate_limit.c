@@ -0,0 +1,121 @@
+#include "rate_limit.h"
+
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+
+uint64_t bucket_refill(uint64_t tokens, uint64_t last_us, uint64_t now_us,
+    unsigned long rate, unsigned long burst) {
+    uint64_t cap = (uint64_t)burst * TOKEN_SCALE;
+    if (now_us > last_us) {
+        uint64_t elapsed = now_us - last_us;
+        // Past this point the bucket is full anyway; keeps the multiply in range.
+        if (elapsed >= (cap / rate) + 1) {
+            return cap;
+        }
+        tokens += elapsed * rate;
+    }
+    return tokens < cap ? tokens : cap;
+}
+
+void ip_key_from_sockaddr(const struct sockaddr_storage *addr, struct ip_key *key) {
+    memset(key, 0, sizeof(*key));
+    if (addr->ss_family == AF_INET6) {
+        memcpy(key->addr, &((const struct sockaddr_in6 *)addr)->sin6_addr, 16);
+    } else if (addr->ss_family == AF_INET) {
+        key->addr[10] = 0xff;
+        key->addr[11] = 0xff;
+        memcpy(key->addr + 12, &((const struct sockaddr_in *)addr)->sin_addr, 4);
+    }
+}
+
+static uint64_t ip_hash(const struct ip_key *key) {
+    uint64_t lo;
+    uint64_t hi;
+    memcpy(&lo, key->addr, 8);
+    memcpy(&hi, key->addr + 8, 8);
+    uint64_t h = (lo ^ (hi * 0x9e3779b97f4a7c15ull)) * 0xff51afd7ed558ccdull;
+    return h ^ (h >> 32);
+}
+
+// Callers cache their own loop time, so last_us may be slightly ahead of now.
+static int ip_entry_expired(const struct ip_entry *e, uint64_t now_us) {
+    return now_us > e->last_us && now_us - e->last_us > IP_ENTRY_TTL_US;
+}
+
+int ip_limiter_init(struct ip_limiter *l) {
+    l->shards = aligned_alloc(64, sizeof(*l->shards) * IP_LIMITER_SHARDS);
+    if (!l->shards) {
+        return -1;
+    }
+    memset(l->shards, 0, sizeof(*l->shards) * IP_LIMITER_SHARDS);
+    for (int i = 0; i < IP_LIMITER_SHARDS; i++) {
+        pthread_mutex_init(&l->shards[i].lock, NULL);
+    }
+    return 0;
+}
+
+void ip_limiter_free(struct ip_limiter *l) {
+    if (!l->shards) {
+        return;
+    }
+    for (int i = 0; i < IP_LIMITER_SHARDS; i++) {
+        pthread_mutex_destroy(&l->shards[i].lock);
+    }
+    free(l->shards);
+    l->shards = NULL;
+}
+
+// Entries idle for IP_ENTRY_TTL_US count as expired: probing walks past them,
+// and the first expired or empty slot is reused when the key is not found.
+int ip_limiter_consume(struct ip_limiter *l, const struct ip_key *key, uint64_t now_us,
+    unsigned long rate, unsigned long burst, int *table_full) {
+    uint64_t h = ip_hash(key);
+    struct ip_shard *shard = &l->shards[h % IP_LIMITER_SHARDS];
+    unsigned int slot = (unsigned int)(h >> 32) % IP_LIMITER_SLOTS;
+    struct ip_entry *found = NULL;
+    struct ip_entry *reuse = NULL;
+    int allowed = 1;
+
+    pthread_mutex_lock(&shard->lock);
+    for (int probe = 0; probe < IP_LIMITER_MAX_PROBE; probe++) {
+        struct ip_entry *e = &shard->slots[(slot + (unsigned int)probe) % IP_LIMITER_SLOTS];
+        if (!e->used) {
+            if (!reuse) {
+                reuse = e;
+            }
+            break;
+        }
+        if (memcmp(&e->key, key, sizeof(*key)) == 0) {
+            found = e;
+            break;
+        }
+        if (!reuse && ip_entry_expired(e, now_us)) {
+            reuse = e;
+        }
+    }
+
+    if (found && ip_entry_expired(found, now_us)) {
+        found->tokens = (uint64_t)burst * TOKEN_SCALE;
+    } else if (!found && reuse) {
+        found = reuse;
+        found->key = *key;
+        found->used = 1;
+        found->tokens = (uint64_t)burst * TOKEN_SCALE;
+        found->last_us = now_us;
+    }
+
+    if (found) {
+        found->tokens = bucket_refill(found->tokens, found->last_us, now_us, rate, burst);
+        found->last_us = now_us;
+        if (found->tokens >= TOKEN_SCALE) {
+            found->tokens -= TOKEN_SCALE;
+        } else {
+            allowed = 0;
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    *table_full = found == NULL;
+    return allowed;
+}
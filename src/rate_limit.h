@@ -0,0 +1,59 @@
+#ifndef NETLOOP_RATE_LIMIT_H
+#define NETLOOP_RATE_LIMIT_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Token buckets for request rate limiting: the per-connection tier is a bare
+// bucket the caller keeps in its connection; the per-address tier is a table
+// shared by every thread.
+
+// Tokens are fixed-point with one unit per microsecond of refill at 1 token/s,
+// so refill is elapsed_us * rate with no division or floating point.
+#define TOKEN_SCALE 1000000ull
+#define IP_LIMITER_SHARDS 64
+#define IP_LIMITER_SLOTS 1024
+#define IP_LIMITER_MAX_PROBE 32
+#define IP_ENTRY_TTL_US (60 * 1000000ull)
+
+// 16-byte source address: IPv6 as is, IPv4 as a v4-mapped IPv6 address.
+struct ip_key {
+    unsigned char addr[16];
+};
+
+struct ip_entry {
+    struct ip_key key;
+    uint64_t tokens;
+    uint64_t last_us;
+    int used;
+};
+
+// Each shard is an open-addressing table behind its own lock; idle entries
+// expire and their slots are reused.
+struct ip_shard {
+    pthread_mutex_t lock;
+    struct ip_entry slots[IP_LIMITER_SLOTS];
+} __attribute__((aligned(64)));
+
+struct ip_limiter {
+    struct ip_shard *shards;
+};
+
+// Refills a bucket of at most burst tokens at rate tokens/s; a clock step
+// backwards just refills nothing.
+uint64_t bucket_refill(uint64_t tokens, uint64_t last_us, uint64_t now_us,
+    unsigned long rate, unsigned long burst);
+
+void ip_key_from_sockaddr(const struct sockaddr_storage *addr, struct ip_key *key);
+
+int ip_limiter_init(struct ip_limiter *l);
+void ip_limiter_free(struct ip_limiter *l);
+
+// Returns 1 if the address may send another request. When the probe window
+// is full of live entries the request is let through (fail open) and
+// *table_full is set.
+int ip_limiter_consume(struct ip_limiter *l, const struct ip_key *key, uint64_t now_us,
+    unsigned long rate, unsigned long burst, int *table_full);
+
+#endif
@@ -1,66 +1,656 @@
+#define _GNU_SOURCE // accept4
 #include <errno.h>
 #include <event2/buffer.h>
 #include <event2/bufferevent.h>
+#include <event2/bufferevent_ssl.h>
 #include <event2/event.h>
 #include <event2/util.h>
+#include <fcntl.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/filter.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "command.h"
+#include "file_cache.h"
+#include "kv.h"
+#include "line_scan.h"
+#include "log.h"
+#include "offload.h"
+#include "rate_limit.h"
+#include "stats.h"
+#include "timer_wheel.h"
+#include "tls.h"
+#include "uring.h"
+
 #define MAX_LINE 1024
+#define PEEK_VECS 8
 #define READ_TIMEOUT_SEC 5
 #define WRITE_TIMEOUT_SEC 5
+#define WHEEL_TICK_MS 100
 #define OUT_HIGH_WM (64 * 1024)
 #define OUT_LOW_WM (16 * 1024)
-#define RATE_TOKENS_PER_SEC 5.0
-#define BURST_TOKENS 10.0
-
-struct server_stats {
-    unsigned long active_connections;
-    unsigned long total_accepted;
-    unsigned long bytes_in;
-    unsigned long bytes_out;
-    unsigned long timeouts;
-    unsigned long rate_limited;
-    unsigned long closed_by_client;
+#define RATE_TOKENS_PER_SEC 5
+#define BURST_TOKENS 10
+#define IP_RATE_TOKENS_PER_SEC 50
+#define IP_BURST_TOKENS 100
+#define LISTEN_BACKLOG_DEFAULT 1024
+// Accepts per listener wakeup; the rest wait for the next loop iteration so
+// a connect storm cannot starve established connections.
+#define ACCEPT_BUDGET_DEFAULT 64
+// Numeric host (IPv6 with a scope id fits in 64) plus ":port".
+#define PEER_HOST_LEN 64
+#define PEER_STR_LEN (PEER_HOST_LEN + 8)
+#define CACHE_LINE 64
+#define MAX_THREADS 256
+#define BATCH_BUF_SIZE (16 * 1024)
+#define STATS_BUF_SIZE 4096
+#define CLIENT_POOL_DEFAULT 256
+#define KV_MAX_MEMORY_DEFAULT (64 * 1024 * 1024)
+#define FILE_CACHE_DEFAULT 64
+// Global budget for bytes held in connection buffers. Reads stop above the
+// budget; the biggest holders are closed above MEM_SHED_PCT of it, or once
+// paused connections have waited MEM_SHED_GRACE_MS for the total to fall
+// under MEM_RESUME_PCT, where reads resume.
+#define MEM_BUDGET_DEFAULT (256ull * 1024 * 1024)
+#define MEM_SHED_PCT 125
+#define MEM_RESUME_PCT 90
+#define MEM_SHED_GRACE_MS 1000
+#define MEM_SHED_BATCH 8
+// Per-worker drift allowed before a worker folds its delta into the global
+// total, so the shared counter is not touched on every read.
+#define MEM_PUBLISH_BYTES (64 * 1024)
+#define FILE_COPY_CHUNK (256 * 1024)
+// io_uring engine, per worker.
+#define URING_SQ_ENTRIES 4096
+#define URING_CQ_ENTRIES 16384
+#define URING_BUF_COUNT 512 // power of two
+#define URING_BUF_SIZE 16384
+#define URING_BGID 1
+#define URING_SEND_IOVS 32
+// Raw epoll engine: fixed per-connection buffers, one epoll set per worker.
+#define EPOLL_RBUF_SIZE 16384
+#define EPOLL_WBUF_SIZE 16384
+#define EPOLL_WRITE_IOVS 32
+#define EPOLL_MAX_EVENTS 256
+#define LATENCY_BUF_SIZE 8192
+// Binary framing: a connection whose first byte is BIN_MAGIC (or that sends
+// "HELLO BIN") switches to fixed 12-byte headers:
+//   [0] opcode  [1] status  [2..3] reserved  [4..7] request id  [8..11] length
+// Multi-byte fields are big-endian; replies echo the opcode and request id.
+#define BIN_MAGIC 0xB1
+#define BIN_HEADER_LEN 12
+#define BIN_MAX_PAYLOAD (16 * 1024 * 1024)
+#define BIN_INLINE_PAYLOAD 1024
+// STREAM <len>: raw payload following the line, echoed without buffering it.
+#define STREAM_MAX_LEN (1ull << 30)
+// STATS LATENCY: one line per cmd_kind plus loop_iteration, loop_lag and
+// offload.
+#define LATENCY_LINES (CMD_KINDS + 3)
+
+enum cork_mode {
+    CORK_NONE,
+    CORK_MSG_MORE,
+    CORK_TCP
+};
+
+enum overload_action {
+    OVERLOAD_BUSY,  // accept, answer "503 BUSY" and close before reading
+    OVERLOAD_REFUSE // stop accepting; new connections wait in the backlog
+};
+
+// How a new connection picks its worker among the SO_REUSEPORT listeners.
+enum steer_mode {
+    STEER_NONE,         // kernel hash of the 4-tuple
+    STEER_INCOMING_CPU, // each listener claims its worker's CPU (SO_INCOMING_CPU)
+    STEER_CBPF          // a classic BPF program maps the RX CPU to a worker
+};
+
+enum io_engine {
+    ENGINE_LIBEVENT, // bufferevents on the event loop
+    ENGINE_URING,    // multishot accept/recv and batched sends on io_uring
+    ENGINE_EPOLL     // edge-triggered epoll with direct read/writev
+};
+
+// io_uring requests carry the client pointer with the operation in its low
+// bits; clients are cache-line aligned, so those bits are free.
+enum uring_op {
+    URING_OP_ACCEPT = 1,
+    URING_OP_RECV,
+    URING_OP_SEND,
+    URING_OP_CANCEL
+};
+#define URING_OP_MASK 7ull
+
+// Registry slots; each gets a hit counter in the stats shard.
+enum command_id {
+    CMD_ID_PING,
+    CMD_ID_ECHO,
+    CMD_ID_STATS,
+    CMD_ID_HELLO,
+    CMD_ID_QUIT,
+    CMD_ID_GET,
+    CMD_ID_SET,
+    CMD_ID_DEL,
+    CMD_ID_INCR,
+    CMD_ID_EXPIRE,
+    CMD_ID_STREAM,
+    CMD_ID_FILE,
+    CMD_ID_UNKNOWN,
+    CMD_ID_COUNT
+};
+
+static const char *g_command_stat_names[CMD_ID_COUNT] = {
+    "ping", "echo", "stats", "hello", "quit", "get", "set", "del", "incr", "expire",
+    "stream", "file", "unknown"
+};
+
+_Static_assert(CMD_ID_COUNT <= STATS_MAX_COMMANDS, "raise STATS_MAX_COMMANDS");
+
+enum cmd_kind {
+    CMD_PING,
+    CMD_ECHO,
+    CMD_STATS,
+    CMD_RATE_LIMITED,
+    CMD_KV,
+    CMD_OTHER,
+    CMD_KINDS
+};
+
+static const char *g_cmd_names[CMD_KINDS] = { "ping", "echo", "stats", "rate_limited", "kv", "other" };
+
+
+enum bin_opcode {
+    BIN_OP_PING = 1,
+    BIN_OP_ECHO = 2,
+    BIN_OP_STATS = 3,
+    BIN_OP_QUIT = 4,
+    BIN_OP_STATS_LATENCY = 5
+};
+
+enum bin_status {
+    BIN_STATUS_OK = 0,
+    BIN_STATUS_RATE_LIMITED = 1,
+    BIN_STATUS_UNKNOWN = 2,
+    BIN_STATUS_TOO_LONG = 3
+};
+
+enum proto_mode {
+    PROTO_UNKNOWN,
+    PROTO_TEXT,
+    PROTO_BINARY
+};
+
+// Tokens per second and bucket size for one limiter tier; a rate of 0
+// disables the tier. Set from the command line before the workers start;
+// there is deliberately no wire command to change them.
+struct rate_config {
+    unsigned long rate;
+    unsigned long burst;
+};
+
+struct client;
+
+// Per-worker client allocator: a preallocated slab plus a LIFO free list, so
+// the most recently closed (still cache-warm) client is handed out first.
+struct client_pool {
+    struct client *slab;
+    struct client *free_list;
+    size_t capacity;
+    size_t free_count;
+    size_t in_use;
+};
+
+// Responses produced while handling one read batch, flushed with one send.
+struct out_batch {
+    struct client *owner;
+    size_t len;
+    char buf[BATCH_BUF_SIZE];
 };
 
-static struct server_stats g_stats;
-static int g_verbose = 0;
+// A worker owns an event_base, its own SO_REUSEPORT listener and every client
+// accepted on it, so the hot path never touches another thread's state.
+struct worker {
+    struct server_stats stats;
+    int id;
+    int cpu; // pinned CPU, or -1 where the scheduler places the thread
+    int listener_fd; // -1 when there is no TCP listener
+    struct event_base *base;
+    struct event *listen_event;
+    struct event *unix_event; // on the shared --unix listener
+    pthread_t thread;
+    struct client_pool pool;
+    struct timer_wheel wheel;
+    struct event *wheel_tick;
+    struct latency_hist latency[CMD_KINDS];
+    struct out_batch batch;
+    struct uring ring;
+    struct uring_buf_ring bufs;
+    struct event *ring_event;
+    int epfd;
+    uint64_t now_us; // loop-cached monotonic time, for timeouts and rates
+    uint64_t wall_ms; // loop-cached wall time, for KV TTLs only
+    struct file_cache files;
+    struct client *clients; // every live connection, for budget enforcement
+    int64_t mem_unpublished;
+    uint64_t mem_stuck_since_ms; // 0 unless budget-paused clients are waiting
+    // Loop health. An iteration's busy time runs from its first callback to
+    // the end of the iteration; the heartbeat is the timeout wheel's tick.
+    struct latency_hist loop_iteration;
+    struct latency_hist loop_lag;
+    unsigned long iteration_callbacks;
+    uint64_t iteration_start;
+    uint64_t worst_iteration_ns; // since the last heartbeat
+    uint64_t heartbeat_ns;
+    int overloaded;
+    int accept_paused;
+    int accept_armed; // io_uring: a multishot accept is outstanding
+    uint64_t tls_rate_ms;
+    unsigned long tls_rate_mark;
+    // Heavy commands finished by the offload pool come back through here.
+    struct offload_done offload_done;
+    struct event *offload_event;
+    struct latency_hist offload_latency;
+} __attribute__((aligned(CACHE_LINE)));
+
+static struct worker *g_workers = NULL;
+static int g_num_workers = 1;
+// With -v, log one in every g_log_sample command lines.
+static unsigned g_log_sample = 1;
+static int g_coalesce = 0;
+static struct rate_config g_conn_rate = { RATE_TOKENS_PER_SEC, BURST_TOKENS };
+static struct rate_config g_ip_rate = { IP_RATE_TOKENS_PER_SEC, IP_BURST_TOKENS };
+// The per-IP tier is shared by every worker, since SO_REUSEPORT spreads one
+// host's connections across them.
+static struct ip_limiter g_ip_limiter;
+static size_t g_pool_capacity = CLIENT_POOL_DEFAULT;
+// Fixed-point (32.32) ns per tick; 0 means the TSC is unusable and
+// clock_now() reads CLOCK_MONOTONIC (vDSO, no syscall) in ns instead.
+static uint64_t g_tsc_ns_mult = 0;
+static enum cork_mode g_cork = CORK_NONE;
+static int g_backlog = LISTEN_BACKLOG_DEFAULT;
+static int g_defer_accept_sec = 0;
+static int g_accept_budget = ACCEPT_BUDGET_DEFAULT;
+static enum io_engine g_engine = ENGINE_LIBEVENT;
+static struct kv_store *g_kv = NULL;
+static size_t g_kv_max_memory = KV_MAX_MEMORY_DEFAULT;
+// FILE serves from beneath this directory; -1 leaves the command disabled.
+static int g_file_root_fd = -1;
+static size_t g_file_cache_capacity = FILE_CACHE_DEFAULT;
+// Copy file ranges into the output buffer instead of referencing them
+// (for comparing against the zero-copy path).
+static int g_file_copy = 0;
+static uint64_t g_mem_budget = MEM_BUDGET_DEFAULT;
+// Sum of what workers have published; within MEM_PUBLISH_BYTES per worker
+// of the exact total.
+static int64_t g_mem_buffered = 0;
+// Heartbeat lag (or a single iteration) past this puts a worker into
+// overload; 0 disables.
+static unsigned g_overload_lag_ms = 0;
+static enum overload_action g_overload_action = OVERLOAD_BUSY;
+// --cpus: worker i is pinned to g_cpus[i % g_num_cpus]; empty leaves
+// placement to the scheduler.
+static int g_cpus[MAX_THREADS];
+static int g_num_cpus = 0;
+static enum steer_mode g_steer = STEER_NONE;
+// Set by --tls-cert/--tls-key: every connection on the port speaks TLS.
+static SSL_CTX *g_tls_ctx = NULL;
+// --unix: one UNIX domain listener for same-host clients, shared by every
+// worker since there is no SO_REUSEPORT for socket paths.
+static const char *g_unix_path = NULL;
+static int g_unix_fd = -1;
+// --offload-threads: heavy commands run on this pool; 0 runs them inline.
+static int g_offload_threads = 0;
+static struct offload_pool g_offload;
 
 struct client {
     struct bufferevent *bev;
-    double tokens;
-    struct timeval last_refill;
-    char peer[NI_MAXHOST + NI_MAXSERV + 2];
+    // Engine-neutral I/O: protocol code only sees these. With bufferevents
+    // they are its buffers; the io_uring engine owns them outright.
+    struct evbuffer *in;
+    struct evbuffer *out;
+    int fd;
+    struct worker *worker;
+    uint64_t tokens;
+    uint64_t last_refill_us;
+    struct ip_key ip;
+    // Raw address from accept; formatted into peer only when something logs.
+    struct sockaddr_storage peer_addr;
+    socklen_t peer_len;
+    char peer[PEER_STR_LEN];
     struct timeval connected_at;
+    enum proto_mode proto;
+    // Activity stamps are all the hot path touches; the wheel entry is only
+    // moved when its slot fires and the deadline turns out to have moved.
+    struct wheel_timer timer;
+    uint64_t last_read_ms;
+    uint64_t last_write_ms;
+    // Bytes of a STREAM payload still to come; while non-zero, input goes
+    // to the output (or is dropped, for a rejected STREAM) instead of the parser.
+    uint64_t stream_left;
+    unsigned char stream_discard;
+    // io_uring engine: bytes of the send in flight live in sending, which is
+    // left alone until the kernel is done with the iovecs pointing into it.
+    struct evbuffer *sending;
+    struct msghdr send_msg;
+    struct iovec send_iov[URING_SEND_IOVS];
+    // epoll engine: text lines are parsed in place from rbuf, and replies
+    // collect in wbuf until one overflows into out (then everything after it
+    // follows, so wbuf always holds the oldest bytes).
+    char *rbuf;
+    size_t rlen;
+    char *wbuf;
+    size_t wlen;
+    size_t woff;
+    unsigned char reading;
+    unsigned char recv_armed;
+    unsigned char send_inflight;
+    unsigned char closing;
+    // Global budget: bytes last charged for this connection, and whether the
+    // budget (rather than its own backpressure) stopped its reads.
+    unsigned char mem_paused;
+    size_t mem_accounted;
+    unsigned char tls_done; // handshake finished (TLS listener only)
+    // Queued FILE bytes; they sit in the page cache, not in our buffers.
+    uint64_t file_left;
+    // Heavy command on the offload pool; reading and parsing wait for it.
+    struct heavy_job *offload;
+    struct client *prev;
+    struct client *next;
+    struct client *next_free;
+} __attribute__((aligned(CACHE_LINE)));
+
+// Heavy commands write their reply into an evbuffer of their own rather than
+// the client's, so the same code runs inline or on an offload thread.
+typedef void (*heavy_fn)(struct evbuffer *out, const char *arg, size_t arg_len);
+
+// The pool thread only touches fn, the argument and out. client is read and
+// cleared on the owning loop alone, so a connection that closes first just
+// orphans its job.
+struct heavy_job {
+    struct offload_job job;
+    struct client *client;
+    heavy_fn fn;
+    struct evbuffer *out;
+    uint64_t queued;
+    unsigned char bin_req[BIN_HEADER_LEN]; // request header, for binary frames
+    unsigned char binary;
+    unsigned char has_arg;
+    size_t arg_len;
+    char arg[];
 };
 
-static double elapsed_ms(const struct timeval *start, const struct timeval *end) {
-    double sec = (double)(end->tv_sec - start->tv_sec);
-    double usec = (double)(end->tv_usec - start->tv_usec) / 1000000.0;
-    return (sec + usec) * 1000.0;
+// Each counter has a single writer (the owning worker), so a relaxed load+store
+// is enough: it compiles to a plain add but keeps cross-thread reads defined.
+static void stat_add(unsigned long *counter, unsigned long n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
 }
 
-static void log_disconnect(struct client *c, const char *reason) {
-    if (!g_verbose || !c) {
+static void stat_sub(unsigned long *counter, unsigned long n) {
+    unsigned long cur = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    __atomic_store_n(counter, cur > n ? cur - n : 0, __ATOMIC_RELAXED);
+}
+
+static void stats_snapshot(struct server_stats *out) {
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < g_num_workers; i++) {
+        stats_accumulate(out, &g_workers[i].stats);
+    }
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Raw timestamp for latency recording: TSC ticks when calibrated, else ns.
+static uint64_t clock_now(void) {
+#ifdef HAVE_X86_SIMD
+    if (g_tsc_ns_mult) {
+        return __rdtsc();
+    }
+#endif
+    return monotonic_ns();
+}
+
+static uint64_t clock_delta_ns(uint64_t start, uint64_t end) {
+    uint64_t delta = end > start ? end - start : 0;
+    if (!g_tsc_ns_mult) {
+        return delta;
+    }
+    return (uint64_t)(((unsigned __int128)delta * g_tsc_ns_mult) >> 32);
+}
+
+// Uses the TSC only when the CPU advertises it as invariant (constant rate
+// across P-states and cores), calibrating it against CLOCK_MONOTONIC.
+static void calibrate_clock(void) {
+#ifdef HAVE_X86_SIMD
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 8))) {
         return;
     }
-    struct timeval now;
-    evutil_gettimeofday(&now, NULL);
-    printf("client %s disconnect: %s age_ms=%.3f\n",
-        c->peer, reason, elapsed_ms(&c->connected_at, &now));
+    struct timespec pause = { 0, 20 * 1000 * 1000 };
+    uint64_t ns0 = monotonic_ns();
+    uint64_t tsc0 = __rdtsc();
+    nanosleep(&pause, NULL);
+    uint64_t ns1 = monotonic_ns();
+    uint64_t tsc1 = __rdtsc();
+    if (tsc1 <= tsc0 || ns1 <= ns0) {
+        return;
+    }
+    g_tsc_ns_mult = (uint64_t)(((unsigned __int128)(ns1 - ns0) << 32) / (tsc1 - tsc0));
+#endif
+}
+
+static void latency_record(struct worker *w, enum cmd_kind kind, uint64_t start) {
+    hist_record(&w->latency[kind], clock_delta_ns(start, clock_now()));
+}
+
+static uint64_t wall_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+}
+
+// Both cached clocks are read once per loop iteration.
+static void clock_refresh(struct worker *w) {
+    w->now_us = monotonic_ns() / 1000;
+    w->wall_ms = wall_now_us() / 1000;
+}
+
+// Called at the top of every callback the loop dispatches (each completion,
+// for io_uring); the first one of an iteration starts its busy clock and,
+// except under epoll, which refreshes after each wait, the cached clocks.
+static void loop_callback(struct worker *w) {
+    if (w->iteration_callbacks++ == 0) {
+        w->iteration_start = clock_now();
+        if (g_engine != ENGINE_EPOLL) {
+            clock_refresh(w);
+        }
+    }
+}
+
+static void loop_iteration_end(struct worker *w) {
+    unsigned long n = w->iteration_callbacks;
+    if (n == 0) {
+        return;
+    }
+    uint64_t ns = clock_delta_ns(w->iteration_start, clock_now());
+    hist_record(&w->loop_iteration, ns);
+    if (ns > w->worst_iteration_ns) {
+        w->worst_iteration_ns = ns;
+    }
+    stat_add(&w->stats.loop_iterations, 1);
+    stat_add(&w->stats.loop_callbacks, n);
+    if (n > w->stats.loop_callbacks_max) {
+        __atomic_store_n(&w->stats.loop_callbacks_max, n, __ATOMIC_RELAXED);
+    }
+    w->iteration_callbacks = 0;
+}
+
+// Merges one histogram, found at offset within struct worker, over all workers.
+static void hist_snapshot(size_t offset, struct latency_hist *out) {
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < g_num_workers; i++) {
+        hist_merge(out, (const struct latency_hist *)((const char *)&g_workers[i] + offset));
+    }
+}
+
+static void latency_snapshot(enum cmd_kind kind, struct latency_hist *out) {
+    hist_snapshot(offsetof(struct worker, latency) + (size_t)kind * sizeof(struct latency_hist), out);
+}
+
+// One line per command kind, then the event loops' iteration time and
+// heartbeat lag, then offloaded commands from submit to reply: percentiles,
+// then the non-empty buckets as <upper_ns>:<count> pairs.
+static size_t format_latency(char *buf, size_t cap) {
+    size_t used = 0;
+    for (int k = 0; k < LATENCY_LINES; k++) {
+        struct latency_hist h;
+        const char *name;
+        if (k < CMD_KINDS) {
+            latency_snapshot((enum cmd_kind)k, &h);
+            name = g_cmd_names[k];
+        } else if (k == CMD_KINDS) {
+            hist_snapshot(offsetof(struct worker, loop_iteration), &h);
+            name = "loop_iteration";
+        } else if (k == CMD_KINDS + 1) {
+            hist_snapshot(offsetof(struct worker, loop_lag), &h);
+            name = "loop_lag";
+        } else {
+            hist_snapshot(offsetof(struct worker, offload_latency), &h);
+            name = "offload";
+        }
+        size_t wrote = latency_format(name, &h, buf + used, cap - used,
+            (size_t)LATENCY_LINES * 160);
+        if (wrote == 0) {
+            return 0;
+        }
+        used += wrote;
+    }
+    return used;
+}
+
+// Loop-cached monotonic time: no syscall inside callbacks, and a wall clock
+// step cannot fire or starve the timeout wheel.
+static uint64_t cached_now_us(struct worker *w) {
+    return w->now_us;
+}
+
+static uint64_t cached_now_ms(struct worker *w) {
+    return w->now_us / 1000;
+}
+
+// Loop-cached wall time, for KV expiry: a TTL is a point in real time.
+static uint64_t cached_wall_ms(struct worker *w) {
+    return w->wall_ms;
+}
+
+static int client_pool_init(struct client_pool *pool, size_t capacity) {
+    memset(pool, 0, sizeof(*pool));
+    pool->capacity = capacity;
+    if (capacity == 0) {
+        return 0;
+    }
+    pool->slab = aligned_alloc(CACHE_LINE, sizeof(struct client) * capacity);
+    if (!pool->slab) {
+        return -1;
+    }
+    // Thread the list back to front so the first allocation gets slab[0].
+    for (size_t i = capacity; i > 0; i--) {
+        pool->slab[i - 1].next_free = pool->free_list;
+        pool->free_list = &pool->slab[i - 1];
+    }
+    pool->free_count = capacity;
+    return 0;
+}
+
+static void client_pool_free(struct client_pool *pool) {
+    struct client *c = pool->free_list;
+    while (c) {
+        struct client *next = c->next_free;
+        if (c < pool->slab || c >= pool->slab + pool->capacity) {
+            free(c);
+        }
+        c = next;
+    }
+    free(pool->slab);
+    memset(pool, 0, sizeof(*pool));
+}
+
+static struct client *client_alloc(struct worker *w) {
+    struct client_pool *pool = &w->pool;
+    struct client *c = pool->free_list;
+
+    if (c) {
+        pool->free_list = c->next_free;
+        pool->free_count--;
+        stat_add(&w->stats.pool_hits, 1);
+    } else {
+        c = aligned_alloc(CACHE_LINE, sizeof(*c));
+        if (!c) {
+            return NULL;
+        }
+        stat_add(&w->stats.pool_misses, 1);
+    }
+    memset(c, 0, sizeof(*c));
+
+    pool->in_use++;
+    if (pool->in_use > w->stats.pool_high_water) {
+        __atomic_store_n(&w->stats.pool_high_water, pool->in_use, __ATOMIC_RELAXED);
+    }
+    return c;
+}
+
+static void client_release(struct worker *w, struct client *c) {
+    struct client_pool *pool = &w->pool;
+    int from_slab = c >= pool->slab && c < pool->slab + pool->capacity;
+
+    pool->in_use--;
+    // Slab objects always go back; overflow objects are kept only while the
+    // free list is below capacity, so a burst does not pin memory forever.
+    if (from_slab || pool->free_count < pool->capacity) {
+        c->next_free = pool->free_list;
+        pool->free_list = c;
+        pool->free_count++;
+        return;
+    }
+    free(c);
+}
+
+static double elapsed_ms(const struct timeval *start, const struct timeval *end) {
+    double sec = (double)(end->tv_sec - start->tv_sec);
+    double usec = (double)(end->tv_usec - start->tv_usec) / 1000000.0;
+    return (sec + usec) * 1000.0;
 }
 
 static void format_peer(const struct sockaddr_storage *addr, socklen_t addr_len,
     char *out, size_t out_len) {
-    char host[NI_MAXHOST];
-    char serv[NI_MAXSERV];
+    char host[PEER_HOST_LEN];
+    char serv[8];
     int rc = getnameinfo((const struct sockaddr *)addr, addr_len,
         host, sizeof(host), serv, sizeof(serv), NI_NUMERICHOST | NI_NUMERICSERV);
     if (rc == 0) {
@@ -70,7 +660,37 @@ static void format_peer(const struct sockaddr_storage *addr, socklen_t addr_len,
     snprintf(out, out_len, "unknown");
 }
 
-static int create_listener_socket(const char *port) {
+static const char *client_peer(struct client *c) {
+    if (c->peer[0] != '\0') {
+        return c->peer;
+    }
+    if (c->peer_addr.ss_family == AF_UNIX) {
+        // Same-host clients connect from unnamed sockets; their pid is
+        // what tells them apart.
+        struct ucred cred;
+        socklen_t len = sizeof(cred);
+        if (getsockopt(c->fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0) {
+            snprintf(c->peer, sizeof(c->peer), "unix:pid%d", (int)cred.pid);
+        } else {
+            snprintf(c->peer, sizeof(c->peer), "unix");
+        }
+        return c->peer;
+    }
+    format_peer(&c->peer_addr, c->peer_len, c->peer, sizeof(c->peer));
+    return c->peer;
+}
+
+static void log_disconnect(struct client *c, const char *reason) {
+    if (!LOG_ENABLED(LOG_DEBUG) || !c) {
+        return;
+    }
+    struct timeval now;
+    evutil_gettimeofday(&now, NULL);
+    log_write(LOG_DEBUG, "client %s disconnect: %s age_ms=%.3f",
+        client_peer(c), reason, elapsed_ms(&c->connected_at, &now));
+}
+
+static int create_listener_socket(const char *port, int reuseport) {
     struct addrinfo hints;
     struct addrinfo *res = NULL;
     struct addrinfo *p = NULL;
@@ -91,7 +711,7 @@ static int create_listener_socket(const char *port) {
     }
 
     for (p = res; p != NULL; p = p->ai_next) {
-        fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        fd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, p->ai_protocol);
         if (fd < 0) {
             continue;
         }
@@ -102,6 +722,15 @@ static int create_listener_socket(const char *port) {
             continue;
         }
 
+        // SO_REUSEPORT lets every worker bind its own listener on the same
+        // port; the kernel then spreads incoming connections across them.
+        if (reuseport &&
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0) {
+            close(fd);
+            fd = -1;
+            continue;
+        }
+
         if (bind(fd, p->ai_addr, p->ai_addrlen) == 0) {
             break;
         }
@@ -117,7 +746,15 @@ static int create_listener_socket(const char *port) {
         return -1;
     }
 
-    if (listen(fd, 16) < 0) {
+    // Only wake the listener once the client has sent its first bytes; the
+    // kernel still completes the handshake after the timeout without data.
+    if (g_defer_accept_sec > 0 &&
+        setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &g_defer_accept_sec,
+            sizeof(g_defer_accept_sec)) < 0) {
+        perror("setsockopt TCP_DEFER_ACCEPT");
+    }
+
+    if (listen(fd, g_backlog) < 0) {
         perror("listen");
         close(fd);
         return -1;
@@ -126,327 +763,3119 @@ static int create_listener_socket(const char *port) {
     return fd;
 }
 
-static void close_client(struct client *c) {
-    if (!c) {
-        return;
+// A socket file left behind by a server that died is replaced; one that
+// still accepts connections belongs to a live server and is left alone.
+static int create_unix_listener(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "server: --unix path is longer than %zu bytes\n", sizeof(addr.sun_path) - 1);
+        return -1;
     }
-    if (c->bev) {
-        bufferevent_free(c->bev);
+    memcpy(addr.sun_path, path, strlen(path));
+
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "server: %s exists and is not a socket\n", path);
+            return -1;
+        }
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int live = probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        if (probe >= 0) {
+            close(probe);
+        }
+        if (live) {
+            fprintf(stderr, "server: %s is in use\n", path);
+            return -1;
+        }
+        unlink(path);
     }
-    if (g_stats.active_connections > 0) {
-        g_stats.active_connections--;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
     }
-    free(c);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "server: bind %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, g_backlog) < 0) {
+        perror("listen");
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
 }
 
-static int queue_response(struct client *c, const char *buf, size_t len) {
-    int rc = bufferevent_write(c->bev, buf, len);
-    if (rc == 0) {
-        g_stats.bytes_out += len;
+static uint64_t uring_tag(struct client *c, enum uring_op op) {
+    return (uint64_t)(uintptr_t)c | (uint64_t)op;
+}
+
+// One io_uring_enter per call carries every request prepared since the last.
+static void worker_submit(struct worker *w) {
+    if (uring_sq_pending(&w->ring) > 0) {
+        stat_add(&w->stats.write_syscalls, 1);
+    }
+    int rc = uring_submit(&w->ring);
+    if (rc < 0 && rc != -EAGAIN && rc != -EBUSY) {
+        LOG_RATELIMIT(LOG_WARN, 1, "server: io_uring_enter: %s", strerror(-rc));
     }
-    return rc;
 }
 
-static int handle_command(struct client *c, const char *line) {
-    if (strcmp(line, "PING") == 0) {
-        const char *resp = "PONG\n";
-        queue_response(c, resp, strlen(resp));
-        return 0;
+static struct io_uring_sqe *worker_sqe(struct worker *w) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&w->ring);
+    if (!sqe) {
+        worker_submit(w);
+        sqe = uring_get_sqe(&w->ring);
     }
+    return sqe;
+}
 
-    if (strncmp(line, "ECHO ", 5) == 0) {
-        char resp[MAX_LINE + 8];
-        int wrote = snprintf(resp, sizeof(resp), "%s\n", line + 5);
-        if (wrote < 0 || (size_t)wrote >= sizeof(resp)) {
-            const char *err = "ERR too_long\n";
-            queue_response(c, err, strlen(err));
-            return 0;
-        }
-        queue_response(c, resp, (size_t)wrote);
-        return 0;
+// If no SQE can be had the client simply stops reading until the next
+// completion for it retries, or the timeout wheel reaps it.
+static void uring_arm_recv(struct client *c) {
+    if (c->recv_armed || c->closing) {
+        return;
+    }
+    struct io_uring_sqe *sqe = worker_sqe(c->worker);
+    if (!sqe) {
+        return;
     }
+    uring_prep_recv_multishot(sqe, c->fd, URING_BGID, uring_tag(c, URING_OP_RECV));
+    c->recv_armed = 1;
+}
 
-    if (strcmp(line, "STATS") == 0) {
-        char resp[256];
-        int wrote = snprintf(resp, sizeof(resp),
-            "active_connections=%lu\n"
-            "total_accepted=%lu\n"
-            "bytes_in=%lu\n"
-            "bytes_out=%lu\n"
-            "timeouts=%lu\n"
-            "rate_limited=%lu\n"
-            "closed_by_client=%lu\n",
-            g_stats.active_connections,
-            g_stats.total_accepted,
-            g_stats.bytes_in,
-            g_stats.bytes_out,
-            g_stats.timeouts,
-            g_stats.rate_limited,
-            g_stats.closed_by_client);
-        if (wrote > 0) {
-            queue_response(c, resp, (size_t)wrote);
+// One send in flight per client: replies queued meanwhile collect in out and
+// leave together in the next sendmsg.
+static void uring_flush(struct client *c) {
+    if (c->send_inflight || c->closing) {
+        return;
+    }
+    if (evbuffer_get_length(c->sending) == 0) {
+        if (evbuffer_get_length(c->out) == 0) {
+            return;
         }
-        return 0;
+        evbuffer_add_buffer(c->sending, c->out);
+        c->last_write_ms = cached_now_ms(c->worker);
     }
-
-    if (strcmp(line, "QUIT") == 0) {
-        g_stats.closed_by_client++;
-        return 1;
+    struct io_uring_sqe *sqe = worker_sqe(c->worker);
+    if (!sqe) {
+        return;
     }
-
-    {
-        const char *resp = "ERR unknown\n";
-        queue_response(c, resp, strlen(resp));
+    int n = evbuffer_peek(c->sending, -1, NULL, c->send_iov, URING_SEND_IOVS);
+    if (n > URING_SEND_IOVS) {
+        n = URING_SEND_IOVS;
     }
-
-    return 0;
+    memset(&c->send_msg, 0, sizeof(c->send_msg));
+    c->send_msg.msg_iov = c->send_iov;
+    c->send_msg.msg_iovlen = (size_t)n;
+    uring_prep_sendmsg(sqe, c->fd, &c->send_msg, MSG_NOSIGNAL, uring_tag(c, URING_OP_SEND));
+    c->send_inflight = 1;
 }
 
-static double min_double(double a, double b) {
-    return a < b ? a : b;
+static void uring_client_release(struct client *c) {
+    close(c->fd);
+    evbuffer_free(c->in);
+    evbuffer_free(c->out);
+    evbuffer_free(c->sending);
+    client_release(c->worker, c);
 }
 
-static void bucket_init(struct client *c) {
-    c->tokens = BURST_TOKENS;
-    evutil_gettimeofday(&c->last_refill, NULL);
+// The client can only be freed once the kernel holds no request for it.
+static void uring_maybe_release(struct client *c) {
+    if (!c->recv_armed && !c->send_inflight) {
+        uring_client_release(c);
+    }
 }
 
-static int bucket_consume(struct client *c) {
-    struct timeval now;
-    evutil_gettimeofday(&now, NULL);
+static void client_pause_reads(struct client *c) {
+    if (g_engine == ENGINE_URING) {
+        if (c->reading && c->recv_armed) {
+            struct io_uring_sqe *sqe = worker_sqe(c->worker);
+            if (sqe) {
+                uring_prep_cancel(sqe, uring_tag(c, URING_OP_RECV), uring_tag(c, URING_OP_CANCEL));
+            }
+        }
+        c->reading = 0;
+        return;
+    }
+    if (g_engine == ENGINE_EPOLL) {
+        c->reading = 0;
+        return;
+    }
+    bufferevent_disable(c->bev, EV_READ);
+}
 
-    double elapsed = (double)(now.tv_sec - c->last_refill.tv_sec) +
-        (double)(now.tv_usec - c->last_refill.tv_usec) / 1000000.0;
-    if (elapsed > 0) {
-        c->tokens = min_double(BURST_TOKENS, c->tokens + elapsed * RATE_TOKENS_PER_SEC);
-        c->last_refill = now;
+// With epoll no new edge will arrive for bytes already queued, so whoever
+// resumes a client also reads it (see epoll_client_event).
+static void client_resume_reads(struct client *c) {
+    if (c->offload) {
+        return; // offload_complete resumes it
+    }
+    if (g_engine == ENGINE_URING) {
+        c->reading = 1;
+        uring_arm_recv(c);
+        return;
+    }
+    if (g_engine == ENGINE_EPOLL) {
+        c->reading = 1;
+        return;
     }
+    bufferevent_enable(c->bev, EV_READ);
+}
 
-    if (c->tokens >= 1.0) {
-        c->tokens -= 1.0;
-        return 1;
+static int client_reading(struct client *c) {
+    if (g_engine != ENGINE_LIBEVENT) {
+        return c->reading;
     }
+    return (bufferevent_get_enabled(c->bev) & EV_READ) != 0;
+}
 
-    return 0;
+static size_t client_output_len(struct client *c) {
+    size_t len = evbuffer_get_length(c->out);
+    if (c->sending) {
+        len += evbuffer_get_length(c->sending);
+    }
+    return len + (c->wlen - c->woff);
 }
 
-static void maybe_pause_reads(struct client *c) {
-    struct evbuffer *output = bufferevent_get_output(c->bev);
-    size_t out_len = evbuffer_get_length(output);
-    if (out_len > OUT_HIGH_WM) {
-        bufferevent_disable(c->bev, EV_READ);
+// Bytes the connection holds in our buffers: unparsed input and pending
+// output, less queued FILE ranges. Those drain first in practice (replies
+// behind a file body are small), so file_left is clamped to what is left.
+static size_t client_buffered(struct client *c) {
+    size_t out = client_output_len(c);
+    if (c->file_left > out) {
+        c->file_left = out;
     }
+    size_t len = out - (size_t)c->file_left + c->rlen;
+    if (c->in) {
+        len += evbuffer_get_length(c->in);
+    }
+    return len;
 }
 
-static void client_read_cb(struct bufferevent *bev, void *arg) {
-    (void)bev;
-    struct client *c = arg;
-    struct evbuffer *input = bufferevent_get_input(c->bev);
+static void mem_publish(struct worker *w) {
+    if (w->mem_unpublished != 0) {
+        __atomic_add_fetch(&g_mem_buffered, w->mem_unpublished, __ATOMIC_RELAXED);
+        w->mem_unpublished = 0;
+    }
+}
 
-    for (;;) {
-        size_t line_len = 0;
-        char *line = evbuffer_readln(input, &line_len, EVBUFFER_EOL_LF);
-        if (!line) {
-            break;
-        }
-        struct timeval t0;
-        if (g_verbose) {
-            evutil_gettimeofday(&t0, NULL);
-        }
+static void mem_account(struct worker *w, int64_t delta) {
+    if (delta > 0) {
+        stat_add(&w->stats.mem_buffered, (unsigned long)delta);
+    } else {
+        stat_sub(&w->stats.mem_buffered, (unsigned long)-delta);
+    }
+    w->mem_unpublished += delta;
+    if (w->mem_unpublished >= MEM_PUBLISH_BYTES || w->mem_unpublished <= -MEM_PUBLISH_BYTES) {
+        mem_publish(w);
+    }
+}
 
-        if (line_len >= MAX_LINE) {
-            const char *err = "ERR too_long\n";
-            queue_response(c, err, strlen(err));
-            log_disconnect(c, "line_too_long");
-            free(line);
-            close_client(c);
-            return;
-        }
+// Charges the worker for whatever the connection's buffers did since the
+// last sync. Called wherever reads or writes settle, so the charge is never
+// more than one read batch stale.
+static void mem_sync(struct client *c) {
+    size_t now = client_buffered(c);
+    if (now != c->mem_accounted) {
+        mem_account(c->worker, (int64_t)now - (int64_t)c->mem_accounted);
+        c->mem_accounted = now;
+    }
+}
 
-        g_stats.bytes_in += line_len + 1;
+static int mem_over(unsigned pct) {
+    if (g_mem_budget == 0) {
+        return 0;
+    }
+    int64_t used = __atomic_load_n(&g_mem_buffered, __ATOMIC_RELAXED);
+    return used > 0 && (uint64_t)used > g_mem_budget / 100 * pct;
+}
 
-        if (!bucket_consume(c)) {
-            const char *resp = "429 SLOWDOWN\n";
-            queue_response(c, resp, strlen(resp));
-            g_stats.rate_limited++;
-            if (g_verbose) {
-                struct timeval t1;
-                evutil_gettimeofday(&t1, NULL);
-                printf("client %s cmd: %s latency_ms=%.3f rate_limited=1\n",
-                    c->peer, line, elapsed_ms(&t0, &t1));
-            }
-            free(line);
-            maybe_pause_reads(c);
-            continue;
-        }
+static void mem_mark_paused(struct client *c) {
+    c->mem_paused = 1;
+    stat_add(&c->worker->stats.mem_paused, 1);
+    stat_add(&c->worker->stats.mem_read_pauses, 1);
+}
 
-        int rc = handle_command(c, line);
-        if (g_verbose) {
-            struct timeval t1;
-            evutil_gettimeofday(&t1, NULL);
-            printf("client %s cmd: %s latency_ms=%.3f\n",
-                c->peer, line, elapsed_ms(&t0, &t1));
+// Copies a reply into the fixed write buffer, or appends it to out once the
+// buffer cannot take it (big replies, or something already overflowed).
+static int epoll_queue(struct client *c, const char *buf, size_t len) {
+    if (client_output_len(c) == 0) {
+        // The write timeout runs from when output starts waiting.
+        c->last_write_ms = cached_now_ms(c->worker);
+    }
+    if (evbuffer_get_length(c->out) == 0) {
+        if (c->wlen + len > EPOLL_WBUF_SIZE && c->woff > 0) {
+            memmove(c->wbuf, c->wbuf + c->woff, c->wlen - c->woff);
+            c->wlen -= c->woff;
+            c->woff = 0;
         }
-        free(line);
-        if (rc != 0) {
-            log_disconnect(c, "client_quit");
-            close_client(c);
-            return;
+        if (c->wlen + len <= EPOLL_WBUF_SIZE) {
+            memcpy(c->wbuf + c->wlen, buf, len);
+            c->wlen += len;
+            return 0;
         }
-        maybe_pause_reads(c);
     }
+    return evbuffer_add(c->out, buf, len);
 }
 
-static void client_write_cb(struct bufferevent *bev, void *arg) {
-    (void)bev;
-    struct client *c = arg;
-    struct evbuffer *output = bufferevent_get_output(c->bev);
-    size_t out_len = evbuffer_get_length(output);
-    if (out_len <= OUT_LOW_WM) {
-        bufferevent_enable(c->bev, EV_READ);
+static void epoll_client_release(struct client *c) {
+    // Closing the fd also takes it out of the epoll set.
+    close(c->fd);
+    free(c->rbuf); // wbuf shares the allocation
+    if (c->in) {
+        evbuffer_free(c->in);
     }
+    evbuffer_free(c->out);
+    client_release(c->worker, c);
 }
 
-static void client_event_cb(struct bufferevent *bev, short events, void *arg) {
-    (void)bev;
+static void close_client(struct client *c) {
+    if (!c) {
+        return;
+    }
+    if (c->worker->batch.owner == c) {
+        // Staged replies die with the connection, like unsent bufferevent output.
+        c->worker->batch.owner = NULL;
+        c->worker->batch.len = 0;
+    }
+    if (c->offload) {
+        // The job still runs to completion; its reply is dropped then.
+        c->offload->client = NULL;
+        c->offload = NULL;
+    }
+    timer_wheel_remove(&c->worker->wheel, &c->timer);
+    stat_sub(&c->worker->stats.active_connections, 1);
+    mem_account(c->worker, -(int64_t)c->mem_accounted);
+    c->mem_accounted = 0;
+    if (c->mem_paused) {
+        stat_sub(&c->worker->stats.mem_paused, 1);
+    }
+    if (c->prev) {
+        c->prev->next = c->next;
+    } else {
+        c->worker->clients = c->next;
+    }
+    if (c->next) {
+        c->next->prev = c->prev;
+    }
+    if (g_engine == ENGINE_URING) {
+        c->closing = 1;
+        // Pending recv and send both complete promptly on a shut-down socket;
+        // the last completion frees the client.
+        if (c->recv_armed || c->send_inflight) {
+            shutdown(c->fd, SHUT_RDWR);
+            return;
+        }
+        uring_client_release(c);
+        return;
+    }
+    if (g_engine == ENGINE_EPOLL) {
+        epoll_client_release(c);
+        return;
+    }
+    if (c->bev) {
+        bufferevent_free(c->bev);
+    }
+    client_release(c->worker, c);
+}
+
+static void set_cork(struct client *c, int on) {
+    setsockopt(c->fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+}
+
+static void batch_begin(struct client *c) {
+    if (!g_coalesce) {
+        return;
+    }
+    c->worker->batch.owner = c;
+    c->worker->batch.len = 0;
+    if (g_cork == CORK_TCP) {
+        set_cork(c, 1);
+    }
+}
+
+// Pushes staged replies to the socket. When nothing older is queued in the
+// bufferevent we write straight from the batch, which skips the EV_WRITE
+// round trip; whatever the kernel does not take goes to the output buffer so
+// ordering, watermarks and write timeouts behave as before.
+static void batch_flush(struct client *c, int more) {
+    struct out_batch *b = &c->worker->batch;
+    struct evbuffer *output = c->out;
+    size_t sent = 0;
+
+    if (b->len == 0) {
+        return;
+    }
+    if (evbuffer_get_length(output) == 0) {
+        int flags = MSG_NOSIGNAL;
+        if (more && g_cork == CORK_MSG_MORE) {
+            flags |= MSG_MORE;
+        }
+        ssize_t n = send(c->fd, b->buf, b->len, flags);
+        stat_add(&c->worker->stats.write_syscalls, 1);
+        if (n > 0) {
+            sent = (size_t)n;
+        }
+    }
+    if (sent < b->len) {
+        evbuffer_add(output, b->buf + sent, b->len - sent);
+    }
+    b->len = 0;
+}
+
+static void batch_end(struct client *c) {
+    if (c->worker->batch.owner != c) {
+        return;
+    }
+    batch_flush(c, 0);
+    c->worker->batch.owner = NULL;
+    if (g_cork == CORK_TCP) {
+        set_cork(c, 0);
+    }
+}
+
+static int queue_response(struct client *c, const char *buf, size_t len) {
+    struct out_batch *b = &c->worker->batch;
+    int rc = 0;
+
+    if (b->owner == c) {
+        if (b->len + len > sizeof(b->buf)) {
+            batch_flush(c, 1);
+        }
+        if (len <= sizeof(b->buf)) {
+            memcpy(b->buf + b->len, buf, len);
+            b->len += len;
+        } else {
+            rc = evbuffer_add(c->out, buf, len);
+        }
+    } else if (g_engine == ENGINE_EPOLL) {
+        rc = epoll_queue(c, buf, len);
+    } else {
+        rc = evbuffer_add(c->out, buf, len);
+    }
+    if (rc == 0) {
+        stat_add(&c->worker->stats.bytes_out, len);
+    }
+    return rc;
+}
+
+// Moves len bytes from src to the client's output without copying. Anything
+// already staged in the batch is flushed first so replies stay in order.
+static int queue_response_buffer(struct client *c, struct evbuffer *src, size_t len) {
+    if (c->worker->batch.owner == c) {
+        batch_flush(c, 1);
+    }
+    int moved = evbuffer_remove_buffer(src, c->out, len);
+    if (moved < 0) {
+        return -1;
+    }
+    stat_add(&c->worker->stats.bytes_out, (unsigned long)moved);
+    return 0;
+}
+
+// Queues len bytes of a cached file from offset. The output buffer takes a
+// reference on the file segment, so nothing is read here: a socket
+// bufferevent hands the range to sendfile, other engines write it from the
+// segment's mapping. Like any other output it counts toward the watermarks
+// and the write timeout until it drains.
+static int queue_response_file(struct client *c, struct file_entry *e, uint64_t offset,
+    uint64_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    if (c->worker->batch.owner == c) {
+        batch_flush(c, 1);
+    }
+    if (client_output_len(c) == 0) {
+        c->last_write_ms = cached_now_ms(c->worker);
+    }
+    if (!g_file_copy) {
+        if (evbuffer_add_file_segment(c->out, e->seg, (ev_off_t)offset, (ev_off_t)len) < 0) {
+            return -1;
+        }
+        c->file_left += len;
+    } else {
+        uint64_t done = 0;
+        while (done < len) {
+            struct evbuffer_iovec vec;
+            size_t want = len - done < FILE_COPY_CHUNK ? (size_t)(len - done) : FILE_COPY_CHUNK;
+            if (evbuffer_reserve_space(c->out, (ev_ssize_t)want, &vec, 1) < 1) {
+                return -1;
+            }
+            ssize_t n = pread(e->fd, vec.iov_base, want, (off_t)(offset + done));
+            if (n <= 0) {
+                return -1;
+            }
+            vec.iov_len = (size_t)n;
+            evbuffer_commit_space(c->out, &vec, 1);
+            done += (uint64_t)n;
+        }
+    }
+    stat_add(&c->worker->stats.bytes_out, (unsigned long)len);
+    return 0;
+}
+
+static const char *steer_name(enum steer_mode mode) {
+    switch (mode) {
+    case STEER_INCOMING_CPU:
+        return "incoming-cpu";
+    case STEER_CBPF:
+        return "cbpf";
+    default:
+        return "none";
+    }
+}
+
+static size_t format_stats(char *buf, size_t cap) {
+    struct stats_report r;
+    memset(&r, 0, sizeof(r));
+    stats_snapshot(&r.totals);
+    kv_stats(g_kv, &r.kv);
+    for (int i = 0; i < g_num_workers; i++) {
+        const struct file_cache *fc = &g_workers[i].files;
+        r.file_hits += __atomic_load_n(&fc->hits, __ATOMIC_RELAXED);
+        r.file_misses += __atomic_load_n(&fc->misses, __ATOMIC_RELAXED);
+        r.file_invalidations += __atomic_load_n(&fc->invalidations, __ATOMIC_RELAXED);
+        r.pinned_workers += __atomic_load_n(&g_workers[i].cpu, __ATOMIC_RELAXED) >= 0;
+    }
+    r.log_dropped = log_dropped();
+    r.log_suppressed = log_suppressed();
+    r.mem_budget = g_mem_budget;
+    hist_snapshot(offsetof(struct worker, loop_iteration), &r.loop_iteration);
+    hist_snapshot(offsetof(struct worker, loop_lag), &r.loop_lag);
+    r.steering = steer_name(g_steer);
+    r.offload_threads = g_offload_threads;
+    r.offload_queue_depth = g_offload_threads > 0 ? offload_depth(&g_offload) : 0;
+    hist_snapshot(offsetof(struct worker, offload_latency), &r.offload);
+    r.command_names = g_command_stat_names;
+    r.num_commands = CMD_ID_COUNT;
+    return stats_format(&r, buf, cap);
+}
+
+static int line_is(const char *line, size_t len, const char *word, size_t word_len) {
+    return len == word_len && memcmp(line, word, word_len) == 0;
+}
+
+// Handlers get the argument (everything after the first space) as a borrowed,
+// non-terminated slice; arg is NULL when the verb had no space after it.
+// Returning 1 closes the connection.
+typedef int (*command_fn)(struct client *c, const char *arg, size_t arg_len);
+
+// Heavy commands (heavy set, fn NULL) go to the offload pool when there is
+// one; see heavy_submit.
+struct command {
+    const char *verb;
+    enum command_id id;
+    enum cmd_kind kind;
+    int min_args;
+    int max_args;
+    command_fn fn;
+    heavy_fn heavy;
+};
+
+static int cmd_ping(struct client *c, const char *arg, size_t arg_len) {
+    (void)arg;
+    (void)arg_len;
+    const char *resp = "PONG\n";
+    queue_response(c, resp, strlen(resp));
+    return 0;
+}
+
+static int cmd_echo(struct client *c, const char *arg, size_t arg_len) {
+    char resp[MAX_LINE + 8];
+    if (arg_len + 1 >= sizeof(resp)) {
+        const char *err = "ERR too_long\n";
+        queue_response(c, err, strlen(err));
+        return 0;
+    }
+    memcpy(resp, arg, arg_len);
+    resp[arg_len] = '\n';
+    queue_response(c, resp, arg_len + 1);
+    return 0;
+}
+
+static int cmd_unknown(struct client *c) {
+    const char *resp = "ERR unknown\n";
+    queue_response(c, resp, strlen(resp));
+    return 0;
+}
+
+// STATS WORKERS: a workers=<n> line, then one line per worker, so placement
+// and steering can be checked worker by worker.
+static void stats_workers(struct evbuffer *out) {
+    char line[256];
+    int len = snprintf(line, sizeof(line), "workers=%d\n", g_num_workers);
+    evbuffer_add(out, line, (size_t)len);
+    for (int i = 0; i < g_num_workers; i++) {
+        const struct worker *w = &g_workers[i];
+        const struct server_stats *s = &w->stats;
+        unsigned long local = __atomic_load_n(&s->accepted_local_cpu, __ATOMIC_RELAXED);
+        unsigned long cross = __atomic_load_n(&s->accepted_cross_cpu, __ATOMIC_RELAXED);
+        int pinned = __atomic_load_n(&w->cpu, __ATOMIC_RELAXED);
+        char cpu[16];
+        if (pinned >= 0) {
+            snprintf(cpu, sizeof(cpu), "%d", pinned);
+        } else {
+            snprintf(cpu, sizeof(cpu), "any");
+        }
+        len = snprintf(line, sizeof(line),
+            "worker=%d cpu=%s active_connections=%lu total_accepted=%lu requests=%lu "
+            "accepted_cross_cpu=%lu cross_cpu_pct=%.1f\n",
+            w->id, cpu,
+            __atomic_load_n(&s->active_connections, __ATOMIC_RELAXED),
+            __atomic_load_n(&s->total_accepted, __ATOMIC_RELAXED),
+            __atomic_load_n(&s->requests, __ATOMIC_RELAXED),
+            cross, cross_cpu_pct(local, cross));
+        if (len > 0 && (size_t)len < sizeof(line)) {
+            evbuffer_add(out, line, (size_t)len);
+        }
+    }
+}
+
+// Heavy: it walks every worker and locks every KV shard. Everything it reads
+// is atomic or locked, so it is safe off the loop.
+static void stats_reply(struct evbuffer *out, const char *arg, size_t arg_len) {
+    if (!arg) {
+        char resp[STATS_BUF_SIZE];
+        size_t wrote = format_stats(resp, sizeof(resp));
+        if (wrote > 0) {
+            evbuffer_add(out, resp, wrote);
+        }
+        return;
+    }
+    if (line_is(arg, arg_len, "LATENCY", 7)) {
+        char resp[LATENCY_BUF_SIZE];
+        size_t wrote = format_latency(resp, sizeof(resp));
+        if (wrote > 0) {
+            evbuffer_add(out, resp, wrote);
+        }
+        return;
+    }
+    if (line_is(arg, arg_len, "WORKERS", 7)) {
+        stats_workers(out);
+        return;
+    }
+    const char *resp = "ERR unknown\n";
+    evbuffer_add(out, resp, strlen(resp));
+}
+
+static int cmd_hello(struct client *c, const char *arg, size_t arg_len) {
+    if (!line_is(arg, arg_len, "BIN", 3)) {
+        return cmd_unknown(c);
+    }
+    const char *resp = "OK BIN\n";
+    queue_response(c, resp, strlen(resp));
+    c->proto = PROTO_BINARY;
+    return 0;
+}
+
+static int cmd_quit(struct client *c, const char *arg, size_t arg_len) {
+    (void)arg;
+    (void)arg_len;
+    stat_add(&c->worker->stats.closed_by_client, 1);
+    return 1;
+}
+
+// Splits "<key> <rest>" at the first space. Returns the key length; rest is
+// NULL when nothing follows the key.
+static size_t split_key(const char *arg, size_t arg_len, const char **rest, size_t *rest_len) {
+    const char *space = memchr(arg, ' ', arg_len);
+    if (!space) {
+        *rest = NULL;
+        *rest_len = 0;
+        return arg_len;
+    }
+    *rest = space + 1;
+    *rest_len = arg_len - (size_t)(space - arg) - 1;
+    return (size_t)(space - arg);
+}
+
+static int kv_reply_status(struct client *c, int rc, const char *ok) {
+    const char *resp;
+    switch (rc) {
+    case KV_OK:
+        resp = ok;
+        break;
+    case KV_NOT_FOUND:
+        resp = "NOT_FOUND\n";
+        break;
+    case KV_NOT_INTEGER:
+        resp = "ERR not_integer\n";
+        break;
+    case KV_OVERFLOW:
+        resp = "ERR overflow\n";
+        break;
+    case KV_KEY_TOO_LONG:
+        resp = "ERR key_too_long\n";
+        break;
+    default:
+        resp = "ERR out_of_memory\n";
+        break;
+    }
+    queue_response(c, resp, strlen(resp));
+    return 0;
+}
+
+static int kv_reply_usage(struct client *c) {
+    const char *resp = "ERR usage\n";
+    queue_response(c, resp, strlen(resp));
+    return 0;
+}
+
+// A GET reply built under the shard lock and queued after it is dropped, so
+// no flush (and its send) ever runs with the lock held. SET values come off
+// one request line and fit inline; heap only guards against anything larger.
+struct kv_reply {
+    char inline_buf[MAX_LINE + 8];
+    char *buf;
+    size_t len;
+};
+
+static void kv_reply_value(const char *value, size_t len, void *arg) {
+    struct kv_reply *r = arg;
+    r->buf = r->inline_buf;
+    if (len + 7 > sizeof(r->inline_buf)) {
+        r->buf = malloc(len + 7);
+        if (!r->buf) {
+            r->len = 0;
+            return;
+        }
+    }
+    memcpy(r->buf, "VALUE ", 6);
+    memcpy(r->buf + 6, value, len);
+    r->buf[6 + len] = '\n';
+    r->len = len + 7;
+}
+
+// GET <key> -> VALUE <value> | NOT_FOUND
+static int cmd_get(struct client *c, const char *arg, size_t arg_len) {
+    const char *rest;
+    size_t rest_len;
+    size_t key_len = split_key(arg, arg_len, &rest, &rest_len);
+    if (key_len == 0 || rest) {
+        return kv_reply_usage(c);
+    }
+    struct kv_reply r;
+    r.len = 0;
+    int rc = kv_get(g_kv, arg, key_len, cached_wall_ms(c->worker), kv_reply_value, &r);
+    if (rc != KV_OK) {
+        return kv_reply_status(c, rc, NULL);
+    }
+    if (r.len == 0) {
+        return kv_reply_status(c, KV_NO_MEMORY, NULL);
+    }
+    queue_response(c, r.buf, r.len);
+    if (r.buf != r.inline_buf) {
+        free(r.buf);
+    }
+    return 0;
+}
+
+// SET <key> <value>; the value is the rest of the line and may hold spaces.
+static int cmd_set(struct client *c, const char *arg, size_t arg_len) {
+    const char *value;
+    size_t value_len;
+    size_t key_len = split_key(arg, arg_len, &value, &value_len);
+    if (key_len == 0 || !value) {
+        return kv_reply_usage(c);
+    }
+    int rc = kv_set(g_kv, arg, key_len, value, value_len, cached_wall_ms(c->worker));
+    return kv_reply_status(c, rc, "OK\n");
+}
+
+// DEL <key> -> DELETED | NOT_FOUND
+static int cmd_del(struct client *c, const char *arg, size_t arg_len) {
+    const char *rest;
+    size_t rest_len;
+    size_t key_len = split_key(arg, arg_len, &rest, &rest_len);
+    if (key_len == 0 || rest) {
+        return kv_reply_usage(c);
+    }
+    int rc = kv_del(g_kv, arg, key_len, cached_wall_ms(c->worker));
+    return kv_reply_status(c, rc, "DELETED\n");
+}
+
+// INCR <key> -> <new value>
+static int cmd_incr(struct client *c, const char *arg, size_t arg_len) {
+    const char *rest;
+    size_t rest_len;
+    size_t key_len = split_key(arg, arg_len, &rest, &rest_len);
+    if (key_len == 0 || rest) {
+        return kv_reply_usage(c);
+    }
+    int64_t value;
+    int rc = kv_incr(g_kv, arg, key_len, 1, cached_wall_ms(c->worker), &value);
+    if (rc != KV_OK) {
+        return kv_reply_status(c, rc, NULL);
+    }
+    char resp[32];
+    int n = snprintf(resp, sizeof(resp), "%lld\n", (long long)value);
+    queue_response(c, resp, (size_t)n);
+    return 0;
+}
+
+// EXPIRE <key> <seconds> -> OK | NOT_FOUND; 0 seconds deletes the key.
+static int cmd_expire(struct client *c, const char *arg, size_t arg_len) {
+    const char *secs;
+    size_t secs_len;
+    size_t key_len = split_key(arg, arg_len, &secs, &secs_len);
+    char buf[24];
+    if (key_len == 0 || !secs || secs_len == 0 || secs_len >= sizeof(buf) ||
+        secs[0] < '0' || secs[0] > '9') {
+        return kv_reply_usage(c);
+    }
+    memcpy(buf, secs, secs_len);
+    buf[secs_len] = '\0';
+    char *end;
+    unsigned long seconds = strtoul(buf, &end, 10);
+    if (*end != '\0' || seconds > UINT32_MAX) {
+        return kv_reply_usage(c);
+    }
+    int rc = kv_expire(g_kv, arg, key_len, (uint64_t)seconds * 1000, cached_wall_ms(c->worker));
+    return kv_reply_status(c, rc, "OK\n");
+}
+
+static int parse_u64(const char *arg, size_t arg_len, uint64_t *out) {
+    char buf[24];
+    if (!arg || arg_len == 0 || arg_len >= sizeof(buf) || arg[0] < '0' || arg[0] > '9') {
+        return -1;
+    }
+    memcpy(buf, arg, arg_len);
+    buf[arg_len] = '\0';
+    char *end;
+    unsigned long long v = strtoull(buf, &end, 10);
+    if (*end != '\0') {
+        return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+// STREAM <len>, then exactly len raw bytes. They come back after a
+// "STREAM <len>" line, handed from input to output as they arrive (see
+// stream_payload), so payload size is not bounded by MAX_LINE or memory.
+static int cmd_stream(struct client *c, const char *arg, size_t arg_len) {
+    uint64_t len;
+    if (parse_u64(arg, arg_len, &len) < 0) {
+        const char *resp = "ERR usage\n";
+        queue_response(c, resp, strlen(resp));
+        return 0;
+    }
+    if (len > STREAM_MAX_LEN) {
+        // The payload cannot be told apart from commands now; hang up.
+        const char *err = "ERR too_long\n";
+        queue_response(c, err, strlen(err));
+        return 1;
+    }
+    char resp[40];
+    int n = snprintf(resp, sizeof(resp), "STREAM %llu\n", (unsigned long long)len);
+    queue_response(c, resp, (size_t)n);
+    c->stream_left = len;
+    return 0;
+}
+
+static int file_reply_error(struct client *c, const char *resp) {
+    queue_response(c, resp, strlen(resp));
+    return 0;
+}
+
+// FILE <path> [<offset> [<length>]] -> "FILE <len>" and len raw bytes of the
+// file beneath --file-root. The range is clamped to the end of the file.
+static int cmd_file(struct client *c, const char *arg, size_t arg_len) {
+    if (g_file_root_fd < 0) {
+        return file_reply_error(c, "ERR disabled\n");
+    }
+    const char *rest;
+    size_t rest_len;
+    size_t path_len = split_key(arg, arg_len, &rest, &rest_len);
+    uint64_t offset = 0;
+    uint64_t len = UINT64_MAX;
+    if (rest) {
+        const char *len_arg;
+        size_t len_arg_len;
+        size_t offset_len = split_key(rest, rest_len, &len_arg, &len_arg_len);
+        if (parse_u64(rest, offset_len, &offset) < 0 ||
+            (len_arg && parse_u64(len_arg, len_arg_len, &len) < 0)) {
+            return file_reply_error(c, "ERR usage\n");
+        }
+    }
+    if (path_len == 0) {
+        return file_reply_error(c, "ERR usage\n");
+    }
+
+    struct file_cache *fc = &c->worker->files;
+    struct file_entry *e;
+    switch (file_cache_get(fc, arg, path_len, cached_now_ms(c->worker), &e)) {
+    case FILE_OK:
+        break;
+    case FILE_NOT_FOUND:
+        return file_reply_error(c, "NOT_FOUND\n");
+    case FILE_FORBIDDEN:
+        return file_reply_error(c, "ERR forbidden\n");
+    case FILE_PATH_TOO_LONG:
+        return file_reply_error(c, "ERR path_too_long\n");
+    default:
+        return file_reply_error(c, "ERR io\n");
+    }
+    if (offset > e->size) {
+        file_cache_put(fc, e);
+        return file_reply_error(c, "ERR range\n");
+    }
+    if (len > e->size - offset) {
+        len = e->size - offset;
+    }
+    char resp[40];
+    int n = snprintf(resp, sizeof(resp), "FILE %llu\n", (unsigned long long)len);
+    queue_response(c, resp, (size_t)n);
+    int rc = queue_response_file(c, e, offset, len);
+    file_cache_put(fc, e);
+    // A short body would leave the client misframed, so hang up instead.
+    return rc < 0 ? 1 : 0;
+}
+
+// To add a command: give it a command_id, a handler and a row here. Lookup
+// cost does not depend on how many rows there are.
+static struct command g_commands[] = {
+    { "PING", CMD_ID_PING, CMD_PING, 0, 0, cmd_ping, NULL },
+    { "ECHO", CMD_ID_ECHO, CMD_ECHO, 1, 1, cmd_echo, NULL },
+    { "STATS", CMD_ID_STATS, CMD_STATS, 0, 1, NULL, stats_reply },
+    { "HELLO", CMD_ID_HELLO, CMD_OTHER, 1, 1, cmd_hello, NULL },
+    { "QUIT", CMD_ID_QUIT, CMD_OTHER, 0, 0, cmd_quit, NULL },
+    { "GET", CMD_ID_GET, CMD_KV, 1, 1, cmd_get, NULL },
+    { "SET", CMD_ID_SET, CMD_KV, 1, 1, cmd_set, NULL },
+    { "DEL", CMD_ID_DEL, CMD_KV, 1, 1, cmd_del, NULL },
+    { "INCR", CMD_ID_INCR, CMD_KV, 1, 1, cmd_incr, NULL },
+    { "EXPIRE", CMD_ID_EXPIRE, CMD_KV, 1, 1, cmd_expire, NULL },
+    { "STREAM", CMD_ID_STREAM, CMD_ECHO, 1, 1, cmd_stream, NULL },
+    { "FILE", CMD_ID_FILE, CMD_OTHER, 1, 1, cmd_file, NULL },
+};
+
+#define NUM_COMMANDS (sizeof(g_commands) / sizeof(g_commands[0]))
+
+static struct command_table g_command_table;
+
+static int command_table_build(void) {
+    const char *verbs[NUM_COMMANDS];
+    for (size_t i = 0; i < NUM_COMMANDS; i++) {
+        verbs[i] = g_commands[i].verb;
+    }
+    return command_table_init(&g_command_table, verbs, NUM_COMMANDS);
+}
+
+static void heavy_job_run(struct offload_job *job) {
+    struct heavy_job *j = (struct heavy_job *)job;
+    j->fn(j->out, j->has_arg ? j->arg : NULL, j->arg_len);
+}
+
+static void heavy_job_free(struct heavy_job *j) {
+    evbuffer_free(j->out);
+    free(j);
+}
+
+// Hands a heavy command to the offload pool; bin_req is the request header
+// when it came as a binary frame. The connection stops reading, and its
+// parser stops after this request, until offload_complete queues the reply,
+// so replies still leave in request order. Returns -1 to have the caller run
+// it inline: there is no pool, or no memory for the job.
+static int heavy_submit(struct client *c, heavy_fn fn, const char *arg, size_t arg_len,
+    const unsigned char *bin_req) {
+    if (g_offload_threads == 0) {
+        return -1;
+    }
+    struct heavy_job *j = malloc(sizeof(*j) + arg_len);
+    if (!j) {
+        return -1;
+    }
+    j->out = evbuffer_new();
+    if (!j->out) {
+        free(j);
+        return -1;
+    }
+    j->job.run = heavy_job_run;
+    j->job.done = &c->worker->offload_done;
+    j->client = c;
+    j->fn = fn;
+    j->queued = clock_now();
+    j->binary = bin_req != NULL;
+    if (bin_req) {
+        memcpy(j->bin_req, bin_req, BIN_HEADER_LEN);
+    }
+    j->has_arg = arg != NULL;
+    j->arg_len = arg_len;
+    if (arg_len > 0) {
+        memcpy(j->arg, arg, arg_len);
+    }
+    c->offload = j;
+    client_pause_reads(c);
+    offload_submit(&g_offload, &j->job);
+    return 0;
+}
+
+// The reply goes straight into the output after anything already staged, as
+// queue_response_buffer would move it.
+static void heavy_inline(struct client *c, heavy_fn fn, const char *arg, size_t arg_len) {
+    if (c->worker->batch.owner == c) {
+        batch_flush(c, 1);
+    }
+    size_t before = evbuffer_get_length(c->out);
+    fn(c->out, arg, arg_len);
+    stat_add(&c->worker->stats.bytes_out, evbuffer_get_length(c->out) - before);
+}
+
+// Lines are borrowed slices of the input buffer: not NUL-terminated, and only
+// valid until the caller drains them. *kind is set for latency accounting.
+static int handle_command(struct client *c, const char *line, size_t len, enum cmd_kind *kind) {
+    struct command_line cl;
+    command_split(line, len, &cl);
+    int idx = command_find(&g_command_table, cl.verb, cl.verb_len);
+    const struct command *cmd = idx >= 0 ? &g_commands[idx] : NULL;
+    int argc = cl.arg ? 1 : 0;
+
+    if (!cmd || argc < cmd->min_args || argc > cmd->max_args) {
+        *kind = CMD_OTHER;
+        stat_add(&c->worker->stats.cmd_hits[CMD_ID_UNKNOWN], 1);
+        return cmd_unknown(c);
+    }
+
+    *kind = cmd->kind;
+    stat_add(&c->worker->stats.cmd_hits[cmd->id], 1);
+    if (cmd->heavy) {
+        if (heavy_submit(c, cmd->heavy, cl.arg, cl.arg_len, NULL) < 0) {
+            heavy_inline(c, cmd->heavy, cl.arg, cl.arg_len);
+        }
+        return 0;
+    }
+    return cmd->fn(c, cl.arg, cl.arg_len);
+}
+
+static void bucket_init(struct client *c) {
+    c->tokens = (uint64_t)__atomic_load_n(&g_conn_rate.burst, __ATOMIC_RELAXED) * TOKEN_SCALE;
+    c->last_refill_us = cached_now_us(c->worker);
+}
+
+static int ip_bucket_consume(struct worker *w, const struct ip_key *key, uint64_t now_us) {
+    unsigned long rate = __atomic_load_n(&g_ip_rate.rate, __ATOMIC_RELAXED);
+    unsigned long burst = __atomic_load_n(&g_ip_rate.burst, __ATOMIC_RELAXED);
+    if (rate == 0) {
+        return 1;
+    }
+    int table_full;
+    int allowed = ip_limiter_consume(&g_ip_limiter, key, now_us, rate, burst, &table_full);
+    if (table_full) {
+        stat_add(&w->stats.ip_table_full, 1);
+    }
+    return allowed;
+}
+
+// Two tiers: the connection's own bucket, then the bucket shared by every
+// connection from the same source address (TCP only). A request rejected by
+// the IP tier does not spend a connection token.
+static int bucket_consume(struct client *c) {
+    struct worker *w = c->worker;
+    unsigned long rate = __atomic_load_n(&g_conn_rate.rate, __ATOMIC_RELAXED);
+    unsigned long burst = __atomic_load_n(&g_conn_rate.burst, __ATOMIC_RELAXED);
+    uint64_t now_us = cached_now_us(w);
+
+    if (rate > 0) {
+        c->tokens = bucket_refill(c->tokens, c->last_refill_us, now_us, rate, burst);
+        c->last_refill_us = now_us;
+        if (c->tokens < TOKEN_SCALE) {
+            stat_add(&w->stats.rate_limited_conn, 1);
+            return 0;
+        }
+    }
+
+    // Socket peers have no source address: keyed as one, every local
+    // client would share a bucket, so only their connection tier applies.
+    if (c->peer_addr.ss_family != AF_UNIX && !ip_bucket_consume(w, &c->ip, now_us)) {
+        stat_add(&w->stats.rate_limited_ip, 1);
+        return 0;
+    }
+
+    if (rate > 0) {
+        c->tokens -= TOKEN_SCALE;
+    }
+    return 1;
+}
+
+// Per-connection backpressure first, then the global budget: over it, every
+// connection stops after the read it is handling (see mem_tick).
+static void maybe_pause_reads(struct client *c) {
+    mem_sync(c);
+    if (!client_reading(c)) {
+        return;
+    }
+    size_t out_len = client_output_len(c);
+    if (c->worker->batch.owner == c) {
+        out_len += c->worker->batch.len;
+    }
+    if (out_len > OUT_HIGH_WM) {
+        client_pause_reads(c);
+    } else if (mem_over(100)) {
+        client_pause_reads(c);
+        mem_mark_paused(c);
+    }
+}
+
+// Chosen once at startup from the CPU's feature flags.
+static line_scan_fn g_scan_lf = line_scan_scalar;
+
+// Handles one complete line (without its LF). Returns 1 if the client was
+// closed, in which case the caller must not touch it or its buffers again.
+static int process_line(struct client *c, const char *line, size_t line_len) {
+    struct worker *w = c->worker;
+    uint64_t start = clock_now();
+    struct timeval t0;
+    if (LOG_ENABLED(LOG_DEBUG)) {
+        evutil_gettimeofday(&t0, NULL);
+    }
+
+    if (line_len >= MAX_LINE) {
+        const char *err = "ERR too_long\n";
+        queue_response(c, err, strlen(err));
+        log_disconnect(c, "line_too_long");
+        close_client(c);
+        return 1;
+    }
+
+    stat_add(&c->worker->stats.bytes_in, line_len + 1);
+    stat_add(&c->worker->stats.requests, 1);
+
+    if (!bucket_consume(c)) {
+        const char *resp = "429 SLOWDOWN\n";
+        queue_response(c, resp, strlen(resp));
+        stat_add(&c->worker->stats.rate_limited, 1);
+        // A rejected STREAM's payload is still on its way; skip it rather
+        // than parse it as commands.
+        uint64_t skip;
+        if (line_len > 7 && memcmp(line, "STREAM ", 7) == 0 &&
+            parse_u64(line + 7, line_len - 7, &skip) == 0 && skip <= STREAM_MAX_LEN) {
+            c->stream_left = skip;
+            c->stream_discard = 1;
+        }
+        latency_record(w, CMD_RATE_LIMITED, start);
+        if (LOG_ENABLED(LOG_DEBUG)) {
+            struct timeval t1;
+            evutil_gettimeofday(&t1, NULL);
+            LOG_SAMPLE(LOG_DEBUG, g_log_sample, "client %s cmd: %.*s latency_ms=%.3f rate_limited=1",
+                client_peer(c), (int)line_len, line, elapsed_ms(&t0, &t1));
+        }
+        maybe_pause_reads(c);
+        return 0;
+    }
+
+    enum cmd_kind kind;
+    int rc = handle_command(c, line, line_len, &kind);
+    latency_record(w, kind, start);
+    if (LOG_ENABLED(LOG_DEBUG)) {
+        struct timeval t1;
+        evutil_gettimeofday(&t1, NULL);
+        LOG_SAMPLE(LOG_DEBUG, g_log_sample, "client %s cmd: %.*s latency_ms=%.3f",
+            client_peer(c), (int)line_len, line, elapsed_ms(&t0, &t1));
+    }
+    if (rc != 0) {
+        log_disconnect(c, "client_quit");
+        close_client(c);
+        return 1;
+    }
+    maybe_pause_reads(c);
+    return 0;
+}
+
+// Finds the first LF in the input when it is not in the first chunk. Returns
+// its offset, or -1 if the buffer holds no complete line yet.
+static ssize_t find_lf_across_chunks(struct evbuffer *input) {
+    struct evbuffer_iovec vecs[PEEK_VECS];
+    int n = evbuffer_peek(input, MAX_LINE, NULL, vecs, PEEK_VECS);
+    size_t offset = 0;
+    if (n > PEEK_VECS) {
+        n = PEEK_VECS;
+    }
+    for (int i = 0; i < n; i++) {
+        const char *base = vecs[i].iov_base;
+        const char *lf = g_scan_lf(base, base + vecs[i].iov_len);
+        if (lf) {
+            return (ssize_t)(offset + (size_t)(lf - base));
+        }
+        offset += vecs[i].iov_len;
+    }
+    // Overlong line (or many tiny chunks): rare, so a plain search is fine.
+    struct evbuffer_ptr pos = evbuffer_search(input, "\n", 1, NULL);
+    return pos.pos;
+}
+
+// Returns 1 if the client was closed while handling its input.
+static int parse_text(struct client *c) {
+    struct evbuffer *input = c->in;
+
+    // Lines are dispatched straight out of the evbuffer's chunks and drained
+    // in bulk, so the common case copies nothing and allocates nothing.
+    for (;;) {
+        struct evbuffer_iovec vec;
+        if (evbuffer_peek(input, -1, NULL, &vec, 1) < 1 || vec.iov_len == 0) {
+            return 0;
+        }
+
+        const char *start = vec.iov_base;
+        const char *end = start + vec.iov_len;
+        const char *p = start;
+        const char *lf;
+        while ((lf = g_scan_lf(p, end)) != NULL) {
+            if (process_line(c, p, (size_t)(lf - p))) {
+                return 1;
+            }
+            p = lf + 1;
+            if (c->proto != PROTO_TEXT || c->stream_left || c->offload) {
+                // HELLO BIN or STREAM: what follows is not lines. An
+                // offloaded command: nothing more until its reply is queued.
+                break;
+            }
+        }
+        if (p != start) {
+            evbuffer_drain(input, (size_t)(p - start));
+            if (c->proto != PROTO_TEXT || c->stream_left || c->offload) {
+                return 0;
+            }
+            continue;
+        }
+
+        // The next line straddles a chunk boundary.
+        ssize_t off = find_lf_across_chunks(input);
+        if (off < 0) {
+            return 0;
+        }
+        const char *line = NULL;
+        if ((size_t)off < MAX_LINE) {
+            line = (const char *)evbuffer_pullup(input, off + 1);
+            if (!line) {
+                close_client(c);
+                return 1;
+            }
+        }
+        // Overlong lines are rejected on length alone, so skip the pullup.
+        if (process_line(c, line ? line : start, (size_t)off)) {
+            return 1;
+        }
+        evbuffer_drain(input, (size_t)off + 1);
+        if (c->proto != PROTO_TEXT || c->stream_left || c->offload) {
+            return 0;
+        }
+    }
+}
+
+static uint32_t load_be32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void store_be32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static void queue_bin_header(struct client *c, const unsigned char *req,
+    enum bin_status status, size_t len) {
+    unsigned char hdr[BIN_HEADER_LEN];
+    memset(hdr, 0, sizeof(hdr));
+    hdr[0] = req[0];
+    hdr[1] = (unsigned char)status;
+    memcpy(hdr + 4, req + 4, 4);
+    store_be32(hdr + 8, (uint32_t)len);
+    queue_response(c, (const char *)hdr, sizeof(hdr));
+}
+
+static void queue_bin_reply(struct client *c, const unsigned char *req,
+    enum bin_status status, const char *payload, size_t len) {
+    queue_bin_header(c, req, status, len);
+    if (len > 0) {
+        queue_response(c, payload, len);
+    }
+}
+
+// Binary twin of handle_command; the payload is still in the input buffer
+// and must be consumed here.
+static int handle_frame(struct client *c, const unsigned char *hdr,
+    struct evbuffer *input, size_t len, enum cmd_kind *kind) {
+    static const enum command_id opcode_ids[] = {
+        [BIN_OP_PING] = CMD_ID_PING,
+        [BIN_OP_ECHO] = CMD_ID_ECHO,
+        [BIN_OP_STATS] = CMD_ID_STATS,
+        [BIN_OP_QUIT] = CMD_ID_QUIT,
+        [BIN_OP_STATS_LATENCY] = CMD_ID_STATS,
+    };
+    enum command_id id = CMD_ID_UNKNOWN;
+    if (hdr[0] >= BIN_OP_PING && hdr[0] <= BIN_OP_STATS_LATENCY) {
+        id = opcode_ids[hdr[0]];
+    }
+    stat_add(&c->worker->stats.cmd_hits[id], 1);
+    *kind = CMD_OTHER;
+
+    switch (hdr[0]) {
+    case BIN_OP_PING:
+        *kind = CMD_PING;
+        evbuffer_drain(input, len);
+        queue_bin_reply(c, hdr, BIN_STATUS_OK, "PONG", 4);
+        return 0;
+
+    case BIN_OP_ECHO:
+        *kind = CMD_ECHO;
+        if (len <= BIN_INLINE_PAYLOAD) {
+            char payload[BIN_INLINE_PAYLOAD];
+            evbuffer_remove(input, payload, len);
+            queue_bin_reply(c, hdr, BIN_STATUS_OK, payload, len);
+            return 0;
+        }
+        // Large payloads move chain by chain to the output without copying.
+        queue_bin_header(c, hdr, BIN_STATUS_OK, len);
+        queue_response_buffer(c, input, len);
+        return 0;
+
+    case BIN_OP_STATS: {
+        *kind = CMD_STATS;
+        evbuffer_drain(input, len);
+        if (heavy_submit(c, stats_reply, NULL, 0, hdr) == 0) {
+            return 0;
+        }
+        char resp[STATS_BUF_SIZE];
+        queue_bin_reply(c, hdr, BIN_STATUS_OK, resp, format_stats(resp, sizeof(resp)));
+        return 0;
+    }
+
+    case BIN_OP_STATS_LATENCY: {
+        *kind = CMD_STATS;
+        evbuffer_drain(input, len);
+        if (heavy_submit(c, stats_reply, "LATENCY", 7, hdr) == 0) {
+            return 0;
+        }
+        char resp[LATENCY_BUF_SIZE];
+        queue_bin_reply(c, hdr, BIN_STATUS_OK, resp, format_latency(resp, sizeof(resp)));
+        return 0;
+    }
+
+    case BIN_OP_QUIT:
+        evbuffer_drain(input, len);
+        stat_add(&c->worker->stats.closed_by_client, 1);
+        return 1;
+
+    default:
+        evbuffer_drain(input, len);
+        queue_bin_reply(c, hdr, BIN_STATUS_UNKNOWN, NULL, 0);
+        return 0;
+    }
+}
+
+// Binary twin of process_line: same limits, accounting and rate limiting.
+static int process_frame(struct client *c, const unsigned char *hdr,
+    struct evbuffer *input, size_t len) {
+    struct worker *w = c->worker;
+    uint64_t start = clock_now();
+
+    stat_add(&w->stats.bytes_in, BIN_HEADER_LEN + len);
+    stat_add(&w->stats.requests, 1);
+
+    if (!bucket_consume(c)) {
+        evbuffer_drain(input, len);
+        queue_bin_reply(c, hdr, BIN_STATUS_RATE_LIMITED, NULL, 0);
+        stat_add(&w->stats.rate_limited, 1);
+        latency_record(w, CMD_RATE_LIMITED, start);
+        maybe_pause_reads(c);
+        return 0;
+    }
+
+    enum cmd_kind kind;
+    int rc = handle_frame(c, hdr, input, len, &kind);
+    latency_record(w, kind, start);
+    LOG_SAMPLE(LOG_DEBUG, g_log_sample, "client %s frame: op=%u len=%zu", client_peer(c), hdr[0], len);
+    if (rc != 0) {
+        log_disconnect(c, "client_quit");
+        close_client(c);
+        return 1;
+    }
+    maybe_pause_reads(c);
+    return 0;
+}
+
+static int parse_binary(struct client *c) {
+    struct evbuffer *input = c->in;
+
+    for (;;) {
+        unsigned char hdr[BIN_HEADER_LEN];
+        size_t avail = evbuffer_get_length(input);
+        if (avail < BIN_HEADER_LEN) {
+            return 0;
+        }
+        evbuffer_copyout(input, hdr, BIN_HEADER_LEN);
+
+        size_t len = load_be32(hdr + 8);
+        if (len > BIN_MAX_PAYLOAD) {
+            queue_bin_reply(c, hdr, BIN_STATUS_TOO_LONG, NULL, 0);
+            log_disconnect(c, "frame_too_long");
+            close_client(c);
+            return 1;
+        }
+        // No scanning: the header says exactly how much to wait for.
+        if (avail < BIN_HEADER_LEN + len) {
+            return 0;
+        }
+        evbuffer_drain(input, BIN_HEADER_LEN);
+        if (process_frame(c, hdr, input, len)) {
+            return 1;
+        }
+        if (c->offload) {
+            return 0;
+        }
+    }
+}
+
+// Moves whatever part of a STREAM payload has arrived to the output: whole
+// chains change hands, only the boundary chain is copied. Reads pause at the
+// high watermark like for any reply, so a slow reader stalls the sender and
+// at most one read's worth sits above OUT_HIGH_WM.
+static void stream_payload(struct client *c) {
+    size_t avail = evbuffer_get_length(c->in);
+    size_t n = avail < c->stream_left ? avail : (size_t)c->stream_left;
+    if (n == 0) {
+        return;
+    }
+    if (c->stream_discard) {
+        evbuffer_drain(c->in, n);
+    } else {
+        queue_response_buffer(c, c->in, n);
+    }
+    stat_add(&c->worker->stats.bytes_in, n);
+    c->stream_left -= n;
+    if (c->stream_left == 0) {
+        c->stream_discard = 0;
+    }
+    maybe_pause_reads(c);
+}
+
+// Returns 1 if the client was closed while handling its input.
+static int parse_input(struct client *c) {
+    if (c->offload) {
+        return 0; // picked up again by offload_complete
+    }
+    if (c->proto == PROTO_UNKNOWN) {
+        struct evbuffer *input = c->in;
+        unsigned char first;
+        if (evbuffer_copyout(input, &first, 1) != 1) {
+            return 0;
+        }
+        c->proto = PROTO_TEXT;
+        if (first == BIN_MAGIC) {
+            evbuffer_drain(input, 1);
+            c->proto = PROTO_BINARY;
+        }
+    }
+    // Text and STREAM payloads take turns until the input runs dry.
+    while (c->proto == PROTO_TEXT) {
+        if (c->stream_left) {
+            stream_payload(c);
+            if (c->stream_left) {
+                return 0;
+            }
+        }
+        if (parse_text(c)) {
+            return 1;
+        }
+        if (!c->stream_left) {
+            break;
+        }
+    }
+    // Checked again: HELLO BIN switches a text connection mid-buffer.
+    if (c->proto == PROTO_BINARY) {
+        return parse_binary(c);
+    }
+    return 0;
+}
+
+static void client_read_cb(struct bufferevent *bev, void *arg) {
+    (void)bev;
+    struct client *c = arg;
+    loop_callback(c->worker);
+
+    c->last_read_ms = cached_now_ms(c->worker);
+    batch_begin(c);
+    if (parse_input(c)) {
+        return;
+    }
+    batch_end(c);
+    maybe_pause_reads(c);
+}
+
+// Backpressure release, shared by every engine. While the global budget is
+// exceeded the connection stays paused and mem_tick resumes it later.
+static void client_output_drained(struct client *c) {
+    mem_sync(c);
+    if (client_output_len(c) <= OUT_LOW_WM && !client_reading(c) && !c->mem_paused) {
+        if (mem_over(100)) {
+            mem_mark_paused(c);
+        } else {
+            client_resume_reads(c);
+        }
+    }
+}
+
+// Writes wbuf and then out with one writev per pass until the socket pushes
+// back; the EPOLLOUT edge brings us back for the rest. Returns 1 if the
+// client was closed.
+static int epoll_flush(struct client *c) {
+    struct worker *w = c->worker;
+    int progress = 0;
+
+    while (client_output_len(c) > 0) {
+        struct iovec iov[EPOLL_WRITE_IOVS];
+        size_t pending = c->wlen - c->woff;
+        int n = 0;
+        if (pending > 0) {
+            iov[0].iov_base = c->wbuf + c->woff;
+            iov[0].iov_len = pending;
+            n = 1;
+        }
+        int chunks = evbuffer_peek(c->out, -1, NULL, iov + n,
+            EPOLL_WRITE_IOVS - n);
+        n += chunks < EPOLL_WRITE_IOVS - n ? chunks : EPOLL_WRITE_IOVS - n;
+
+        ssize_t wrote = writev(c->fd, iov, n);
+        stat_add(&w->stats.write_syscalls, 1);
+        if (wrote < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (LOG_ENABLED(LOG_DEBUG)) {
+                char reason[128];
+                snprintf(reason, sizeof(reason), "error:%s", strerror(errno));
+                log_disconnect(c, reason);
+            }
+            close_client(c);
+            return 1;
+        }
+        progress = 1;
+        size_t from_wbuf = (size_t)wrote < pending ? (size_t)wrote : pending;
+        c->woff += from_wbuf;
+        if (c->woff == c->wlen) {
+            c->woff = 0;
+            c->wlen = 0;
+        }
+        if ((size_t)wrote > from_wbuf) {
+            evbuffer_drain(c->out, (size_t)wrote - from_wbuf);
+        }
+    }
+    if (progress) {
+        c->last_write_ms = cached_now_ms(w);
+        client_output_drained(c);
+    }
+    return 0;
+}
+
+static void client_write_cb(struct bufferevent *bev, void *arg) {
+    (void)bev;
+    struct client *c = arg;
+    loop_callback(c->worker);
+    client_output_drained(c);
+}
+
+static void tls_handshake_done(struct client *c) {
+    struct worker *w = c->worker;
+    struct tls_session_info info;
+    tls_session_info(bufferevent_openssl_get_ssl(c->bev), &info);
+    c->tls_done = 1;
+    stat_add(&w->stats.tls_handshakes, 1);
+    if (info.resumed) {
+        stat_add(&w->stats.tls_resumed, 1);
+    }
+    if (info.ktls_tx) {
+        stat_add(&w->stats.tls_ktls_tx, 1);
+    }
+    if (info.ktls_rx) {
+        stat_add(&w->stats.tls_ktls_rx, 1);
+    }
+    LOG(LOG_DEBUG, "server: peer %s tls %s ktls_tx=%d ktls_rx=%d", client_peer(c),
+        info.resumed ? "resumed" : "full", info.ktls_tx, info.ktls_rx);
+}
+
+static void client_event_cb(struct bufferevent *bev, short events, void *arg) {
+    struct client *c = arg;
+    loop_callback(c->worker);
+
+    // An accepting OpenSSL bufferevent reports the finished handshake as
+    // CONNECTED.
+    if (events & BEV_EVENT_CONNECTED) {
+        tls_handshake_done(c);
+        return;
+    }
+    if (g_tls_ctx && !c->tls_done && (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR))) {
+        stat_add(&c->worker->stats.tls_failures, 1);
+        if (LOG_ENABLED(LOG_DEBUG)) {
+            char err[160];
+            char reason[192];
+            snprintf(reason, sizeof(reason), "tls:%s",
+                tls_error_string(bufferevent_get_openssl_error(bev), err, sizeof(err)));
+            log_disconnect(c, reason);
+        }
+        close_client(c);
+        return;
+    }
+
+    if (events & BEV_EVENT_EOF) {
+        stat_add(&c->worker->stats.closed_by_client, 1);
+        log_disconnect(c, "eof");
+        close_client(c);
+        return;
+    }
+
+    if (events & BEV_EVENT_ERROR) {
+        if (LOG_ENABLED(LOG_DEBUG)) {
+            int err = EVUTIL_SOCKET_ERROR();
+            const char *err_str = evutil_socket_error_to_string(err);
+            char reason[128];
+            snprintf(reason, sizeof(reason), "error:%s", err_str);
+            log_disconnect(c, reason);
+        }
+        close_client(c);
+    }
+}
+
+// Each bufferevent read adds to the input exactly once and each write drains
+// the output exactly once, so these callbacks count the I/O syscalls libevent
+// makes on our behalf.
+static void input_count_cb(struct evbuffer *buf, const struct evbuffer_cb_info *info, void *arg) {
+    (void)buf;
+    struct client *c = arg;
+    if (info->n_added > 0) {
+        stat_add(&c->worker->stats.read_syscalls, 1);
+    }
+}
+
+static void output_count_cb(struct evbuffer *buf, const struct evbuffer_cb_info *info, void *arg) {
+    (void)buf;
     struct client *c = arg;
+    if (info->n_deleted > 0) {
+        stat_add(&c->worker->stats.write_syscalls, 1);
+        if (c->worker->iteration_callbacks == 0) {
+            // libevent's own write handler can run before any of ours.
+            clock_refresh(c->worker);
+        }
+        c->last_write_ms = cached_now_ms(c->worker);
+        // The write callback only runs once output is empty.
+        mem_sync(c);
+    } else if (info->n_added > 0 && info->orig_size == 0) {
+        // The write timeout runs from when output starts waiting.
+        c->last_write_ms = cached_now_ms(c->worker);
+    }
+}
+
+// Same rules libevent applied with bufferevent_set_timeouts: the read timeout
+// runs while reading is enabled, the write timeout while output is pending.
+static uint64_t client_deadline_ms(struct client *c) {
+    uint64_t deadline = UINT64_MAX;
+    if (client_reading(c)) {
+        deadline = c->last_read_ms + READ_TIMEOUT_SEC * 1000ull;
+    }
+    if (client_output_len(c) > 0) {
+        uint64_t write_deadline = c->last_write_ms + WRITE_TIMEOUT_SEC * 1000ull;
+        if (write_deadline < deadline) {
+            deadline = write_deadline;
+        }
+    }
+    if (deadline == UINT64_MAX) {
+        deadline = c->last_read_ms + READ_TIMEOUT_SEC * 1000ull;
+    }
+    return deadline;
+}
+
+static void client_timer_expire(struct wheel_timer *t, uint64_t now_ms, void *arg) {
+    struct worker *w = arg;
+    struct client *c = (struct client *)((char *)t - offsetof(struct client, timer));
+    uint64_t deadline = client_deadline_ms(c);
+
+    if (deadline > now_ms) {
+        // Activity since arming pushed the deadline out: lazy re-arm.
+        timer_wheel_add(&w->wheel, &c->timer, deadline);
+        return;
+    }
+    if (c->mem_paused && client_output_len(c) == 0) {
+        // We stopped reading it, so its silence says nothing about the peer.
+        timer_wheel_add(&w->wheel, &c->timer, now_ms + READ_TIMEOUT_SEC * 1000ull);
+        return;
+    }
+    stat_add(&w->stats.timeouts, 1);
+    log_disconnect(c, "timeout");
+    close_client(c);
+}
+
+// Identity only; the engine attaches I/O, then client_start makes it live.
+static struct client *client_open(struct worker *w, int fd,
+    const struct sockaddr_storage *addr, socklen_t addr_len) {
+    struct client *c = client_alloc(w);
+    if (!c) {
+        return NULL;
+    }
+    c->worker = w;
+    c->fd = fd;
+    memcpy(&c->peer_addr, addr, addr_len);
+    c->peer_len = addr_len;
+    ip_key_from_sockaddr(addr, &c->ip);
+    evutil_gettimeofday(&c->connected_at, NULL);
+    return c;
+}
+
+// Compares the CPU the kernel processed the handshake on with the one this
+// worker runs on; steering exists to make these match.
+static void client_note_cpu(struct client *c) {
+    struct worker *w = c->worker;
+    int rx_cpu = -1;
+    socklen_t len = sizeof(rx_cpu);
+    if (getsockopt(c->fd, SOL_SOCKET, SO_INCOMING_CPU, &rx_cpu, &len) < 0 || rx_cpu < 0) {
+        return;
+    }
+    int cpu = w->cpu >= 0 ? w->cpu : sched_getcpu();
+    stat_add(rx_cpu == cpu ? &w->stats.accepted_local_cpu : &w->stats.accepted_cross_cpu, 1);
+}
+
+static void client_start(struct client *c) {
+    struct worker *w = c->worker;
+    bucket_init(c);
+    client_note_cpu(c);
+    stat_add(&w->stats.total_accepted, 1);
+    stat_add(&w->stats.active_connections, 1);
+    c->last_read_ms = cached_now_ms(w);
+    c->last_write_ms = c->last_read_ms;
+    c->next = w->clients;
+    if (w->clients) {
+        w->clients->prev = c;
+    }
+    w->clients = c;
+    timer_wheel_add(&w->wheel, &c->timer, c->last_read_ms + READ_TIMEOUT_SEC * 1000ull);
+    LOG(LOG_DEBUG, "server: peer %s connected", client_peer(c));
+}
+
+// Text lines are dispatched straight out of the fixed read buffer and only a
+// trailing partial line is moved down. Binary frames can be far larger than
+// the buffer, so a framed connection hands its bytes to the evbuffer parser.
+// Returns 1 if the client was closed.
+static int epoll_parse(struct client *c) {
+    size_t off = 0;
+
+    if (c->offload) {
+        return 0;
+    }
+    if (c->proto == PROTO_UNKNOWN) {
+        c->proto = PROTO_TEXT;
+        if ((unsigned char)c->rbuf[0] == BIN_MAGIC) {
+            c->proto = PROTO_BINARY;
+            off = 1;
+        }
+    }
+    const char *end = c->rbuf + c->rlen;
+    while (c->proto == PROTO_TEXT) {
+        if (c->stream_left) {
+            // The fixed buffers mean STREAM payloads are copied here.
+            size_t avail = c->rlen - off;
+            size_t n = avail < c->stream_left ? avail : (size_t)c->stream_left;
+            if (n > 0 && !c->stream_discard) {
+                queue_response(c, c->rbuf + off, n);
+            }
+            stat_add(&c->worker->stats.bytes_in, n);
+            c->stream_left -= n;
+            off += n;
+            if (c->stream_left) {
+                break;
+            }
+            c->stream_discard = 0;
+            maybe_pause_reads(c);
+        }
+        const char *p = c->rbuf + off;
+        const char *lf = g_scan_lf(p, end);
+        if (!lf) {
+            if ((size_t)(end - p) >= MAX_LINE) {
+                // Rejected on length alone; process_line closes the client.
+                return process_line(c, p, (size_t)(end - p));
+            }
+            break;
+        }
+        if (process_line(c, p, (size_t)(lf - p))) {
+            return 1;
+        }
+        off = (size_t)(lf - c->rbuf) + 1;
+        if (c->offload) {
+            break;
+        }
+    }
+    // Checked again: HELLO BIN switches a text connection mid-buffer.
+    if (c->proto == PROTO_BINARY && off < c->rlen) {
+        if (!c->in && !(c->in = evbuffer_new())) {
+            close_client(c);
+            return 1;
+        }
+        evbuffer_add(c->in, c->rbuf + off, c->rlen - off);
+        off = c->rlen;
+    }
+    if (off > 0) {
+        memmove(c->rbuf, c->rbuf + off, c->rlen - off);
+        c->rlen -= off;
+    }
+    if (c->proto == PROTO_BINARY && c->in) {
+        return parse_binary(c);
+    }
+    return 0;
+}
+
+// Edge-triggered: keep reading until the socket is empty or backpressure
+// pauses the client. Replies go out after each read, so a pipelining client
+// gets one writev per read rather than one per request.
+static void epoll_read(struct client *c) {
+    struct worker *w = c->worker;
+
+    while (c->reading) {
+        ssize_t n = read(c->fd, c->rbuf + c->rlen, EPOLL_RBUF_SIZE - c->rlen);
+        stat_add(&w->stats.read_syscalls, 1);
+        if (n > 0) {
+            c->rlen += (size_t)n;
+            c->last_read_ms = cached_now_ms(w);
+            if (epoll_parse(c)) {
+                return;
+            }
+            maybe_pause_reads(c);
+            if (epoll_flush(c)) {
+                return;
+            }
+            continue;
+        }
+        if (n == 0) {
+            stat_add(&w->stats.closed_by_client, 1);
+            log_disconnect(c, "eof");
+            close_client(c);
+            return;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return;
+        }
+        if (LOG_ENABLED(LOG_DEBUG)) {
+            char reason[128];
+            snprintf(reason, sizeof(reason), "error:%s", strerror(errno));
+            log_disconnect(c, reason);
+        }
+        close_client(c);
+        return;
+    }
+}
+
+static void epoll_client_event(struct client *c, uint32_t events) {
+    int resumed = 0;
+    if (events & EPOLLOUT) {
+        int was_reading = c->reading;
+        if (epoll_flush(c)) {
+            return;
+        }
+        resumed = !was_reading && c->reading;
+    }
+    // Errors and hangups surface as a failed or empty read.
+    if (c->reading && (resumed || (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))) {
+        epoll_read(c);
+    }
+}
+
+// Sockets are registered once for both directions; with edge triggering an
+// idle writable socket costs nothing, and no epoll_ctl is needed to pause.
+static int epoll_attach(struct worker *w, int fd, const struct sockaddr_storage *addr,
+    socklen_t addr_len) {
+    struct client *c = client_open(w, fd, addr, addr_len);
+    if (!c) {
+        return -1;
+    }
+    c->rbuf = malloc(EPOLL_RBUF_SIZE + EPOLL_WBUF_SIZE);
+    c->out = evbuffer_new();
+    if (!c->rbuf || !c->out) {
+        free(c->rbuf);
+        if (c->out) {
+            evbuffer_free(c->out);
+        }
+        client_release(w, c);
+        return -1;
+    }
+    c->wbuf = c->rbuf + EPOLL_RBUF_SIZE;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = c;
+    if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        LOG_RATELIMIT(LOG_WARN, 1, "server: epoll_ctl: %s", strerror(errno));
+        free(c->rbuf);
+        evbuffer_free(c->out);
+        client_release(w, c);
+        return -1;
+    }
+    client_start(c);
+    // Bytes that arrived before the add (TCP_DEFER_ACCEPT) still report an
+    // edge on the first epoll_wait.
+    c->reading = 1;
+    return 0;
+}
+
+// Returns 1 if the client was closed.
+static int uring_parse(struct client *c) {
+    if (parse_input(c)) {
+        return 1;
+    }
+    maybe_pause_reads(c);
+    uring_flush(c);
+    return 0;
+}
+
+// Back on the owning loop: queue the reply, then pick the connection up
+// where its parser stopped, reading again unless its output or the memory
+// budget says otherwise.
+static void offload_complete(struct worker *w, struct heavy_job *j) {
+    struct client *c = j->client;
+    hist_record(&w->offload_latency, clock_delta_ns(j->queued, clock_now()));
+    stat_add(&w->stats.offload_jobs, 1);
+    if (!c) {
+        stat_add(&w->stats.offload_orphaned, 1);
+        heavy_job_free(j);
+        return;
+    }
+    c->offload = NULL;
+    size_t len = evbuffer_get_length(j->out);
+    if (j->binary) {
+        queue_bin_header(c, j->bin_req, BIN_STATUS_OK, len);
+    }
+    queue_response_buffer(c, j->out, len);
+    heavy_job_free(j);
+    client_output_drained(c);
+    if (g_engine == ENGINE_EPOLL) {
+        if (epoll_parse(c)) {
+            return;
+        }
+        maybe_pause_reads(c);
+        if (epoll_flush(c)) {
+            return;
+        }
+        // Data that arrived while paused raised no new edge.
+        epoll_read(c);
+    } else if (g_engine == ENGINE_URING) {
+        uring_parse(c);
+    } else if (!parse_input(c)) {
+        maybe_pause_reads(c);
+    }
+}
+
+static void offload_drain(struct worker *w) {
+    struct offload_job *job = offload_done_take(&w->offload_done);
+    while (job) {
+        struct offload_job *next = job->next;
+        offload_complete(w, (struct heavy_job *)job);
+        job = next;
+    }
+    if (g_engine == ENGINE_URING) {
+        worker_submit(w);
+    }
+}
+
+static void offload_cb(evutil_socket_t fd, short events, void *arg) {
+    (void)fd;
+    (void)events;
+    struct worker *w = arg;
+    loop_callback(w);
+    offload_drain(w);
+}
+
+// Busy action: answer before reading anything, so shedding a connection
+// costs one accept and one send. A TLS client expects a handshake, and
+// plaintext would read as a protocol error, so it is closed without a reply.
+static int overload_reject(struct worker *w, int fd, int tls) {
+    if (!w->overloaded || g_overload_action != OVERLOAD_BUSY) {
+        return 0;
+    }
+    if (!tls) {
+        static const char busy[] = "503 BUSY\n";
+        ssize_t n = send(fd, busy, sizeof(busy) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+        (void)n;
+    }
+    close(fd);
+    stat_add(&w->stats.overload_busy, 1);
+    return 1;
+}
+
+// The handshake runs inside the bufferevent; the read and write callbacks
+// only ever see plaintext.
+static struct bufferevent *tls_bufferevent_new(struct worker *w, int fd) {
+    SSL *ssl = SSL_new(g_tls_ctx);
+    if (!ssl) {
+        return NULL;
+    }
+    struct bufferevent *bev = bufferevent_openssl_socket_new(w->base, fd, ssl,
+        BUFFEREVENT_SSL_ACCEPTING, BEV_OPT_CLOSE_ON_FREE);
+    if (!bev) {
+        SSL_free(ssl);
+        return NULL;
+    }
+    // Clients that just close the socket are ordinary EOFs, not errors.
+    bufferevent_openssl_set_allow_dirty_shutdown(bev, 1);
+    // A handshake flight can take several writes; with Nagle the later ones
+    // wait on the client's delayed ACK (about 40 ms per full handshake).
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return bev;
+}
+
+// Serves the TCP listener and the --unix one alike. Every worker watches the
+// shared UNIX listener, so a connection there can wake several of them; the
+// ones that lose the race get EAGAIN.
+static void accept_cb(evutil_socket_t fd, short events, void *arg) {
+    (void)events;
+    struct worker *w = arg;
+    int is_unix = fd == g_unix_fd;
+    loop_callback(w);
+
+    for (int budget = g_accept_budget; ; budget--) {
+        if (budget == 0) {
+            // The listen event is level-triggered, so whatever is still queued
+            // fires again after this iteration's other ready events run.
+            stat_add(&w->stats.accept_budget_exhausted, 1);
+            return;
+        }
+        struct sockaddr_storage client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_fd = accept4(fd, (struct sockaddr *)&client_addr, &client_len,
+            SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            // EMFILE and friends repeat on every wakeup; don't let them flood.
+            LOG_RATELIMIT(LOG_WARN, 1, "server: accept: %s", strerror(errno));
+            return;
+        }
+
+        if (overload_reject(w, client_fd, g_tls_ctx && !is_unix)) {
+            continue;
+        }
+        if (g_engine == ENGINE_EPOLL) {
+            if (epoll_attach(w, client_fd, &client_addr, client_len) < 0) {
+                close(client_fd);
+            }
+            continue;
+        }
+        struct client *c = client_open(w, client_fd, &client_addr, client_len);
+        if (!c) {
+            close(client_fd);
+            continue;
+        }
+        // The socket file's permissions guard same-host clients; TLS is for
+        // the network port.
+        if (g_tls_ctx && !is_unix) {
+            c->bev = tls_bufferevent_new(w, client_fd);
+        } else {
+            c->bev = bufferevent_socket_new(w->base, client_fd, BEV_OPT_CLOSE_ON_FREE);
+        }
+        if (!c->bev) {
+            client_release(w, c);
+            close(client_fd);
+            continue;
+        }
+        c->in = bufferevent_get_input(c->bev);
+        c->out = bufferevent_get_output(c->bev);
+        bufferevent_setcb(c->bev, client_read_cb, client_write_cb, client_event_cb, c);
+        evbuffer_add_cb(c->in, input_count_cb, c);
+        evbuffer_add_cb(c->out, output_count_cb, c);
+        client_start(c);
+        if (is_unix) {
+            stat_add(&w->stats.accepted_unix, 1);
+        }
+        bufferevent_enable(c->bev, EV_READ | EV_WRITE);
+    }
+}
+
+static void uring_arm_accept(struct worker *w) {
+    struct io_uring_sqe *sqe = worker_sqe(w);
+    if (!sqe) {
+        LOG(LOG_ERROR, "server: worker %d cannot re-arm accept", w->id);
+        return;
+    }
+    uring_prep_multishot_accept(sqe, w->listener_fd, SOCK_CLOEXEC, URING_OP_ACCEPT);
+    w->accept_armed = 1;
+}
+
+static void uring_handle_accept(struct worker *w, const struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        w->accept_armed = 0;
+        if (!w->accept_paused) {
+            uring_arm_accept(w);
+        }
+    }
+    // ECANCELED is accept_pause withdrawing the multishot on purpose.
+    if (cqe->res == -ECANCELED) {
+        return;
+    }
+    if (cqe->res < 0) {
+        LOG_RATELIMIT(LOG_WARN, 1, "server: accept: %s", strerror(-cqe->res));
+        return;
+    }
+
+    int fd = cqe->res;
+    if (overload_reject(w, fd, 0)) {
+        return;
+    }
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    // Multishot accept has nowhere to return addresses, and the per-IP
+    // limiter needs one before the first request.
+    if (getpeername(fd, (struct sockaddr *)&addr, &addr_len) < 0) {
+        close(fd);
+        return;
+    }
+    struct client *c = client_open(w, fd, &addr, addr_len);
+    if (!c) {
+        close(fd);
+        return;
+    }
+    c->in = evbuffer_new();
+    c->out = evbuffer_new();
+    c->sending = evbuffer_new();
+    if (!c->in || !c->out || !c->sending) {
+        if (c->in) {
+            evbuffer_free(c->in);
+        }
+        if (c->out) {
+            evbuffer_free(c->out);
+        }
+        if (c->sending) {
+            evbuffer_free(c->sending);
+        }
+        client_release(w, c);
+        close(fd);
+        return;
+    }
+    client_start(c);
+    c->reading = 1;
+    uring_arm_recv(c);
+}
+
+static void uring_handle_recv(struct worker *w, struct client *c, const struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        c->recv_armed = 0;
+    }
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        // Copy out and hand the buffer straight back: a client sitting on half
+        // a line must not pin a slot the whole worker shares.
+        if (cqe->res > 0 && !c->closing) {
+            evbuffer_add(c->in, uring_buf_ring_buffer(&w->bufs, bid), (size_t)cqe->res);
+        }
+        uring_buf_ring_recycle(&w->bufs, bid);
+    }
+    if (c->closing) {
+        uring_maybe_release(c);
+        return;
+    }
+
+    if (cqe->res == 0) {
+        stat_add(&w->stats.closed_by_client, 1);
+        log_disconnect(c, "eof");
+        close_client(c);
+        return;
+    }
+    // ENOBUFS (buffer ring ran dry) and ECANCELED (paused) just end the
+    // multishot; it is re-armed below if the client is still reading.
+    if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+        if (LOG_ENABLED(LOG_DEBUG)) {
+            char reason[128];
+            snprintf(reason, sizeof(reason), "error:%s", strerror(-cqe->res));
+            log_disconnect(c, reason);
+        }
+        close_client(c);
+        return;
+    }
+    if (cqe->res > 0) {
+        c->last_read_ms = cached_now_ms(w);
+        if (c->reading) {
+            if (uring_parse(c)) {
+                return;
+            }
+        } else {
+            // Landed before the cancel did; parsed once reads resume.
+            mem_sync(c);
+        }
+    }
+    if (!c->recv_armed && c->reading) {
+        uring_arm_recv(c);
+    }
+}
+
+static void uring_handle_send(struct worker *w, struct client *c, const struct io_uring_cqe *cqe) {
+    c->send_inflight = 0;
+    if (c->closing) {
+        uring_maybe_release(c);
+        return;
+    }
+    if (cqe->res < 0) {
+        if (LOG_ENABLED(LOG_DEBUG)) {
+            char reason[128];
+            snprintf(reason, sizeof(reason), "error:%s", strerror(-cqe->res));
+            log_disconnect(c, reason);
+        }
+        close_client(c);
+        return;
+    }
+    evbuffer_drain(c->sending, (size_t)cqe->res);
+    c->last_write_ms = cached_now_ms(w);
+    uring_flush(c);
+    int was_reading = c->reading;
+    client_output_drained(c);
+    if (!was_reading && c->reading && evbuffer_get_length(c->in) > 0) {
+        uring_parse(c);
+    }
+}
+
+// The ring fd polls readable while completions are waiting, so the worker's
+// event loop wakes for io_uring exactly as it would for a socket. Everything
+// prepared while handling the batch goes out in one submit at the end.
+static void uring_ring_cb(evutil_socket_t fd, short events, void *arg) {
+    (void)fd;
+    (void)events;
+    struct worker *w = arg;
+    unsigned ready;
 
-    if (events & BEV_EVENT_TIMEOUT) {
-        g_stats.timeouts++;
-        log_disconnect(c, "timeout");
-        close_client(c);
+    while ((ready = uring_cq_ready(&w->ring)) > 0) {
+        for (unsigned i = 0; i < ready; i++) {
+            const struct io_uring_cqe *cqe = uring_peek_cqe(&w->ring, i);
+            loop_callback(w);
+            struct client *c = (struct client *)(uintptr_t)(cqe->user_data & ~URING_OP_MASK);
+            switch ((enum uring_op)(cqe->user_data & URING_OP_MASK)) {
+            case URING_OP_ACCEPT:
+                uring_handle_accept(w, cqe);
+                break;
+            case URING_OP_RECV:
+                uring_handle_recv(w, c, cqe);
+                break;
+            case URING_OP_SEND:
+                uring_handle_send(w, c, cqe);
+                break;
+            case URING_OP_CANCEL:
+                // The cancelled recv reports itself; its client may be gone.
+                break;
+            }
+        }
+        uring_cq_advance(&w->ring, ready);
+    }
+    worker_submit(w);
+}
+
+static int uring_worker_init(struct worker *w) {
+    int rc = uring_init(&w->ring, URING_SQ_ENTRIES, URING_CQ_ENTRIES);
+    if (rc < 0) {
+        fprintf(stderr, "server: io_uring setup failed: %s\n", strerror(-rc));
+        return -1;
+    }
+    rc = uring_buf_ring_init(&w->ring, &w->bufs, URING_BGID, URING_BUF_COUNT, URING_BUF_SIZE);
+    if (rc < 0) {
+        fprintf(stderr, "server: io_uring buffer ring failed: %s\n", strerror(-rc));
+        uring_free(&w->ring);
+        return -1;
+    }
+    w->ring_event = event_new(w->base, w->ring.fd, EV_READ | EV_PERSIST, uring_ring_cb, w);
+    if (!w->ring_event || event_add(w->ring_event, NULL) < 0) {
+        fprintf(stderr, "server: failed to add io_uring event\n");
+        if (w->ring_event) {
+            event_free(w->ring_event);
+            w->ring_event = NULL;
+        }
+        uring_buf_ring_free(&w->ring, &w->bufs);
+        uring_free(&w->ring);
+        return -1;
+    }
+    uring_arm_accept(w);
+    worker_submit(w);
+    return 0;
+}
+
+// The listener stays level-triggered so the accept budget works as with
+// libevent: whatever is left over reports again on the next wait.
+static int epoll_listen(struct worker *w, int op) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    return epoll_ctl(w->epfd, op, w->listener_fd, &ev);
+}
+
+static int epoll_worker_init(struct worker *w) {
+    w->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (w->epfd < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+    if (epoll_listen(w, EPOLL_CTL_ADD) < 0) {
+        perror("epoll_ctl");
+        close(w->epfd);
+        w->epfd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// Refuse action: take the listener out of the loop. Connections queue in
+// the kernel backlog (this worker's, with SO_REUSEPORT) until it is back.
+static void accept_pause(struct worker *w, int pause) {
+    if (w->accept_paused == pause) {
+        return;
+    }
+    w->accept_paused = pause;
+    if (g_engine == ENGINE_URING) {
+        if (pause && w->accept_armed) {
+            struct io_uring_sqe *sqe = worker_sqe(w);
+            if (sqe) {
+                uring_prep_cancel(sqe, uring_tag(NULL, URING_OP_ACCEPT), uring_tag(NULL, URING_OP_CANCEL));
+            }
+        } else if (!pause && !w->accept_armed) {
+            // Otherwise the cancelled accept's last completion re-arms it.
+            uring_arm_accept(w);
+        }
+    } else if (g_engine == ENGINE_EPOLL) {
+        epoll_listen(w, pause ? EPOLL_CTL_DEL : EPOLL_CTL_ADD);
+    } else {
+        struct event *events[] = { w->listen_event, w->unix_event };
+        for (size_t i = 0; i < sizeof(events) / sizeof(events[0]); i++) {
+            if (!events[i]) {
+                continue;
+            }
+            if (pause) {
+                event_del(events[i]);
+            } else {
+                event_add(events[i], NULL);
+            }
+        }
+    }
+}
+
+// Heartbeat: the wheel tick is due every WHEEL_TICK_MS, so anything beyond
+// that between two ticks is time the loop spent busy. That lag, or a single
+// iteration, past --overload-lag enters overload; both under half of it
+// leave it again.
+static void loop_heartbeat(struct worker *w) {
+    uint64_t now = monotonic_ns();
+    uint64_t worst = w->worst_iteration_ns;
+    uint64_t prev = w->heartbeat_ns;
+    w->heartbeat_ns = now;
+    w->worst_iteration_ns = 0;
+    if (prev == 0) {
         return;
     }
+    uint64_t period = WHEEL_TICK_MS * 1000000ull;
+    uint64_t lag = now - prev > period ? now - prev - period : 0;
+    hist_record(&w->loop_lag, lag);
+    __atomic_store_n(&w->stats.loop_lag_us, (unsigned long)(lag / 1000), __ATOMIC_RELAXED);
 
-    if (events & BEV_EVENT_EOF) {
-        g_stats.closed_by_client++;
-        log_disconnect(c, "eof");
-        close_client(c);
+    if (g_overload_lag_ms == 0) {
         return;
     }
+    uint64_t limit = g_overload_lag_ms * 1000000ull;
+    uint64_t signal = lag > worst ? lag : worst;
+    if (!w->overloaded && signal > limit) {
+        w->overloaded = 1;
+        stat_add(&w->stats.overloaded, 1);
+        stat_add(&w->stats.overload_events, 1);
+        LOG_RATELIMIT(LOG_WARN, 1, "server: worker %d overloaded (lag %llu ms, iteration %llu ms)",
+            w->id, (unsigned long long)(lag / 1000000), (unsigned long long)(worst / 1000000));
+        if (g_overload_action == OVERLOAD_REFUSE) {
+            accept_pause(w, 1);
+        }
+    } else if (w->overloaded && signal < limit / 2) {
+        w->overloaded = 0;
+        stat_sub(&w->stats.overloaded, 1);
+        LOG(LOG_INFO, "server: worker %d no longer overloaded", w->id);
+        accept_pause(w, 0);
+    }
+}
 
-    if (events & BEV_EVENT_ERROR) {
-        if (g_verbose) {
-            int err = EVUTIL_SOCKET_ERROR();
-            const char *err_str = evutil_socket_error_to_string(err);
-            char reason[128];
-            snprintf(reason, sizeof(reason), "error:%s", err_str);
-            log_disconnect(c, reason);
+// Closes the worker's biggest buffer holders, largest first, until the total
+// is low enough for paused connections to resume. One pass over the
+// connection list picks the MEM_SHED_BATCH candidates; the next tick takes
+// more if needed.
+static void mem_shed(struct worker *w) {
+    struct client *worst[MEM_SHED_BATCH];
+    int n = 0;
+
+    for (struct client *c = w->clients; c; c = c->next) {
+        if (c->mem_accounted == 0) {
+            continue;
         }
-        close_client(c);
+        int i = n < MEM_SHED_BATCH ? n++ : MEM_SHED_BATCH;
+        while (i > 0 && worst[i - 1]->mem_accounted < c->mem_accounted) {
+            if (i < MEM_SHED_BATCH) {
+                worst[i] = worst[i - 1];
+            }
+            i--;
+        }
+        if (i < MEM_SHED_BATCH) {
+            worst[i] = c;
+        }
+    }
+    for (int i = 0; i < n && mem_over(MEM_RESUME_PCT); i++) {
+        stat_add(&w->stats.mem_shed, 1);
+        log_disconnect(worst[i], "shed");
+        close_client(worst[i]);
+        mem_publish(w);
     }
 }
 
-static void accept_cb(evutil_socket_t fd, short events, void *arg) {
+// Budget policy, in order: over budget, connections pause as they read
+// (maybe_pause_reads); over by MEM_SHED_PCT, or paused for MEM_SHED_GRACE_MS
+// without the total dropping (holders that never drain, such as a stalled
+// half-received frame), the largest are shed; back under MEM_RESUME_PCT,
+// everything the budget paused reads again.
+static void mem_tick(struct worker *w, uint64_t now_ms) {
+    if (g_mem_budget == 0) {
+        return;
+    }
+    mem_publish(w);
+    int paused = __atomic_load_n(&w->stats.mem_paused, __ATOMIC_RELAXED) > 0;
+    if (paused && mem_over(MEM_RESUME_PCT)) {
+        if (w->mem_stuck_since_ms == 0) {
+            w->mem_stuck_since_ms = now_ms;
+        }
+    } else {
+        w->mem_stuck_since_ms = 0;
+    }
+    if (mem_over(MEM_SHED_PCT) ||
+        (w->mem_stuck_since_ms && now_ms - w->mem_stuck_since_ms >= MEM_SHED_GRACE_MS)) {
+        mem_shed(w);
+        return;
+    }
+    if (!paused || mem_over(MEM_RESUME_PCT)) {
+        return;
+    }
+    struct client *next;
+    for (struct client *c = w->clients; c; c = next) {
+        next = c->next;
+        if (!c->mem_paused) {
+            continue;
+        }
+        c->mem_paused = 0;
+        stat_sub(&w->stats.mem_paused, 1);
+        if (client_output_len(c) > OUT_LOW_WM) {
+            continue; // its own drain resumes it
+        }
+        client_resume_reads(c);
+        if (g_engine == ENGINE_EPOLL) {
+            // Data that arrived while paused raised no new edge.
+            epoll_read(c);
+        } else if (g_engine == ENGINE_URING && evbuffer_get_length(c->in) > 0) {
+            uring_parse(c);
+        }
+    }
+}
+
+// Publishes the handshakes-per-second rate about once a second.
+static void tls_tick(struct worker *w, uint64_t now_ms) {
+    if (now_ms - w->tls_rate_ms < 1000) {
+        return;
+    }
+    unsigned long done = w->stats.tls_handshakes;
+    unsigned long rate = (done - w->tls_rate_mark) * 1000 / (unsigned long)(now_ms - w->tls_rate_ms);
+    __atomic_store_n(&w->stats.tls_handshake_rate, rate, __ATOMIC_RELAXED);
+    w->tls_rate_mark = done;
+    w->tls_rate_ms = now_ms;
+}
+
+// Per-tick housekeeping for every engine: loop health, connection timeouts,
+// the memory budget, then a slice of the KV store's sampled expiry and rehashing.
+static void worker_tick(struct worker *w, uint64_t now_ms) {
+    loop_heartbeat(w);
+    if (g_tls_ctx) {
+        tls_tick(w, now_ms);
+    }
+    timer_wheel_advance(&w->wheel, now_ms, client_timer_expire, w);
+    mem_tick(w, now_ms);
+    kv_maintain(g_kv, cached_wall_ms(w));
+    if (g_engine == ENGINE_URING) {
+        // Whatever the tick queued (accept changes, recvs of resumed clients)
+        // must not wait for the next completion to be submitted.
+        worker_submit(w);
+    }
+}
+
+static void wheel_tick_cb(evutil_socket_t fd, short events, void *arg) {
+    (void)fd;
     (void)events;
-    struct event_base *base = arg;
+    struct worker *w = arg;
+    loop_callback(w);
+    worker_tick(w, cached_now_ms(w));
+}
+
+// The worker's event_base is never dispatched with this engine: one
+// epoll_wait per iteration, one clock read after it for the cached time, and
+// the timeout wheel ticked from the wait timeout.
+static void epoll_loop(struct worker *w) {
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    uint64_t next_tick_ms = w->now_us / 1000 + WHEEL_TICK_MS;
 
     for (;;) {
-        struct sockaddr_storage client_addr;
-        socklen_t client_len = sizeof(client_addr);
-        int client_fd = accept(fd, (struct sockaddr *)&client_addr, &client_len);
-        if (client_fd < 0) {
-            if (errno == EINTR) {
-                continue;
-            }
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                return;
-            }
-            perror("accept");
+        uint64_t now_ms = w->now_us / 1000;
+        int timeout = next_tick_ms > now_ms ? (int)(next_tick_ms - now_ms) : 0;
+        int n = epoll_wait(w->epfd, events, EPOLL_MAX_EVENTS, timeout);
+        if (n < 0 && errno != EINTR) {
+            LOG(LOG_ERROR, "server: worker %d epoll_wait: %s", w->id, strerror(errno));
             return;
         }
+        clock_refresh(w);
+        // A client only closes itself or from the wheel and offload
+        // completions below, and the kernel reports each fd once per wait,
+        // so no event here is stale.
+        int offload_ready = 0;
+        for (int i = 0; i < n; i++) {
+            if (!events[i].data.ptr) {
+                accept_cb(w->listener_fd, EV_READ, w);
+            } else if (events[i].data.ptr == &w->offload_done) {
+                offload_ready = 1;
+            } else {
+                loop_callback(w);
+                epoll_client_event(events[i].data.ptr, events[i].events);
+            }
+        }
+        if (offload_ready) {
+            loop_callback(w);
+            offload_drain(w);
+        }
+        now_ms = w->now_us / 1000;
+        if (now_ms >= next_tick_ms) {
+            loop_callback(w);
+            worker_tick(w, now_ms);
+            next_tick_ms = now_ms + WHEEL_TICK_MS;
+        }
+        loop_iteration_end(w);
+    }
+}
 
-        struct client *c = calloc(1, sizeof(*c));
-        if (!c) {
-            close(client_fd);
-            continue;
+static void worker_engine_free(struct worker *w) {
+    if (g_engine == ENGINE_EPOLL && w->epfd >= 0) {
+        close(w->epfd);
+        w->epfd = -1;
+    }
+    if (w->listen_event) {
+        event_free(w->listen_event);
+    }
+    if (w->unix_event) {
+        event_free(w->unix_event);
+    }
+    if (w->ring_event) {
+        event_free(w->ring_event);
+    }
+    if (w->offload_event) {
+        event_free(w->offload_event);
+    }
+    offload_done_free(&w->offload_done);
+    uring_buf_ring_free(&w->ring, &w->bufs);
+    uring_free(&w->ring);
+}
+
+// Registers the worker's TCP listener, if it has one, and the shared UNIX
+// listener with its event loop.
+static int listen_events_init(struct worker *w) {
+    if (w->listener_fd >= 0) {
+        w->listen_event = event_new(w->base, w->listener_fd, EV_READ | EV_PERSIST, accept_cb, w);
+        if (!w->listen_event || event_add(w->listen_event, NULL) < 0) {
+            fprintf(stderr, "server: failed to add listen event\n");
+            return -1;
+        }
+    }
+    if (g_unix_fd >= 0) {
+        w->unix_event = event_new(w->base, g_unix_fd, EV_READ | EV_PERSIST, accept_cb, w);
+        if (!w->unix_event || event_add(w->unix_event, NULL) < 0) {
+            fprintf(stderr, "server: failed to add unix listen event\n");
+            return -1;
         }
+    }
+    return 0;
+}
 
-        format_peer(&client_addr, client_len, c->peer, sizeof(c->peer));
-        evutil_gettimeofday(&c->connected_at, NULL);
-        c->bev = bufferevent_socket_new(base, client_fd, BEV_OPT_CLOSE_ON_FREE);
-        if (!c->bev) {
-            close_client(c);
-            continue;
+// Completions wake the loop through the eventfd: an event on the base for
+// the libevent and io_uring engines, a sentinel entry in the epoll set.
+static int offload_worker_init(struct worker *w) {
+    if (offload_done_init(&w->offload_done) < 0) {
+        return -1;
+    }
+    if (g_engine == ENGINE_EPOLL) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = &w->offload_done;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->offload_done.efd, &ev) < 0) {
+            perror("epoll_ctl");
+            return -1;
         }
-        bucket_init(c);
-        g_stats.total_accepted++;
-        g_stats.active_connections++;
+        return 0;
+    }
+    w->offload_event = event_new(w->base, w->offload_done.efd, EV_READ | EV_PERSIST, offload_cb, w);
+    if (!w->offload_event || event_add(w->offload_event, NULL) < 0) {
+        fprintf(stderr, "server: failed to add offload event\n");
+        return -1;
+    }
+    return 0;
+}
 
-        bufferevent_setcb(c->bev, client_read_cb, client_write_cb, client_event_cb, c);
-        {
-            struct timeval read_tv = { READ_TIMEOUT_SEC, 0 };
-            struct timeval write_tv = { WRITE_TIMEOUT_SEC, 0 };
-            bufferevent_set_timeouts(c->bev, &read_tv, &write_tv);
+static void close_listener(struct worker *w) {
+    if (w->listener_fd >= 0) {
+        close(w->listener_fd);
+        w->listener_fd = -1;
+    }
+}
+
+static void worker_free(struct worker *w) {
+    event_free(w->wheel_tick);
+    client_pool_free(&w->pool);
+    file_cache_free(&w->files);
+    worker_engine_free(w);
+    event_base_free(w->base);
+    close_listener(w);
+}
+
+// A NULL port leaves the worker without a TCP listener (--unix only).
+static int worker_init(struct worker *w, int id, const char *port) {
+    w->id = id;
+    w->cpu = g_num_cpus > 0 ? g_cpus[id % g_num_cpus] : -1;
+    w->listener_fd = -1;
+    w->offload_done.efd = -1;
+    if (port) {
+        w->listener_fd = create_listener_socket(port, g_num_workers > 1);
+        if (w->listener_fd < 0) {
+            return -1;
         }
-        bufferevent_enable(c->bev, EV_READ | EV_WRITE);
+    }
+    // The reuseport lookup prefers the listener whose incoming CPU matches
+    // the CPU handling the SYN (reliably so since Linux 6.2).
+    if (g_steer == STEER_INCOMING_CPU &&
+        setsockopt(w->listener_fd, SOL_SOCKET, SO_INCOMING_CPU, &w->cpu, sizeof(w->cpu)) < 0) {
+        fprintf(stderr, "server: SO_INCOMING_CPU: %s\n", strerror(errno));
+        close_listener(w);
+        return -1;
+    }
+
+    w->base = event_base_new();
+    if (!w->base) {
+        fprintf(stderr, "server: failed to create event_base\n");
+        close_listener(w);
+        return -1;
+    }
+
+    if (g_engine == ENGINE_URING) {
+        if (uring_worker_init(w) < 0) {
+            event_base_free(w->base);
+            close_listener(w);
+            return -1;
+        }
+    } else if (g_engine == ENGINE_EPOLL) {
+        if (epoll_worker_init(w) < 0) {
+            event_base_free(w->base);
+            close_listener(w);
+            return -1;
+        }
+    } else if (listen_events_init(w) < 0) {
+        worker_engine_free(w);
+        event_base_free(w->base);
+        close_listener(w);
+        return -1;
+    }
+
+    if (client_pool_init(&w->pool, g_pool_capacity) < 0) {
+        fprintf(stderr, "server: failed to preallocate client pool\n");
+        worker_engine_free(w);
+        event_base_free(w->base);
+        close_listener(w);
+        return -1;
+    }
+
+    if (g_file_root_fd >= 0 && file_cache_init(&w->files, g_file_root_fd, g_file_cache_capacity) < 0) {
+        fprintf(stderr, "server: failed to allocate file cache\n");
+        client_pool_free(&w->pool);
+        worker_engine_free(w);
+        event_base_free(w->base);
+        close_listener(w);
+        return -1;
+    }
+
+    // One coarse tick per worker drives every connection's read/write timeout.
+    clock_refresh(w);
+    timer_wheel_init(&w->wheel, WHEEL_TICK_MS, cached_now_ms(w));
+    w->wheel_tick = event_new(w->base, -1, EV_PERSIST, wheel_tick_cb, w);
+    {
+        struct timeval tick = { 0, WHEEL_TICK_MS * 1000 };
+        if (!w->wheel_tick || event_add(w->wheel_tick, &tick) < 0) {
+            fprintf(stderr, "server: failed to start timeout wheel\n");
+            if (w->wheel_tick) {
+                event_free(w->wheel_tick);
+            }
+            file_cache_free(&w->files);
+            client_pool_free(&w->pool);
+            worker_engine_free(w);
+            event_base_free(w->base);
+            close_listener(w);
+            return -1;
+        }
+    }
+
+    if (g_offload_threads > 0 && offload_worker_init(w) < 0) {
+        worker_free(w);
+        return -1;
+    }
+    return 0;
+}
+
+static void worker_pin(struct worker *w) {
+    if (w->cpu < 0) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0) {
+        LOG(LOG_WARN, "server: worker %d cannot pin to CPU %d: %s", w->id, w->cpu, strerror(rc));
+        __atomic_store_n(&w->cpu, -1, __ATOMIC_RELAXED);
+    }
+}
+
+// SO_REUSEPORT listeners join the group in worker order, so the program
+// returns a worker id as the socket index. CPUs without a worker fall back
+// to spreading by CPU number.
+static int steer_attach_cbpf(void) {
+    struct sock_filter code[2 * MAX_THREADS + 3];
+    int n = 0;
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU));
+    for (int i = 0; i < g_num_workers; i++) {
+        code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)g_workers[i].cpu, 0, 1);
+        code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, (uint32_t)i);
+    }
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t)g_num_workers);
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+    struct sock_fprog prog = { .len = (unsigned short)n, .filter = code };
+    if (setsockopt(g_workers[0].listener_fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+            &prog, sizeof(prog)) < 0) {
+        fprintf(stderr, "server: SO_ATTACH_REUSEPORT_CBPF: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// "0-3,6": distinct CPUs this process may run on, in worker order.
+static int parse_cpu_list(const char *list) {
+    cpu_set_t allowed;
+    cpu_set_t seen;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+        perror("sched_getaffinity");
+        return -1;
+    }
+    CPU_ZERO(&seen);
+    g_num_cpus = 0;
+    const char *p = list;
+    while (*p) {
+        char *end;
+        unsigned long lo = strtoul(p, &end, 10);
+        unsigned long hi = lo;
+        if (end == p) {
+            break;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtoul(p, &end, 10);
+            if (end == p || hi < lo) {
+                break;
+            }
+        }
+        for (unsigned long cpu = lo; cpu <= hi; cpu++) {
+            if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed)) {
+                fprintf(stderr, "server: --cpus: CPU %lu is not available\n", cpu);
+                return -1;
+            }
+            if (CPU_ISSET(cpu, &seen)) {
+                fprintf(stderr, "server: --cpus: CPU %lu listed twice\n", cpu);
+                return -1;
+            }
+            if (g_num_cpus == MAX_THREADS) {
+                fprintf(stderr, "server: --cpus: at most %d CPUs\n", MAX_THREADS);
+                return -1;
+            }
+            CPU_SET(cpu, &seen);
+            g_cpus[g_num_cpus++] = (int)cpu;
+        }
+        p = end;
+        if (*p == '\0') {
+            return 0;
+        }
+        if (*p != ',') {
+            break;
+        }
+        p++;
+    }
+    fprintf(stderr, "server: --cpus: bad CPU list '%s'\n", list);
+    return -1;
+}
 
-        printf("server: client connected\n");
-        if (g_verbose) {
-            printf("server: peer %s connected\n", c->peer);
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+    if (log_attach_thread() < 0) {
+        fprintf(stderr, "server: worker %d logging synchronously\n", w->id);
+    }
+    worker_pin(w);
+    if (g_engine == ENGINE_EPOLL) {
+        epoll_loop(w);
+    } else {
+        // One iteration per call rather than event_base_dispatch, so each
+        // iteration's busy time can be closed off when it returns.
+        while (event_base_loop(w->base, EVLOOP_ONCE) == 0) {
+            loop_iteration_end(w);
         }
     }
+    return NULL;
+}
+
+static int parse_on_off(const char *value, int *out) {
+    if (strcmp(value, "on") == 0) {
+        *out = 1;
+    } else if (strcmp(value, "off") == 0) {
+        *out = 0;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s <port|-> [-v] [--threads N] [--coalesce] [--cork none|more|tcp]\n"
+        "       [--pool N] [--rate R] [--burst B] [--ip-rate R] [--ip-burst B]\n"
+        "       [--log-level debug|info|warn|error] [--log-sample N]\n"
+        "       [--backlog N] [--defer-accept SEC] [--accept-budget N]\n"
+        "       [--engine=libevent|uring|epoll] [--kv-max-memory BYTES]\n"
+        "       [--file-root DIR] [--file-cache N] [--file-copy] [--mem-budget BYTES]\n"
+        "       [--overload-lag MS] [--overload-action busy|refuse]\n"
+        "       [--cpus LIST] [--steer none|incoming-cpu|cbpf]\n"
+        "       [--tls-cert FILE --tls-key FILE] [--tls-cache N] [--tls-tickets on|off]\n"
+        "       [--ktls on|off] [--unix PATH] [--offload-threads N]\n"
+        "       A port of - serves only the --unix socket.\n", prog);
 }
 
 int main(int argc, char **argv) {
-    if (argc < 2 || argc > 3) {
-        fprintf(stderr, "usage: %s <port> [-v]\n", argv[0]);
+    if (argc < 2) {
+        usage(argv[0]);
         return 1;
     }
 
-    if (argc == 3) {
-        if (strcmp(argv[2], "-v") == 0) {
-            g_verbose = 1;
+    enum log_level log_level = LOG_INFO;
+    int threads_set = 0;
+    struct tls_config tls = { NULL, NULL, TLS_CACHE_DEFAULT, 1, 1 };
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            log_level = LOG_DEBUG;
+        } else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc) {
+            if (log_level_parse(argv[++i], &log_level) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--log-sample") == 0 && i + 1 < argc) {
+            g_log_sample = (unsigned)strtoul(argv[++i], NULL, 10);
+            if (g_log_sample == 0) {
+                fprintf(stderr, "server: --log-sample must be at least 1\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            g_num_workers = atoi(argv[++i]);
+            threads_set = 1;
+            if (g_num_workers < 1 || g_num_workers > MAX_THREADS) {
+                fprintf(stderr, "server: --threads must be 1..%d\n", MAX_THREADS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--offload-threads") == 0 && i + 1 < argc) {
+            g_offload_threads = atoi(argv[++i]);
+            if (g_offload_threads < 0 || g_offload_threads > MAX_THREADS) {
+                fprintf(stderr, "server: --offload-threads must be 0..%d\n", MAX_THREADS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            g_conn_rate.rate = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--burst") == 0 && i + 1 < argc) {
+            g_conn_rate.burst = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--ip-rate") == 0 && i + 1 < argc) {
+            g_ip_rate.rate = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--ip-burst") == 0 && i + 1 < argc) {
+            g_ip_rate.burst = strtoul(argv[++i], NULL, 10);
+        } else if (strncmp(argv[i], "--engine=", 9) == 0) {
+            const char *engine = argv[i] + 9;
+            if (strcmp(engine, "libevent") == 0) {
+                g_engine = ENGINE_LIBEVENT;
+            } else if (strcmp(engine, "uring") == 0) {
+                g_engine = ENGINE_URING;
+            } else if (strcmp(engine, "epoll") == 0) {
+                g_engine = ENGINE_EPOLL;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--backlog") == 0 && i + 1 < argc) {
+            g_backlog = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--defer-accept") == 0 && i + 1 < argc) {
+            g_defer_accept_sec = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--accept-budget") == 0 && i + 1 < argc) {
+            g_accept_budget = atoi(argv[++i]);
+            if (g_accept_budget < 1) {
+                fprintf(stderr, "server: --accept-budget must be at least 1\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--kv-max-memory") == 0 && i + 1 < argc) {
+            g_kv_max_memory = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--file-root") == 0 && i + 1 < argc) {
+            const char *root = argv[++i];
+            if (g_file_root_fd >= 0) {
+                close(g_file_root_fd);
+            }
+            g_file_root_fd = open(root, O_PATH | O_DIRECTORY | O_CLOEXEC);
+            if (g_file_root_fd < 0) {
+                fprintf(stderr, "server: --file-root %s: %s\n", root, strerror(errno));
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--overload-lag") == 0 && i + 1 < argc) {
+            g_overload_lag_ms = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--overload-action") == 0 && i + 1 < argc) {
+            const char *action = argv[++i];
+            if (strcmp(action, "busy") == 0) {
+                g_overload_action = OVERLOAD_BUSY;
+            } else if (strcmp(action, "refuse") == 0) {
+                g_overload_action = OVERLOAD_REFUSE;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cpus") == 0 && i + 1 < argc) {
+            if (parse_cpu_list(argv[++i]) < 0) {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--steer") == 0 && i + 1 < argc) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "none") == 0) {
+                g_steer = STEER_NONE;
+            } else if (strcmp(mode, "incoming-cpu") == 0) {
+                g_steer = STEER_INCOMING_CPU;
+            } else if (strcmp(mode, "cbpf") == 0) {
+                g_steer = STEER_CBPF;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--tls-cert") == 0 && i + 1 < argc) {
+            tls.cert_file = argv[++i];
+        } else if (strcmp(argv[i], "--tls-key") == 0 && i + 1 < argc) {
+            tls.key_file = argv[++i];
+        } else if (strcmp(argv[i], "--tls-cache") == 0 && i + 1 < argc) {
+            tls.cache_size = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--tls-tickets") == 0 && i + 1 < argc) {
+            if (parse_on_off(argv[++i], &tls.tickets) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--ktls") == 0 && i + 1 < argc) {
+            if (parse_on_off(argv[++i], &tls.ktls) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--unix") == 0 && i + 1 < argc) {
+            g_unix_path = argv[++i];
+        } else if (strcmp(argv[i], "--mem-budget") == 0 && i + 1 < argc) {
+            g_mem_budget = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--file-cache") == 0 && i + 1 < argc) {
+            g_file_cache_capacity = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--file-copy") == 0) {
+            g_file_copy = 1;
+        } else if (strcmp(argv[i], "--pool") == 0 && i + 1 < argc) {
+            g_pool_capacity = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--coalesce") == 0) {
+            g_coalesce = 1;
+        } else if (strcmp(argv[i], "--cork") == 0 && i + 1 < argc) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "none") == 0) {
+                g_cork = CORK_NONE;
+            } else if (strcmp(mode, "more") == 0) {
+                g_cork = CORK_MSG_MORE;
+            } else if (strcmp(mode, "tcp") == 0) {
+                g_cork = CORK_TCP;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
         } else {
-            fprintf(stderr, "usage: %s <port> [-v]\n", argv[0]);
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    const char *port = strcmp(argv[1], "-") == 0 ? NULL : argv[1];
+    if (!port && !g_unix_path) {
+        fprintf(stderr, "server: a port of - needs --unix\n");
+        return 1;
+    }
+    // UNIX connections are accepted straight into bufferevents; the other
+    // engines run their own accept paths on the TCP listener.
+    if (g_unix_path && g_engine != ENGINE_LIBEVENT) {
+        fprintf(stderr, "server: --unix needs the libevent engine\n");
+        return 1;
+    }
+
+    // --cpus alone runs one worker per listed CPU.
+    if (g_num_cpus > 0 && !threads_set) {
+        g_num_workers = g_num_cpus;
+    }
+    // Steering maps a CPU to one worker, so each needs a CPU of its own.
+    if (g_steer != STEER_NONE && (g_num_cpus == 0 || g_num_workers > g_num_cpus)) {
+        fprintf(stderr, "server: --steer needs --cpus with a CPU for every worker\n");
+        return 1;
+    }
+    if (g_steer != STEER_NONE && !port) {
+        fprintf(stderr, "server: --steer applies to the TCP listener\n");
+        return 1;
+    }
+
+    if (!tls.cert_file != !tls.key_file) {
+        fprintf(stderr, "server: --tls-cert and --tls-key go together\n");
+        return 1;
+    }
+    if (tls.cert_file) {
+        // TLS rides on OpenSSL bufferevents, and --coalesce writes to the
+        // socket directly.
+        if (g_engine != ENGINE_LIBEVENT || g_coalesce) {
+            fprintf(stderr, "server: TLS needs the libevent engine without --coalesce\n");
+            return 1;
+        }
+        g_tls_ctx = tls_ctx_new(&tls);
+        if (!g_tls_ctx) {
             return 1;
         }
     }
 
+    if (g_cork != CORK_NONE && !g_coalesce) {
+        fprintf(stderr, "server: --cork requires --coalesce\n");
+        return 1;
+    }
+    // io_uring already batches every reply of a wakeup into one submit, and
+    // the epoll engine's write buffer does the same job as the batch.
+    if (g_coalesce && g_engine != ENGINE_LIBEVENT) {
+        fprintf(stderr, "server: --coalesce applies to the libevent engine only\n");
+        return 1;
+    }
+
     if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
         perror("signal");
         return 1;
     }
 
-    int listener_fd = create_listener_socket(argv[1]);
-    if (listener_fd < 0) {
+    g_scan_lf = line_scan_select();
+    calibrate_clock();
+    if (command_table_build() < 0) {
         return 1;
     }
-
-    if (evutil_make_socket_nonblocking(listener_fd) < 0) {
-        perror("evutil_make_socket_nonblocking");
-        close(listener_fd);
+    if (g_conn_rate.burst == 0 || g_ip_rate.burst == 0) {
+        fprintf(stderr, "server: burst sizes must be at least 1\n");
+        return 1;
+    }
+    if (ip_limiter_init(&g_ip_limiter) < 0) {
+        fprintf(stderr, "server: out of memory\n");
+        return 1;
+    }
+    g_kv = kv_create(g_kv_max_memory);
+    if (!g_kv) {
+        fprintf(stderr, "server: out of memory\n");
         return 1;
     }
 
-    struct event_base *base = event_base_new();
-    if (!base) {
-        fprintf(stderr, "server: failed to create event_base\n");
-        close(listener_fd);
+    g_workers = aligned_alloc(CACHE_LINE, sizeof(*g_workers) * (size_t)g_num_workers);
+    if (!g_workers) {
+        fprintf(stderr, "server: out of memory\n");
         return 1;
     }
+    memset(g_workers, 0, sizeof(*g_workers) * (size_t)g_num_workers);
 
-    struct event *listen_event = event_new(base, listener_fd, EV_READ | EV_PERSIST, accept_cb, base);
-    if (!listen_event) {
-        fprintf(stderr, "server: failed to create listen event\n");
-        event_base_free(base);
-        close(listener_fd);
+    if (g_unix_path) {
+        g_unix_fd = create_unix_listener(g_unix_path);
+        if (g_unix_fd < 0) {
+            free(g_workers);
+            return 1;
+        }
+    }
+    for (int i = 0; i < g_num_workers; i++) {
+        if (worker_init(&g_workers[i], i, port) < 0) {
+            while (--i >= 0) {
+                worker_free(&g_workers[i]);
+            }
+            free(g_workers);
+            if (g_unix_fd >= 0) {
+                close(g_unix_fd);
+                unlink(g_unix_path);
+            }
+            return 1;
+        }
+    }
+    if (g_steer == STEER_CBPF && g_num_workers > 1 && steer_attach_cbpf() < 0) {
+        return 1;
+    }
+    if (g_offload_threads > 0 && offload_pool_start(&g_offload, g_offload_threads) < 0) {
         return 1;
     }
 
-    if (event_add(listen_event, NULL) < 0) {
-        fprintf(stderr, "server: failed to add listen event\n");
-        event_free(listen_event);
-        event_base_free(base);
-        close(listener_fd);
+    if (log_init(log_level) < 0) {
+        fprintf(stderr, "server: failed to start logger\n");
         return 1;
     }
+    log_attach_thread();
+    LOG(LOG_INFO, "server: listening on %s%s%s (%d thread%s, %s engine%s)",
+        port ? port : "", port && g_unix_path ? " and " : "", g_unix_path ? g_unix_path : "",
+        g_num_workers, g_num_workers == 1 ? "" : "s",
+        g_engine == ENGINE_URING ? "uring" : g_engine == ENGINE_EPOLL ? "epoll" : "libevent",
+        g_tls_ctx ? ", TLS" : "");
 
-    printf("server: listening on %s\n", argv[1]);
-    event_base_dispatch(base);
+    // Worker 0 runs on the main thread; the rest get their own threads.
+    for (int i = 1; i < g_num_workers; i++) {
+        if (pthread_create(&g_workers[i].thread, NULL, worker_main, &g_workers[i]) != 0) {
+            fprintf(stderr, "server: failed to start worker %d\n", i);
+            return 1;
+        }
+    }
+    worker_main(&g_workers[0]);
+    for (int i = 1; i < g_num_workers; i++) {
+        pthread_join(g_workers[i].thread, NULL);
+    }
 
-    event_free(listen_event);
-    event_base_free(base);
-    close(listener_fd);
+    for (int i = 0; i < g_num_workers; i++) {
+        worker_free(&g_workers[i]);
+    }
+    free(g_workers);
+    if (g_unix_fd >= 0) {
+        close(g_unix_fd);
+        unlink(g_unix_path);
+    }
+    kv_destroy(g_kv);
+    ip_limiter_free(&g_ip_limiter);
+    if (g_tls_ctx) {
+        SSL_CTX_free(g_tls_ctx);
+    }
+    if (g_file_root_fd >= 0) {
+        close(g_file_root_fd);
+    }
+    log_shutdown();
     return 0;
 }
@@ -0,0 +1,316 @@
+#include "stats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Single writer, relaxed: a plain add that keeps cross-thread reads defined.
+static void count_add(unsigned long *counter, unsigned long n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+void stats_accumulate(struct server_stats *out, const struct server_stats *shard) {
+    out->active_connections += __atomic_load_n(&shard->active_connections, __ATOMIC_RELAXED);
+    out->total_accepted += __atomic_load_n(&shard->total_accepted, __ATOMIC_RELAXED);
+    out->accept_budget_exhausted += __atomic_load_n(&shard->accept_budget_exhausted, __ATOMIC_RELAXED);
+    out->accepted_unix += __atomic_load_n(&shard->accepted_unix, __ATOMIC_RELAXED);
+    out->bytes_in += __atomic_load_n(&shard->bytes_in, __ATOMIC_RELAXED);
+    out->bytes_out += __atomic_load_n(&shard->bytes_out, __ATOMIC_RELAXED);
+    out->timeouts += __atomic_load_n(&shard->timeouts, __ATOMIC_RELAXED);
+    out->rate_limited += __atomic_load_n(&shard->rate_limited, __ATOMIC_RELAXED);
+    out->rate_limited_conn += __atomic_load_n(&shard->rate_limited_conn, __ATOMIC_RELAXED);
+    out->rate_limited_ip += __atomic_load_n(&shard->rate_limited_ip, __ATOMIC_RELAXED);
+    out->ip_table_full += __atomic_load_n(&shard->ip_table_full, __ATOMIC_RELAXED);
+    out->closed_by_client += __atomic_load_n(&shard->closed_by_client, __ATOMIC_RELAXED);
+    out->requests += __atomic_load_n(&shard->requests, __ATOMIC_RELAXED);
+    out->read_syscalls += __atomic_load_n(&shard->read_syscalls, __ATOMIC_RELAXED);
+    out->write_syscalls += __atomic_load_n(&shard->write_syscalls, __ATOMIC_RELAXED);
+    out->pool_hits += __atomic_load_n(&shard->pool_hits, __ATOMIC_RELAXED);
+    out->pool_misses += __atomic_load_n(&shard->pool_misses, __ATOMIC_RELAXED);
+    out->pool_high_water += __atomic_load_n(&shard->pool_high_water, __ATOMIC_RELAXED);
+    out->mem_buffered += __atomic_load_n(&shard->mem_buffered, __ATOMIC_RELAXED);
+    out->mem_paused += __atomic_load_n(&shard->mem_paused, __ATOMIC_RELAXED);
+    out->mem_read_pauses += __atomic_load_n(&shard->mem_read_pauses, __ATOMIC_RELAXED);
+    out->mem_shed += __atomic_load_n(&shard->mem_shed, __ATOMIC_RELAXED);
+    out->loop_iterations += __atomic_load_n(&shard->loop_iterations, __ATOMIC_RELAXED);
+    out->loop_callbacks += __atomic_load_n(&shard->loop_callbacks, __ATOMIC_RELAXED);
+    unsigned long cb_max = __atomic_load_n(&shard->loop_callbacks_max, __ATOMIC_RELAXED);
+    if (cb_max > out->loop_callbacks_max) {
+        out->loop_callbacks_max = cb_max;
+    }
+    unsigned long lag = __atomic_load_n(&shard->loop_lag_us, __ATOMIC_RELAXED);
+    if (lag > out->loop_lag_us) {
+        out->loop_lag_us = lag;
+    }
+    out->overloaded += __atomic_load_n(&shard->overloaded, __ATOMIC_RELAXED);
+    out->overload_events += __atomic_load_n(&shard->overload_events, __ATOMIC_RELAXED);
+    out->overload_busy += __atomic_load_n(&shard->overload_busy, __ATOMIC_RELAXED);
+    out->accepted_local_cpu += __atomic_load_n(&shard->accepted_local_cpu, __ATOMIC_RELAXED);
+    out->accepted_cross_cpu += __atomic_load_n(&shard->accepted_cross_cpu, __ATOMIC_RELAXED);
+    out->tls_handshakes += __atomic_load_n(&shard->tls_handshakes, __ATOMIC_RELAXED);
+    out->tls_resumed += __atomic_load_n(&shard->tls_resumed, __ATOMIC_RELAXED);
+    out->tls_failures += __atomic_load_n(&shard->tls_failures, __ATOMIC_RELAXED);
+    out->tls_ktls_tx += __atomic_load_n(&shard->tls_ktls_tx, __ATOMIC_RELAXED);
+    out->tls_ktls_rx += __atomic_load_n(&shard->tls_ktls_rx, __ATOMIC_RELAXED);
+    out->tls_handshake_rate += __atomic_load_n(&shard->tls_handshake_rate, __ATOMIC_RELAXED);
+    out->offload_jobs += __atomic_load_n(&shard->offload_jobs, __ATOMIC_RELAXED);
+    out->offload_orphaned += __atomic_load_n(&shard->offload_orphaned, __ATOMIC_RELAXED);
+    for (int id = 0; id < STATS_MAX_COMMANDS; id++) {
+        out->cmd_hits[id] += __atomic_load_n(&shard->cmd_hits[id], __ATOMIC_RELAXED);
+    }
+}
+
+static unsigned int latency_bucket(uint64_t ns) {
+    if (ns < (1u << LAT_SUB_BITS)) {
+        return (unsigned int)ns;
+    }
+    unsigned int msb = 63u - (unsigned int)__builtin_clzll(ns);
+    unsigned int sub = (unsigned int)(ns >> (msb - LAT_SUB_BITS)) & ((1u << LAT_SUB_BITS) - 1);
+    return ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) + sub;
+}
+
+// Largest ns value that lands in the bucket.
+static uint64_t latency_bucket_upper(unsigned int idx) {
+    if (idx < (1u << LAT_SUB_BITS)) {
+        return idx;
+    }
+    unsigned int shift = (idx >> LAT_SUB_BITS) - 1;
+    uint64_t sub = idx & ((1u << LAT_SUB_BITS) - 1);
+    return (((1ull << LAT_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+void hist_record(struct latency_hist *h, uint64_t ns) {
+    count_add(&h->counts[latency_bucket(ns)], 1);
+    count_add(&h->total, 1);
+    if (ns > h->max_ns) {
+        __atomic_store_n(&h->max_ns, ns, __ATOMIC_RELAXED);
+    }
+}
+
+void hist_merge(struct latency_hist *out, const struct latency_hist *h) {
+    for (unsigned int b = 0; b < LAT_BUCKETS; b++) {
+        out->counts[b] += __atomic_load_n(&h->counts[b], __ATOMIC_RELAXED);
+    }
+    out->total += __atomic_load_n(&h->total, __ATOMIC_RELAXED);
+    unsigned long max_ns = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+    if (max_ns > out->max_ns) {
+        out->max_ns = max_ns;
+    }
+}
+
+uint64_t latency_percentile(const struct latency_hist *h, double pct) {
+    unsigned long total = 0;
+    for (unsigned int b = 0; b < LAT_BUCKETS; b++) {
+        total += h->counts[b];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    unsigned long target = (unsigned long)((pct / 100.0) * (double)total + 0.5);
+    if (target < 1) {
+        target = 1;
+    }
+    unsigned long seen = 0;
+    for (unsigned int b = 0; b < LAT_BUCKETS; b++) {
+        seen += h->counts[b];
+        if (seen >= target) {
+            uint64_t upper = latency_bucket_upper(b);
+            return upper < h->max_ns ? upper : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+double cross_cpu_pct(unsigned long local, unsigned long cross) {
+    return local + cross ? 100.0 * (double)cross / (double)(local + cross) : 0.0;
+}
+
+size_t stats_format(const struct stats_report *r, char *buf, size_t cap) {
+    double per_req = r->totals.requests ?
+        (double)(r->totals.read_syscalls + r->totals.write_syscalls) / (double)r->totals.requests : 0.0;
+    unsigned long lookups = r->kv.hits + r->kv.misses;
+    double hit_ratio = lookups ? (double)r->kv.hits / (double)lookups : 0.0;
+    double per_iteration = r->totals.loop_iterations ?
+        (double)r->totals.loop_callbacks / (double)r->totals.loop_iterations : 0.0;
+    int wrote = snprintf(buf, cap,
+        "active_connections=%lu\n"
+        "total_accepted=%lu\n"
+        "accept_budget_exhausted=%lu\n"
+        "accepted_unix=%lu\n"
+        "bytes_in=%lu\n"
+        "bytes_out=%lu\n"
+        "timeouts=%lu\n"
+        "rate_limited=%lu\n"
+        "rate_limited_conn=%lu\n"
+        "rate_limited_ip=%lu\n"
+        "ip_table_full=%lu\n"
+        "closed_by_client=%lu\n"
+        "requests=%lu\n"
+        "read_syscalls=%lu\n"
+        "write_syscalls=%lu\n"
+        "syscalls_per_request=%.3f\n"
+        "pool_hits=%lu\n"
+        "pool_misses=%lu\n"
+        "pool_high_water=%lu\n"
+        "log_dropped=%lu\n"
+        "log_suppressed=%lu\n"
+        "kv_keys=%lu\n"
+        "kv_hits=%lu\n"
+        "kv_misses=%lu\n"
+        "kv_hit_ratio=%.3f\n"
+        "kv_memory_bytes=%zu\n"
+        "kv_max_memory_bytes=%zu\n"
+        "kv_table_bytes=%zu\n"
+        "kv_evictions=%lu\n"
+        "kv_expired=%lu\n"
+        "file_cache_hits=%lu\n"
+        "file_cache_misses=%lu\n"
+        "file_cache_invalidations=%lu\n"
+        "mem_buffered_bytes=%lu\n"
+        "mem_budget_bytes=%llu\n"
+        "mem_paused_connections=%lu\n"
+        "mem_read_pauses=%lu\n"
+        "mem_shed_connections=%lu\n"
+        "loop_iterations=%lu\n"
+        "loop_callbacks_per_iteration=%.2f\n"
+        "loop_callbacks_max=%lu\n"
+        "loop_iteration_us_p99=%lu\n"
+        "loop_iteration_us_max=%lu\n"
+        "loop_lag_us=%lu\n"
+        "loop_lag_us_p99=%lu\n"
+        "loop_lag_us_max=%lu\n"
+        "overloaded_workers=%lu\n"
+        "overload_events=%lu\n"
+        "overload_busy_replies=%lu\n"
+        "pinned_workers=%d\n"
+        "steering=%s\n"
+        "accepted_local_cpu=%lu\n"
+        "accepted_cross_cpu=%lu\n"
+        "cross_cpu_pct=%.1f\n"
+        "tls_handshakes=%lu\n"
+        "tls_handshakes_per_sec=%lu\n"
+        "tls_full_handshakes=%lu\n"
+        "tls_resumed_handshakes=%lu\n"
+        "tls_handshake_failures=%lu\n"
+        "tls_ktls_tx_connections=%lu\n"
+        "tls_ktls_rx_connections=%lu\n"
+        "offload_threads=%d\n"
+        "offload_queue_depth=%lu\n"
+        "offload_jobs=%lu\n"
+        "offload_orphaned=%lu\n"
+        "offload_us_p99=%lu\n"
+        "offload_us_max=%lu\n",
+        r->totals.active_connections,
+        r->totals.total_accepted,
+        r->totals.accept_budget_exhausted,
+        r->totals.accepted_unix,
+        r->totals.bytes_in,
+        r->totals.bytes_out,
+        r->totals.timeouts,
+        r->totals.rate_limited,
+        r->totals.rate_limited_conn,
+        r->totals.rate_limited_ip,
+        r->totals.ip_table_full,
+        r->totals.closed_by_client,
+        r->totals.requests,
+        r->totals.read_syscalls,
+        r->totals.write_syscalls,
+        per_req,
+        r->totals.pool_hits,
+        r->totals.pool_misses,
+        r->totals.pool_high_water,
+        r->log_dropped,
+        r->log_suppressed,
+        r->kv.keys,
+        r->kv.hits,
+        r->kv.misses,
+        hit_ratio,
+        r->kv.memory_bytes,
+        r->kv.max_memory_bytes,
+        r->kv.table_bytes,
+        r->kv.evictions,
+        r->kv.expired,
+        r->file_hits,
+        r->file_misses,
+        r->file_invalidations,
+        r->totals.mem_buffered,
+        (unsigned long long)r->mem_budget,
+        r->totals.mem_paused,
+        r->totals.mem_read_pauses,
+        r->totals.mem_shed,
+        r->totals.loop_iterations,
+        per_iteration,
+        r->totals.loop_callbacks_max,
+        (unsigned long)(latency_percentile(&r->loop_iteration, 99.0) / 1000),
+        r->loop_iteration.max_ns / 1000,
+        r->totals.loop_lag_us,
+        (unsigned long)(latency_percentile(&r->loop_lag, 99.0) / 1000),
+        r->loop_lag.max_ns / 1000,
+        r->totals.overloaded,
+        r->totals.overload_events,
+        r->totals.overload_busy,
+        r->pinned_workers,
+        r->steering,
+        r->totals.accepted_local_cpu,
+        r->totals.accepted_cross_cpu,
+        cross_cpu_pct(r->totals.accepted_local_cpu, r->totals.accepted_cross_cpu),
+        r->totals.tls_handshakes,
+        r->totals.tls_handshake_rate,
+        r->totals.tls_handshakes - r->totals.tls_resumed,
+        r->totals.tls_resumed,
+        r->totals.tls_failures,
+        r->totals.tls_ktls_tx,
+        r->totals.tls_ktls_rx,
+        r->offload_threads,
+        r->offload_queue_depth,
+        r->totals.offload_jobs,
+        r->totals.offload_orphaned,
+        (unsigned long)(latency_percentile(&r->offload, 99.0) / 1000),
+        r->offload.max_ns / 1000);
+    if (wrote < 0 || (size_t)wrote >= cap) {
+        return 0;
+    }
+    size_t used = (size_t)wrote;
+    for (size_t id = 0; id < r->num_commands; id++) {
+        wrote = snprintf(buf + used, cap - used, "cmd_%s=%lu\n",
+            r->command_names[id], r->totals.cmd_hits[id]);
+        if (wrote < 0 || (size_t)wrote >= cap - used) {
+            return 0;
+        }
+        used += (size_t)wrote;
+    }
+    return used;
+}
+
+size_t latency_format(const char *name, const struct latency_hist *h, char *buf, size_t cap,
+    size_t reserve) {
+    size_t used = 0;
+    int wrote = snprintf(buf + used, cap - used,
+        "latency_%s count=%lu p50_ns=%lu p90_ns=%lu p99_ns=%lu p999_ns=%lu max_ns=%lu buckets=",
+        name, h->total,
+        (unsigned long)latency_percentile(h, 50.0),
+        (unsigned long)latency_percentile(h, 90.0),
+        (unsigned long)latency_percentile(h, 99.0),
+        (unsigned long)latency_percentile(h, 99.9),
+        h->max_ns);
+    if (wrote < 0 || (size_t)wrote >= cap - used) {
+        return 0;
+    }
+    used += (size_t)wrote;
+
+    int first = 1;
+    for (unsigned int b = 0; b < LAT_BUCKETS; b++) {
+        if (h->counts[b] == 0) {
+            continue;
+        }
+        // Leave room for the newline of this and every remaining line.
+        wrote = snprintf(buf + used, cap - used, "%s%lu:%lu", first ? "" : ",",
+            (unsigned long)latency_bucket_upper(b), h->counts[b]);
+        if (wrote < 0 || (size_t)wrote + reserve >= cap - used) {
+            break;
+        }
+        used += (size_t)wrote;
+        first = 0;
+    }
+    buf[used++] = '\n';
+    return used;
+}
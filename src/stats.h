@@ -0,0 +1,114 @@
+#ifndef NETLOOP_STATS_H
+#define NETLOOP_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kv.h"
+
+// The protocol server's counters and latency histograms, and their text form
+// for STATS and STATS LATENCY. Gathering the numbers is the server's job;
+// everything here works on plain values, so it runs without a server.
+
+#define STATS_MAX_COMMANDS 16
+// Log-bucketed latency: LAT_SUB_BITS linear steps per power of two of ns.
+#define LAT_SUB_BITS 2
+#define LAT_BUCKETS (64 << LAT_SUB_BITS)
+
+// One shard per worker. Each shard sits on its own cache line so workers never
+// bounce lines between cores when bumping counters; STATS sums the shards.
+// Every counter has a single writer, its worker; readers load them relaxed.
+struct server_stats {
+    unsigned long active_connections;
+    unsigned long total_accepted;
+    unsigned long accept_budget_exhausted;
+    unsigned long accepted_unix; // of total_accepted, on the --unix listener
+    unsigned long bytes_in;
+    unsigned long bytes_out;
+    unsigned long timeouts;
+    unsigned long rate_limited;
+    unsigned long rate_limited_conn;
+    unsigned long rate_limited_ip;
+    unsigned long ip_table_full;
+    unsigned long closed_by_client;
+    unsigned long requests;
+    unsigned long read_syscalls;
+    unsigned long write_syscalls;
+    unsigned long pool_hits;
+    unsigned long pool_misses;
+    unsigned long pool_high_water;
+    unsigned long mem_buffered;
+    unsigned long mem_paused;
+    unsigned long mem_read_pauses;
+    unsigned long mem_shed;
+    unsigned long loop_iterations;
+    unsigned long loop_callbacks;
+    unsigned long loop_callbacks_max;
+    unsigned long loop_lag_us; // at the last heartbeat
+    unsigned long overloaded;
+    unsigned long overload_events;
+    unsigned long overload_busy;
+    // Accepted connections whose packets the kernel processed on this
+    // worker's CPU, and those it processed elsewhere.
+    unsigned long accepted_local_cpu;
+    unsigned long accepted_cross_cpu;
+    unsigned long tls_handshakes;
+    unsigned long tls_resumed;
+    unsigned long tls_failures;
+    unsigned long tls_ktls_tx;
+    unsigned long tls_ktls_rx;
+    unsigned long tls_handshake_rate; // completed over the last full second
+    unsigned long offload_jobs; // heavy commands completed on the offload pool
+    unsigned long offload_orphaned; // of those, whose connection closed first
+    unsigned long cmd_hits[STATS_MAX_COMMANDS];
+} __attribute__((aligned(64)));
+
+// Written only by the owning worker; STATS LATENCY merges all workers.
+struct latency_hist {
+    unsigned long counts[LAT_BUCKETS];
+    unsigned long total;
+    unsigned long max_ns;
+};
+
+// Everything one STATS reply prints.
+struct stats_report {
+    struct server_stats totals;
+    struct kv_stats kv;
+    unsigned long file_hits;
+    unsigned long file_misses;
+    unsigned long file_invalidations;
+    unsigned long log_dropped;
+    unsigned long log_suppressed;
+    uint64_t mem_budget;
+    struct latency_hist loop_iteration;
+    struct latency_hist loop_lag;
+    int pinned_workers;
+    const char *steering;
+    int offload_threads;
+    unsigned long offload_queue_depth;
+    struct latency_hist offload; // submit to reply queued, on the owning loop
+    const char *const *command_names; // one per cmd_hits entry in use
+    size_t num_commands;
+};
+
+// Adds one shard into a total; maxima (callbacks per iteration, lag) are
+// kept rather than summed.
+void stats_accumulate(struct server_stats *out, const struct server_stats *shard);
+
+void hist_record(struct latency_hist *h, uint64_t ns);
+void hist_merge(struct latency_hist *out, const struct latency_hist *h);
+uint64_t latency_percentile(const struct latency_hist *h, double pct);
+
+// Share of accepted connections that landed off their RX queue's CPU.
+double cross_cpu_pct(unsigned long local, unsigned long cross);
+
+// The STATS reply; returns its length, or 0 if it does not fit.
+size_t stats_format(const struct stats_report *r, char *buf, size_t cap);
+
+// One STATS LATENCY line: percentiles, then the non-empty buckets as
+// <upper_ns>:<count> pairs, cut short to keep reserve bytes free for the
+// lines after it. Returns its length, or 0 if not even the percentiles fit.
+size_t latency_format(const char *name, const struct latency_hist *h, char *buf, size_t cap,
+    size_t reserve);
+
+#endif
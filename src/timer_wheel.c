@@ -0,0 +1,91 @@
+#include "timer_wheel.h"
+
+#include <string.h>
+
+static void list_init(struct wheel_timer *head) {
+    head->prev = head;
+    head->next = head;
+}
+
+void timer_wheel_init(struct timer_wheel *w, uint64_t tick_ms, uint64_t now_ms) {
+    memset(w, 0, sizeof(*w));
+    w->tick_ms = tick_ms ? tick_ms : 1;
+    w->current_tick = now_ms / w->tick_ms;
+    for (size_t i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+        list_init(&w->slots[i]);
+    }
+}
+
+void timer_wheel_add(struct timer_wheel *w, struct wheel_timer *t, uint64_t deadline_ms) {
+    uint64_t tick = deadline_ms / w->tick_ms;
+
+    // Never land in the slot being fired (or a past one), and never wrap past
+    // the horizon: far deadlines get re-inserted when their slot comes round.
+    if (tick <= w->current_tick) {
+        tick = w->current_tick + 1;
+    } else if (tick - w->current_tick >= TIMER_WHEEL_SLOTS) {
+        tick = w->current_tick + TIMER_WHEEL_SLOTS - 1;
+    }
+
+    struct wheel_timer *head = &w->slots[tick % TIMER_WHEEL_SLOTS];
+    t->deadline_ms = deadline_ms;
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+    w->count++;
+}
+
+void timer_wheel_remove(struct timer_wheel *w, struct wheel_timer *t) {
+    if (!t->next) {
+        return;
+    }
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->prev = NULL;
+    t->next = NULL;
+    w->count--;
+}
+
+void timer_wheel_rearm(struct timer_wheel *w, struct wheel_timer *t, uint64_t deadline_ms) {
+    timer_wheel_remove(w, t);
+    timer_wheel_add(w, t, deadline_ms);
+}
+
+int timer_wheel_armed(const struct wheel_timer *t) {
+    return t->next != NULL;
+}
+
+size_t timer_wheel_advance(struct timer_wheel *w, uint64_t now_ms, timer_expire_fn expire, void *arg) {
+    uint64_t target = now_ms / w->tick_ms;
+    size_t fired = 0;
+
+    while (w->current_tick < target) {
+        w->current_tick++;
+        struct wheel_timer *head = &w->slots[w->current_tick % TIMER_WHEEL_SLOTS];
+
+        // Detach the slot first: expire may re-add into later slots or free
+        // the owner, and neither may disturb the walk.
+        struct wheel_timer due;
+        if (head->next == head) {
+            continue;
+        }
+        due.next = head->next;
+        due.prev = head->prev;
+        due.next->prev = &due;
+        due.prev->next = &due;
+        list_init(head);
+
+        while (due.next != &due) {
+            struct wheel_timer *t = due.next;
+            due.next = t->next;
+            t->next->prev = &due;
+            t->prev = NULL;
+            t->next = NULL;
+            w->count--;
+            fired++;
+            expire(t, now_ms, arg);
+        }
+    }
+    return fired;
+}
@@ -0,0 +1,41 @@
+#ifndef NETLOOP_TIMER_WHEEL_H
+#define NETLOOP_TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMER_WHEEL_SLOTS 256
+
+// Intrusive timer: embed it in the object it times out and recover the owner
+// with offsetof. Linked into exactly one slot while armed.
+struct wheel_timer {
+    struct wheel_timer *prev;
+    struct wheel_timer *next;
+    uint64_t deadline_ms;
+};
+
+// Coarse-tick hashed wheel. Arm, re-arm and cancel are O(1) list splices, and
+// an expiry pass only visits the slots whose tick has passed. Deadlines past
+// the horizon (slots * tick) park in the last reachable slot and are
+// re-inserted when it fires, so any timeout length works.
+struct timer_wheel {
+    struct wheel_timer slots[TIMER_WHEEL_SLOTS];
+    uint64_t tick_ms;
+    uint64_t current_tick;
+    size_t count;
+};
+
+typedef void (*timer_expire_fn)(struct wheel_timer *t, uint64_t now_ms, void *arg);
+
+void timer_wheel_init(struct timer_wheel *w, uint64_t tick_ms, uint64_t now_ms);
+void timer_wheel_add(struct timer_wheel *w, struct wheel_timer *t, uint64_t deadline_ms);
+void timer_wheel_remove(struct timer_wheel *w, struct wheel_timer *t);
+void timer_wheel_rearm(struct timer_wheel *w, struct wheel_timer *t, uint64_t deadline_ms);
+int timer_wheel_armed(const struct wheel_timer *t);
+
+// Fires every slot up to now_ms. Each due timer is unlinked before expire is
+// called, which may re-add it (its new deadline lands in a later slot) or free
+// its owner. Returns the number of timers handed to expire.
+size_t timer_wheel_advance(struct timer_wheel *w, uint64_t now_ms, timer_expire_fn expire, void *arg);
+
+#endif
@@ -0,0 +1,71 @@
+#include "tls.h"
+
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <stdio.h>
+
+static const unsigned char session_id_context[] = "netloop";
+
+static void print_error(const char *what, const char *file) {
+    char buf[256];
+    fprintf(stderr, "server: %s %s: %s\n", what, file,
+        tls_error_string(ERR_get_error(), buf, sizeof(buf)));
+}
+
+SSL_CTX *tls_ctx_new(const struct tls_config *cfg) {
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx) {
+        print_error("TLS", "context");
+        return NULL;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    // Partial SSL_write calls are how a bufferevent drains its output.
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+        SSL_MODE_RELEASE_BUFFERS);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, cfg->cert_file) != 1) {
+        print_error("TLS certificate", cfg->cert_file);
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    if (SSL_CTX_use_PrivateKey_file(ctx, cfg->key_file, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1) {
+        print_error("TLS key", cfg->key_file);
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+
+    SSL_CTX_set_session_id_context(ctx, session_id_context, sizeof(session_id_context) - 1);
+    if (cfg->cache_size > 0) {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx, cfg->cache_size);
+    } else {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    }
+    if (!cfg->tickets) {
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+        if (cfg->cache_size == 0) {
+            // TLS 1.3 would still issue stateful tickets for a cache that
+            // is not there.
+            SSL_CTX_set_num_tickets(ctx, 0);
+        }
+    }
+    if (cfg->ktls) {
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    }
+    return ctx;
+}
+
+void tls_session_info(SSL *ssl, struct tls_session_info *out) {
+    out->resumed = SSL_session_reused(ssl);
+    out->ktls_tx = BIO_get_ktls_send(SSL_get_wbio(ssl)) > 0;
+    out->ktls_rx = BIO_get_ktls_recv(SSL_get_rbio(ssl)) > 0;
+}
+
+const char *tls_error_string(unsigned long err, char *buf, size_t len) {
+    if (err == 0) {
+        return "unknown";
+    }
+    ERR_error_string_n(err, buf, len);
+    return buf;
+}
@@ -0,0 +1,44 @@
+#ifndef NETLOOP_TLS_H
+#define NETLOOP_TLS_H
+
+#include <openssl/ssl.h>
+
+// Server-side TLS context shared by every worker. OpenSSL locks the session
+// cache internally, so a client can resume on any worker.
+//
+// - The session cache holds up to cache_size sessions (0 turns it off) for
+//   clients resuming by session ID, or by stateful ticket when tickets are
+//   off.
+// - Stateless tickets let clients resume without any server-side state; the
+//   ticket keys are random per process, so a restart means full handshakes.
+// - With ktls, OpenSSL hands the record layer to the kernel after the
+//   handshake where the kernel and cipher allow it. SSL_read and SSL_write
+//   then move plaintext and the kernel encrypts, with no userspace crypto
+//   copies. Without kernel support connections fall back silently.
+
+#define TLS_CACHE_DEFAULT 20480
+
+struct tls_config {
+    const char *cert_file;
+    const char *key_file;
+    long cache_size;
+    int tickets;
+    int ktls;
+};
+
+// Prints the OpenSSL error to stderr and returns NULL on failure.
+SSL_CTX *tls_ctx_new(const struct tls_config *cfg);
+
+// What a finished handshake negotiated.
+struct tls_session_info {
+    int resumed;
+    int ktls_tx;
+    int ktls_rx;
+};
+
+void tls_session_info(SSL *ssl, struct tls_session_info *out);
+
+// The oldest queued OpenSSL error for a log line, or "unknown".
+const char *tls_error_string(unsigned long err, char *buf, size_t len);
+
+#endif
@@ -0,0 +1,240 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(struct uring *r, unsigned entries, unsigned cq_entries) {
+    struct io_uring_params p;
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cq_entries;
+
+    r->fd = sys_io_uring_setup(entries, &p);
+    if (r->fd < 0) {
+        return -errno;
+    }
+    // Multishot requests can outrun a full CQ; without NODROP completions
+    // would be lost instead of parked in the overflow list.
+    if (!(p.features & IORING_FEAT_NODROP) || !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(r->fd);
+        return -ENOSYS;
+    }
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (r->cq_ring_size > r->sq_ring_size) {
+        r->sq_ring_size = r->cq_ring_size;
+    }
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) {
+        int err = -errno;
+        r->sq_ring = NULL;
+        close(r->fd);
+        return err;
+    }
+    r->cq_ring = r->sq_ring; // IORING_FEAT_SINGLE_MMAP
+
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        int err = -errno;
+        munmap(r->sq_ring, r->sq_ring_size);
+        r->sq_ring = NULL;
+        close(r->fd);
+        return err;
+    }
+
+    char *sq = r->sq_ring;
+    r->sq_entries = p.sq_entries;
+    r->sq_khead = (unsigned *)(sq + p.sq_off.head);
+    r->sq_ktail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->sq_kflags = (unsigned *)(sq + p.sq_off.flags);
+
+    char *cq = r->cq_ring;
+    r->cq_khead = (unsigned *)(cq + p.cq_off.head);
+    r->cq_ktail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // The SQ index array never changes: slot i always points at SQE i.
+    for (unsigned i = 0; i < r->sq_entries; i++) {
+        r->sq_array[i] = i;
+    }
+    return 0;
+}
+
+void uring_free(struct uring *r) {
+    if (!r->sq_ring) {
+        return;
+    }
+    munmap(r->sqes, r->sqes_size);
+    munmap(r->sq_ring, r->sq_ring_size);
+    close(r->fd);
+    r->sq_ring = NULL;
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *r) {
+    unsigned head = __atomic_load_n(r->sq_khead, __ATOMIC_ACQUIRE);
+    if (r->sqe_tail - head >= r->sq_entries) {
+        return NULL;
+    }
+    struct io_uring_sqe *sqe = &r->sqes[r->sqe_tail & r->sq_mask];
+    r->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+unsigned uring_sq_pending(const struct uring *r) {
+    return r->sqe_tail - r->sqe_head;
+}
+
+int uring_submit(struct uring *r) {
+    unsigned n = r->sqe_tail - r->sqe_head;
+    // Completions that did not fit the CQ wait in the kernel's overflow list
+    // and only move back when someone asks for events.
+    unsigned flags = (__atomic_load_n(r->sq_kflags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW) ?
+        IORING_ENTER_GETEVENTS : 0;
+    if (n == 0 && flags == 0) {
+        return 0;
+    }
+    __atomic_store_n(r->sq_ktail, r->sqe_tail, __ATOMIC_RELEASE);
+    r->sqe_head = r->sqe_tail;
+    int rc;
+    do {
+        rc = sys_io_uring_enter(r->fd, n, 0, flags);
+    } while (rc < 0 && errno == EINTR);
+    return rc < 0 ? -errno : rc;
+}
+
+unsigned uring_cq_ready(const struct uring *r) {
+    return __atomic_load_n(r->cq_ktail, __ATOMIC_ACQUIRE) - *r->cq_khead;
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *r, unsigned index) {
+    return &r->cqes[(*r->cq_khead + index) & r->cq_mask];
+}
+
+void uring_cq_advance(struct uring *r, unsigned n) {
+    __atomic_store_n(r->cq_khead, *r->cq_khead + n, __ATOMIC_RELEASE);
+}
+
+int uring_buf_ring_init(struct uring *r, struct uring_buf_ring *b, uint16_t bgid,
+    unsigned entries, size_t buf_size) {
+    memset(b, 0, sizeof(*b));
+    b->br_size = entries * sizeof(struct io_uring_buf);
+    b->br = mmap(NULL, b->br_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b->br == MAP_FAILED) {
+        b->br = NULL;
+        return -errno;
+    }
+    b->bufs = malloc(entries * buf_size);
+    if (!b->bufs) {
+        munmap(b->br, b->br_size);
+        b->br = NULL;
+        return -ENOMEM;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)b->br;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    if (sys_io_uring_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        int err = -errno;
+        free(b->bufs);
+        munmap(b->br, b->br_size);
+        b->br = NULL;
+        return err;
+    }
+
+    b->entries = entries;
+    b->buf_size = buf_size;
+    b->bgid = bgid;
+    for (unsigned i = 0; i < entries; i++) {
+        uring_buf_ring_recycle(b, (uint16_t)i);
+    }
+    return 0;
+}
+
+void uring_buf_ring_free(struct uring *r, struct uring_buf_ring *b) {
+    if (!b->br) {
+        return;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = b->bgid;
+    sys_io_uring_register(r->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    free(b->bufs);
+    munmap(b->br, b->br_size);
+    b->br = NULL;
+}
+
+char *uring_buf_ring_buffer(struct uring_buf_ring *b, uint16_t bid) {
+    return b->bufs + (size_t)bid * b->buf_size;
+}
+
+void uring_buf_ring_recycle(struct uring_buf_ring *b, uint16_t bid) {
+    struct io_uring_buf *buf = &b->br->bufs[b->tail & (b->entries - 1)];
+    buf->addr = (uint64_t)(uintptr_t)uring_buf_ring_buffer(b, bid);
+    buf->len = (uint32_t)b->buf_size;
+    buf->bid = bid;
+    b->tail++;
+    __atomic_store_n(&b->br->tail, b->tail, __ATOMIC_RELEASE);
+}
+
+void uring_prep_multishot_accept(struct io_uring_sqe *sqe, int fd, int flags, uint64_t user_data) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->accept_flags = (uint32_t)flags;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int fd, uint16_t bgid, uint64_t user_data) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bgid;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *msg,
+    unsigned flags, uint64_t user_data) {
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = flags;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_cancel(struct io_uring_sqe *sqe, uint64_t target, uint64_t user_data) {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = user_data;
+}
@@ -0,0 +1,77 @@
+#ifndef NETLOOP_URING_H
+#define NETLOOP_URING_H
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Just enough io_uring for the server: ring setup over the raw syscalls (no
+// liburing), SQE/CQE access, and provided buffer rings. Single-threaded per
+// ring, like the event loops that own them.
+
+struct uring {
+    int fd;
+    unsigned sq_entries;
+    unsigned *sq_khead;
+    unsigned *sq_ktail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    unsigned *sq_kflags;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_head; // prepared but not yet published to the kernel
+    unsigned sqe_tail;
+    unsigned *cq_khead;
+    unsigned *cq_ktail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+// Kernel-shared ring of recv buffers; the kernel picks one per completion and
+// reports its id in the CQE flags.
+struct uring_buf_ring {
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    char *bufs;
+    size_t buf_size;
+    unsigned entries;
+    uint16_t bgid;
+    uint16_t tail;
+};
+
+int uring_init(struct uring *r, unsigned entries, unsigned cq_entries);
+void uring_free(struct uring *r);
+
+// Returns NULL when the submission queue is full; submit and retry.
+struct io_uring_sqe *uring_get_sqe(struct uring *r);
+
+// Publishes prepared SQEs and enters the kernel once (also when only a CQ
+// overflow needs flushing). Returns the number submitted or -errno.
+int uring_submit(struct uring *r);
+unsigned uring_sq_pending(const struct uring *r);
+
+// Completion queue walk: peek, handle, then advance past everything handled.
+struct io_uring_cqe *uring_peek_cqe(struct uring *r, unsigned index);
+unsigned uring_cq_ready(const struct uring *r);
+void uring_cq_advance(struct uring *r, unsigned n);
+
+int uring_buf_ring_init(struct uring *r, struct uring_buf_ring *b, uint16_t bgid,
+    unsigned entries, size_t buf_size);
+void uring_buf_ring_free(struct uring *r, struct uring_buf_ring *b);
+char *uring_buf_ring_buffer(struct uring_buf_ring *b, uint16_t bid);
+// Hands a consumed buffer back to the kernel.
+void uring_buf_ring_recycle(struct uring_buf_ring *b, uint16_t bid);
+
+void uring_prep_multishot_accept(struct io_uring_sqe *sqe, int fd, int flags, uint64_t user_data);
+void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int fd, uint16_t bgid, uint64_t user_data);
+void uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *msg,
+    unsigned flags, uint64_t user_data);
+// Cancels the request whose user_data is target.
+void uring_prep_cancel(struct io_uring_sqe *sqe, uint64_t target, uint64_t user_data);
+
+#endif